@@ -0,0 +1,405 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stand-alone binary to load up a FAR and compile small deterministic (or
+// subsequential) byte rules into standalone C++ source. Each rule becomes a
+// function
+//
+//   bool Rule(std::string_view input, std::string *output);
+//
+// performing the same rewrite as GrmManager::RewriteBytes. Dispatch on the
+// current state is a switch; sparse states dispatch on the input byte with a
+// nested switch, while dense states index a constexpr transition table. Output
+// strings are read from a constexpr character array.
+//
+// Rule names are mapped to function names by replacing each character which
+// cannot appear in an identifier with an underscore; rules whose names map to
+// the same function are rejected.
+
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <thrax/compat/utils.h>
+#include <fst/arc.h>
+#include <fst/fst.h>
+#include <fst/string.h>
+#include <fst/vector-fst.h>
+#include <thrax/algo/flat_dfa.h>
+#include <thrax/grm-manager.h>
+
+using ::fst::FlatDfa;
+using ::fst::StdArc;
+using ::thrax::GrmManagerSpec;
+
+DEFINE_string(far, "", "Path to the FAR.");
+DEFINE_string(rules, "", "Comma-separated names of the rules to compile.");
+DEFINE_string(output, "", "Path for the generated C++ source (default: stdout).");
+DEFINE_string(output_header, "",
+              "If non-empty, path for a header declaring the generated "
+              "functions.");
+DEFINE_string(namespace_name, "thrax_generated",
+              "C++ namespace for the generated functions.");
+DEFINE_int32(dense_state_arcs, 48,
+             "States with at least this many arcs are compiled to a "
+             "256-entry transition table rather than a switch.");
+DEFINE_string(check_inputs, "",
+              "If non-empty, path to a file with one input string per line; "
+              "the flat form each rule is compiled from is checked against "
+              "GrmManager::RewriteBytes on every line.");
+
+namespace {
+
+using Dfa = FlatDfa<StdArc>;
+using Label = StdArc::Label;
+
+// Name of the transition table type in the generated source.
+constexpr char kTransitionType[] = "Transition";
+
+// Turns a rule name into a valid C++ identifier.
+std::string FunctionName(const std::string &rule) {
+  std::string name;
+  for (const char ch : rule) {
+    name.push_back(isalnum(static_cast<unsigned char>(ch)) ? ch : '_');
+  }
+  if (name.empty() || isdigit(static_cast<unsigned char>(name[0]))) {
+    name.insert(0, "_");
+  }
+  return name;
+}
+
+// Escapes bytes for use inside a C++ string or character literal. Octal
+// escapes always have three digits so they cannot run into what follows.
+std::string Escape(const std::string &bytes) {
+  std::string escaped;
+  for (const unsigned char ch : bytes) {
+    if (isalnum(ch) || ch == ' ' || ch == '_' || ch == '-' || ch == '.' ||
+        ch == ',') {
+      escaped.push_back(ch);
+    } else {
+      escaped += thrax::StringPrintf("\\%03o", ch);
+    }
+  }
+  return escaped;
+}
+
+bool IsByte(Label label) { return label > 0 && label < 256; }
+
+// Returns the output string of an arc or final state as bytes, or false if it
+// contains a label that is not a byte.
+bool OutputBytes(const Dfa &dfa, uint32_t output, uint32_t output_size,
+                 std::string *bytes) {
+  std::vector<Label> labels;
+  dfa.AppendOutput(output, output_size, &labels);
+  bytes->clear();
+  for (const auto label : labels) {
+    if (!IsByte(label)) return false;
+    bytes->push_back(label);
+  }
+  return true;
+}
+
+// Accumulates the output strings of one rule into a single character array,
+// sharing identical strings.
+class OutputPool {
+ public:
+  uint32_t Add(const std::string &bytes) {
+    const auto it = offsets_.find(bytes);
+    if (it != offsets_.end()) return it->second;
+    const uint32_t offset = pool_.size();
+    pool_ += bytes;
+    offsets_[bytes] = offset;
+    return offset;
+  }
+
+  const std::string &Get() const { return pool_; }
+
+ private:
+  std::string pool_;
+  std::map<std::string, uint32_t> offsets_;
+};
+
+// Emits the statement(s) appending `bytes` to the output.
+void EmitAppend(const std::string &bytes, const std::string &pool_name,
+                OutputPool *pool, const std::string &indent,
+                std::ostream &strm) {
+  if (bytes.empty()) return;
+  if (bytes.size() == 1) {
+    strm << indent << "output->push_back('" << Escape(bytes) << "');\n";
+  } else {
+    strm << indent << "output->append(" << pool_name << " + "
+         << pool->Add(bytes) << ", " << bytes.size() << ");\n";
+  }
+}
+
+// Writes the function for one rule. Returns false if the rule uses labels
+// outside the byte range.
+bool EmitRule(const std::string &rule, const Dfa &dfa, std::ostream &strm) {
+  const auto name = FunctionName(rule);
+  const auto pool_name = "k" + name + "Outputs";
+  OutputPool pool;
+  // Whether the generated code refers to the pool even if it is empty.
+  bool pool_used = false;
+  std::ostringstream tables;
+  std::ostringstream body;
+  std::string bytes;
+  body << "bool " << name
+       << "(std::string_view input, std::string *output) {\n"
+       << "  output->clear();\n";
+  if (dfa.Start() == Dfa::kNoState) {
+    body << "  return false;\n}\n\n";
+    strm << "// Rule: " << rule << " (empty)\n" << body.str();
+    return true;
+  }
+  body << "  uint32_t state = " << dfa.Start() << ";\n"
+       << "  for (const unsigned char ch : input) {\n"
+       << "    // A NUL byte compiles to an epsilon, which composition skips.\n"
+       << "    if (ch == 0) continue;\n"
+       << "    switch (state) {\n";
+  for (uint32_t s = 0; s < dfa.NumStates(); ++s) {
+    const auto &state = dfa.GetState(s);
+    if (state.num_arcs == 0) continue;
+    for (auto *arc = dfa.ArcsBegin(s); arc != dfa.ArcsEnd(s); ++arc) {
+      if (!IsByte(arc->ilabel)) {
+        LOG(ERROR) << "Rule " << rule << " has non-byte input label "
+                   << arc->ilabel;
+        return false;
+      }
+    }
+    body << "      case " << s << ": {\n";
+    if (state.num_arcs >=
+        static_cast<uint32_t>(FST_FLAGS_dense_state_arcs)) {
+      const auto table_name = "k" + name + "State" + std::to_string(s);
+      std::vector<std::string> entries(256, "{-1, 0, 0}");
+      for (auto *arc = dfa.ArcsBegin(s); arc != dfa.ArcsEnd(s); ++arc) {
+        if (!OutputBytes(dfa, arc->output, arc->output_size, &bytes)) {
+          LOG(ERROR) << "Rule " << rule << " has non-byte output labels";
+          return false;
+        }
+        const auto offset = bytes.empty() ? 0 : pool.Add(bytes);
+        entries[arc->ilabel] = thrax::StringPrintf(
+            "{%u, %u, %zu}", arc->nextstate, offset, bytes.size());
+      }
+      pool_used = true;
+      tables << "constexpr " << kTransitionType << " " << table_name
+             << "[256] = {\n";
+      for (int i = 0; i < 256; ++i) {
+        tables << "    " << entries[i] << ",\n";
+      }
+      tables << "};\n\n";
+      body << "        const " << kTransitionType << " &t = " << table_name
+           << "[ch];\n"
+           << "        if (t.next < 0) return false;\n"
+           << "        output->append(" << pool_name
+           << " + t.output_offset, t.output_size);\n"
+           << "        state = t.next;\n"
+           << "        break;\n"
+           << "      }\n";
+      continue;
+    }
+    body << "        switch (ch) {\n";
+    for (auto *arc = dfa.ArcsBegin(s); arc != dfa.ArcsEnd(s); ++arc) {
+      if (!OutputBytes(dfa, arc->output, arc->output_size, &bytes)) {
+        LOG(ERROR) << "Rule " << rule << " has non-byte output labels";
+        return false;
+      }
+      body << "          case " << arc->ilabel << ":\n";
+      EmitAppend(bytes, pool_name, &pool, "            ", body);
+      body << "            state = " << arc->nextstate << ";\n"
+           << "            break;\n";
+    }
+    body << "          default:\n"
+         << "            return false;\n"
+         << "        }\n"
+         << "        break;\n"
+         << "      }\n";
+  }
+  body << "      default:\n"
+       << "        return false;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  switch (state) {\n";
+  for (uint32_t s = 0; s < dfa.NumStates(); ++s) {
+    const auto &state = dfa.GetState(s);
+    if (state.final_weight == StdArc::Weight::Zero()) continue;
+    if (!OutputBytes(dfa, state.final_output, state.final_output_size,
+                     &bytes)) {
+      LOG(ERROR) << "Rule " << rule << " has non-byte final output labels";
+      return false;
+    }
+    body << "    case " << s << ":\n";
+    EmitAppend(bytes, pool_name, &pool, "      ", body);
+    body << "      return true;\n";
+  }
+  body << "    default:\n"
+       << "      return false;\n"
+       << "  }\n"
+       << "}\n\n";
+  strm << "// Rule: " << rule << " (" << dfa.NumStates() << " states, "
+       << dfa.NumArcs() << " arcs)\n"
+       << "namespace {\n\n";
+  if (pool_used || !pool.Get().empty()) {
+    strm << "constexpr char " << pool_name << "[] = \"" << Escape(pool.Get())
+         << "\";\n\n";
+  }
+  strm << tables.str() << "}  // namespace\n\n" << body.str();
+  return true;
+}
+
+// Checks each compiled rule against the grammar manager on every line of the
+// input file. Returns false on any disagreement.
+bool CheckRules(const GrmManagerSpec<StdArc> &grm,
+                const std::vector<std::string> &rules,
+                const std::vector<std::unique_ptr<Dfa>> &dfas,
+                const std::string &filename) {
+  std::ifstream strm(filename);
+  if (!strm) {
+    LOG(ERROR) << "Can't open input file: " << filename;
+    return false;
+  }
+  bool success = true;
+  size_t num_inputs = 0;
+  std::string input;
+  std::string expected;
+  std::string actual;
+  // Compiles the input ourselves, since GrmManager would otherwise apply
+  // sequential rules through their flat form, which is what we are checking.
+  const ::fst::StringCompiler<StdArc> compiler(::fst::TokenType::BYTE);
+  ::fst::VectorFst<StdArc> input_fst;
+  while (std::getline(strm, input)) {
+    ++num_inputs;
+    const bool compiled = compiler(input, &input_fst);
+    for (size_t i = 0; i < rules.size(); ++i) {
+      const bool expected_ok =
+          compiled && grm.RewriteBytes(rules[i], input_fst, &expected);
+      const bool actual_ok = dfas[i]->RewriteBytes(input, &actual);
+      if (expected_ok != actual_ok || (expected_ok && expected != actual)) {
+        LOG(ERROR) << "Mismatch for rule " << rules[i] << " on input \""
+                   << input << "\": expected "
+                   << (expected_ok ? "\"" + expected + "\"" : "failure")
+                   << ", got " << (actual_ok ? "\"" + actual + "\"" : "failure");
+        success = false;
+      }
+    }
+  }
+  if (success) {
+    std::cerr << "Checked " << rules.size() << " rules on " << num_inputs
+              << " inputs" << std::endl;
+  }
+  return success;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(argv[0], &argc, &argv, true);
+
+  GrmManagerSpec<StdArc> grm;
+  if (!grm.LoadArchive(FST_FLAGS_far)) {
+    LOG(ERROR) << "Unable to load FAR: " << FST_FLAGS_far;
+    return 1;
+  }
+  const auto rules = ::fst::StringSplit(FST_FLAGS_rules, ',');
+  if (rules.empty()) {
+    LOG(ERROR) << "--rules must be specified";
+    return 1;
+  }
+  std::map<std::string, std::string> function_rules = {
+      {kTransitionType, ""}};
+  for (const auto &rule : rules) {
+    const auto name = FunctionName(rule);
+    const auto [it, inserted] = function_rules.emplace(name, rule);
+    if (!inserted) {
+      LOG(ERROR) << "Rule " << rule << " would be compiled to function "
+                 << name << ", which is taken by "
+                 << (it->second.empty() ? "the generated code"
+                                        : "rule " + it->second);
+      return 1;
+    }
+  }
+  std::vector<std::unique_ptr<Dfa>> dfas;
+  for (const auto &rule : rules) {
+    const auto *fst = grm.GetFst(rule);
+    if (!fst) {
+      LOG(ERROR) << "Rule " << rule << " not found in " << FST_FLAGS_far;
+      return 1;
+    }
+    auto dfa = std::make_unique<Dfa>();
+    if (!dfa->Init(*fst)) {
+      LOG(ERROR) << "Rule " << rule << " is not input-deterministic; it must "
+                 << "be deterministic or subsequential to be compiled";
+      return 1;
+    }
+    dfas.push_back(std::move(dfa));
+  }
+  std::ostringstream source;
+  source << "// Generated by thraxcodegen from " << FST_FLAGS_far
+         << ". Do not edit.\n\n"
+         << "#include <cstdint>\n"
+         << "#include <string>\n"
+         << "#include <string_view>\n\n"
+         << "namespace " << FST_FLAGS_namespace_name << " {\n"
+         << "namespace {\n\n"
+         << "struct " << kTransitionType << " {\n"
+         << "  int32_t next;\n"
+         << "  uint32_t output_offset;\n"
+         << "  uint32_t output_size;\n"
+         << "};\n\n"
+         << "}  // namespace\n\n";
+  for (size_t i = 0; i < rules.size(); ++i) {
+    if (!EmitRule(rules[i], *dfas[i], source)) return 1;
+  }
+  source << "}  // namespace " << FST_FLAGS_namespace_name << "\n";
+  if (FST_FLAGS_output.empty()) {
+    std::cout << source.str();
+  } else {
+    std::ofstream strm(FST_FLAGS_output);
+    if (!(strm << source.str())) {
+      LOG(ERROR) << "Failed to write: " << FST_FLAGS_output;
+      return 1;
+    }
+  }
+  if (!FST_FLAGS_output_header.empty()) {
+    std::ofstream strm(FST_FLAGS_output_header);
+    strm << "// Generated by thraxcodegen from " << FST_FLAGS_far
+         << ". Do not edit.\n\n"
+         << "#pragma once\n\n"
+         << "#include <string>\n"
+         << "#include <string_view>\n\n"
+         << "namespace " << FST_FLAGS_namespace_name << " {\n\n";
+    for (const auto &rule : rules) {
+      strm << "bool " << FunctionName(rule)
+           << "(std::string_view input, std::string *output);\n";
+    }
+    strm << "\n}  // namespace " << FST_FLAGS_namespace_name << "\n";
+    if (!strm) {
+      LOG(ERROR) << "Failed to write: " << FST_FLAGS_output_header;
+      return 1;
+    }
+  }
+  if (!FST_FLAGS_check_inputs.empty() &&
+      !CheckRules(grm, rules, dfas, FST_FLAGS_check_inputs)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stand-alone binary to load up a FAR, preparing its rules as a server would
+// (honoring flags such as --pack_rules and --reorder_rule_states), and write
+// them to a runtime image which servers can attach to with
+// GrmManager::LoadImage() without preparing the rules again. The image is
+// then read back and checked against the FAR.
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/expanded-fst.h>
+#include <fst/fst.h>
+#include <thrax/grm-manager.h>
+
+using ::thrax::GrmManager;
+
+DEFINE_string(far, "", "Path to the FAR.");
+DEFINE_string(image, "", "Path to which the runtime image is written.");
+
+int main(int argc, char **argv) {
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(argv[0], &argc, &argv, true);
+
+  if (FST_FLAGS_far.empty() || FST_FLAGS_image.empty()) {
+    LOG(FATAL) << "--far and --image must be specified";
+  }
+  GrmManager grm;
+  CHECK(grm.LoadArchive(FST_FLAGS_far));
+  if (!grm.WriteImage(FST_FLAGS_image)) return 1;
+  GrmManager image;
+  if (!image.LoadImage(FST_FLAGS_image)) return 1;
+  const auto &fsts = grm.GetFstMap();
+  const auto &image_fsts = image.GetFstMap();
+  size_t num_rules = 0;
+  size_t num_flat_rules = 0;
+  for (const auto &[name, fst] : fsts) {
+    const auto it = image_fsts.find(name);
+    if (it == image_fsts.end() ||
+        ::fst::CountStates(*it->second) != ::fst::CountStates(*fst) ||
+        ::fst::CountArcs(*it->second) != ::fst::CountArcs(*fst)) {
+      LOG(ERROR) << "Image does not match the FAR for rule " << name;
+      return 1;
+    }
+    ++num_rules;
+    if (image.GetFlatRule(name)) ++num_flat_rules;
+  }
+  std::cout << "Wrote " << num_rules << " FSTs, " << num_flat_rules
+            << " with flat forms, to " << FST_FLAGS_image << "\n";
+  return 0;
+}
@@ -0,0 +1,204 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stand-alone binary to load up a FAR, rewrite a corpus of byte strings, one
+// per line, with a cascade of rules, and report which states and arcs of each
+// rule composition visits. The counts can be written to a file with
+// --profile_output, for --rule_state_profile and other passes to consume.
+//
+// For each rule the report gives the share of its states and arcs that were
+// visited at all, and the hottest states and arcs with their share of the
+// visits to the rule. Rules which are applied without composition, such as
+// input-deterministic rules, are still profiled as if composed, which gives
+// the states and arcs the deterministic pass follows.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/arc.h>
+#include <fst/expanded-fst.h>
+#include <fst/fst.h>
+#include <thrax/grm-manager.h>
+#include <thrax/rule-profile.h>
+
+using ::fst::StdArc;
+using ::thrax::GrmManager;
+using ::thrax::RuleProfile;
+using ::thrax::RuleTriple;
+
+DEFINE_string(far, "", "Path to the FAR.");
+DEFINE_string(rules, "", "Names of the rewrite rules, applied in order.");
+DEFINE_string(input, "",
+              "Path to the corpus, one input per line; if empty, the corpus "
+              "is read from stdin.");
+DEFINE_string(profile_output, "",
+              "If set, the path to which the visit counts are written.");
+DEFINE_int32(top_n, 10,
+             "The number of hottest states and arcs reported per rule.");
+
+namespace {
+
+double Percent(uint64 part, uint64 whole) {
+  return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+// Prints a label as its number, followed by the byte it stands for if it is
+// printable ASCII.
+std::string FormatLabel(StdArc::Label label) {
+  std::string formatted = std::to_string(label);
+  if (label > 32 && label < 127) {
+    formatted += "'";
+    formatted += static_cast<char>(label);
+    formatted += "'";
+  }
+  return formatted;
+}
+
+void PrintReport(const GrmManager &grm, const std::vector<RuleTriple> &triples,
+                 const RuleProfile &profile) {
+  for (const auto &triple : triples) {
+    const auto &name = triple.main_rule;
+    const auto *fst = grm.GetFst(name);
+    std::cout << "Rule " << name << ":\n";
+    const auto *state_visits = profile.StateVisits(name);
+    const auto *arc_visits = profile.ArcVisits(name);
+    if (!fst || !state_visits) {
+      std::cout << "  Not profiled\n";
+      continue;
+    }
+    const auto num_states = ::fst::CountStates(*fst);
+    const auto num_arcs = ::fst::CountArcs(*fst);
+    uint64 total_state_visits = 0;
+    size_t visited_states = 0;
+    std::vector<std::pair<uint64, int64>> hot_states;
+    for (size_t s = 0; s < state_visits->size(); ++s) {
+      const auto count = (*state_visits)[s];
+      if (count == 0) continue;
+      total_state_visits += count;
+      ++visited_states;
+      hot_states.emplace_back(count, s);
+    }
+    uint64 total_arc_visits = 0;
+    size_t visited_arcs = 0;
+    // Count, state and arc position.
+    std::vector<std::tuple<uint64, int64, size_t>> hot_arcs;
+    if (arc_visits) {
+      for (size_t s = 0; s < arc_visits->size(); ++s) {
+        for (size_t a = 0; a < (*arc_visits)[s].size(); ++a) {
+          const auto count = (*arc_visits)[s][a];
+          if (count == 0) continue;
+          total_arc_visits += count;
+          ++visited_arcs;
+          hot_arcs.emplace_back(count, s, a);
+        }
+      }
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  States visited: " << visited_states << " of "
+              << num_states << " ("
+              << Percent(visited_states, num_states) << "%), "
+              << total_state_visits << " visits\n";
+    std::cout << "  Arcs followed: " << visited_arcs << " of " << num_arcs
+              << " (" << Percent(visited_arcs, num_arcs) << "%), "
+              << total_arc_visits << " times\n";
+    const size_t top_n = std::max(FST_FLAGS_top_n, 0);
+    const auto by_count = [](const auto &x, const auto &y) {
+      return std::get<0>(x) > std::get<0>(y);
+    };
+    const auto num_hot_states = std::min(top_n, hot_states.size());
+    std::partial_sort(hot_states.begin(), hot_states.begin() + num_hot_states,
+                      hot_states.end(), by_count);
+    hot_states.resize(num_hot_states);
+    uint64 hot_state_visits = 0;
+    for (const auto &[count, s] : hot_states) hot_state_visits += count;
+    std::cout << "  Hottest " << num_hot_states << " states ("
+              << Percent(hot_state_visits, total_state_visits)
+              << "% of visits):\n";
+    for (const auto &[count, s] : hot_states) {
+      std::cout << "    state " << s << ": " << count << " ("
+                << Percent(count, total_state_visits) << "%)\n";
+    }
+    const auto num_hot_arcs = std::min(top_n, hot_arcs.size());
+    std::partial_sort(hot_arcs.begin(), hot_arcs.begin() + num_hot_arcs,
+                      hot_arcs.end(), by_count);
+    hot_arcs.resize(num_hot_arcs);
+    std::cout << "  Hottest " << num_hot_arcs << " arcs:\n";
+    for (const auto &[count, s, a] : hot_arcs) {
+      ::fst::ArcIterator<::fst::Fst<StdArc>> aiter(*fst, s);
+      aiter.Seek(a);
+      const auto &arc = aiter.Value();
+      std::cout << "    " << s << " -> " << arc.nextstate << " "
+                << FormatLabel(arc.ilabel) << ":" << FormatLabel(arc.olabel)
+                << ": " << count << " ("
+                << Percent(count, total_arc_visits) << "%)\n";
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(argv[0], &argc, &argv, true);
+
+  GrmManager grm;
+  CHECK(grm.LoadArchive(FST_FLAGS_far));
+  std::vector<RuleTriple> triples;
+  for (const auto &def : ::fst::StringSplit(FST_FLAGS_rules, ',')) {
+    triples.emplace_back(def);
+    if (!grm.GetFst(triples.back().main_rule)) {
+      LOG(FATAL) << "Cannot find rule: " << triples.back().main_rule;
+    }
+  }
+  if (triples.empty()) LOG(FATAL) << "--rules must be specified";
+  std::ifstream file;
+  if (!FST_FLAGS_input.empty()) {
+    file.open(FST_FLAGS_input);
+    if (!file) LOG(FATAL) << "Unable to open corpus: " << FST_FLAGS_input;
+  }
+  std::istream &istrm = FST_FLAGS_input.empty() ? std::cin : file;
+  RuleProfile profile;
+  size_t num_inputs = 0;
+  size_t num_failed = 0;
+  std::string line;
+  std::string output;
+  while (std::getline(istrm, line)) {
+    ++num_inputs;
+    for (const auto &triple : triples) {
+      if (!grm.ProfileRewriteBytes(triple.main_rule, line, &output, &profile,
+                                   triple.pdt_parens_rule,
+                                   triple.mpdt_assignments_rule)) {
+        ++num_failed;
+        break;
+      }
+      line.swap(output);
+    }
+  }
+  std::cout << "Inputs: " << num_inputs << ", failed: " << num_failed << "\n";
+  PrintReport(grm, triples, profile);
+  if (!FST_FLAGS_profile_output.empty() &&
+      !profile.Write(FST_FLAGS_profile_output)) {
+    return 1;
+  }
+  return 0;
+}
@@ -113,6 +113,10 @@ int main(int argc, char** argv) {
       uniform_selector, /*max_length=*/std::numeric_limits<int32_t>::max(),
       /*npath=*/1, true, false);
 
+  const ::thrax::LabelFormatter input_formatter(generated_symtab.get(), type,
+                                                input_symtab.get());
+  const ::thrax::LabelFormatter output_formatter(generated_symtab.get(), type,
+                                                 output_symtab.get());
   for (int i = 0; i < FST_FLAGS_noutput; ++i) {
     StdVectorFst ofst;
     RandGen(cleaned, &ofst, opts);
@@ -120,12 +124,10 @@ int main(int argc, char** argv) {
     StdVectorFst ifst(ofst);
     Project(&ifst, ProjectType::INPUT);
     Project(&ofst, ProjectType::OUTPUT);
-    if (!FstToStrings(ifst, &istrings, generated_symtab.get(), type,
-                      input_symtab.get())) {
+    if (!FstToStrings(ifst, &istrings, input_formatter)) {
       LOG(FATAL) << "Can't generate strings for input side";
     }
-    if (!FstToStrings(ofst, &ostrings, generated_symtab.get(), type,
-                      output_symtab.get())) {
+    if (!FstToStrings(ofst, &ostrings, output_formatter)) {
       LOG(FATAL) << "Can't generate strings for output side";
     }
   }
@@ -27,6 +27,7 @@
 #include <fst/symbol-table.h>
 #include <fst/vector-fst.h>
 #include <thrax/grm-manager.h>
+#include <thrax/symbol-index.h>
 #include <../bin/utildefs.h>
 #include <thrax/symbols.h>
 #define HISTORY_FILE ".rewrite-tester-history"
@@ -43,6 +44,7 @@ using ::fst::TokenType;
 using ::thrax::FstToStrings;
 using ::thrax::GetGeneratedSymbolTable;
 using ::thrax::RuleTriple;
+using ::thrax::SymbolIndex;
 
 DEFINE_string(far, "", "Path to the FAR.");
 DEFINE_string(rules, "", "Names of the rewrite rules.");
@@ -55,6 +57,8 @@ DEFINE_string(history_file, HISTORY_FILE,
 DEFINE_int64(noutput, 1, "Maximum number of output strings for each input.");
 DEFINE_bool(show_details, false, "Show the output of each individual rule when"
             " multiple rules are specified.");
+DEFINE_bool(show_memory_usage, false,
+            "Print the memory held by each FST in the FAR after loading.");
 
 #ifdef HAVE_READLINE
 using thrax::File;
@@ -106,6 +110,7 @@ RewriteTesterUtils::RewriteTesterUtils() :
 
 void RewriteTesterUtils::Initialize() {
   CHECK(grm_.LoadArchive(FST_FLAGS_far));
+  if (FST_FLAGS_show_memory_usage) PrintMemoryUsage();
   rules_ = ::fst::StringSplit(FST_FLAGS_rules, ',');
   byte_symtab_ = nullptr;
   utf8_symtab_ = nullptr;
@@ -158,8 +163,8 @@ void RewriteTesterUtils::Initialize() {
     if (!input_symtab_) {
       LOG(FATAL) << "Invalid mode or symbol table path.";
     }
-    compiler_ = std::make_unique<StringCompiler<StdArc>>(TokenType::SYMBOL,
-                                                          input_symtab_.get());
+    input_index_ = SymbolIndex::Build(*input_symtab_);
+    if (!input_index_) LOG(FATAL) << "Cannot index the input symbol table.";
   }
   output_symtab_ = nullptr;
   if (FST_FLAGS_output_mode == "byte") {
@@ -174,13 +179,18 @@ void RewriteTesterUtils::Initialize() {
       LOG(FATAL) << "Invalid mode or symbol table path.";
     }
   }
+  formatter_ = std::make_unique<::thrax::LabelFormatter>(
+      generated_symtab_.get(), type_, output_symtab_.get());
 }
 
 const std::string RewriteTesterUtils::ProcessInput(const std::string& input,
                                                    bool prepend_output) {
   StdVectorFst input_fst;
   StdVectorFst output_fst;
-  if (!compiler_->operator()(input, &input_fst)) {
+  const bool compiled =
+      input_index_ ? ::thrax::CompileSymbols(*input_index_, input, &input_fst)
+                   : compiler_->operator()(input, &input_fst);
+  if (!compiled) {
     return "Unable to parse input string.";
   }
   std::ostringstream sstrm;
@@ -202,8 +212,7 @@ const std::string RewriteTesterUtils::ProcessInput(const std::string& input,
                      triple.pdt_parens_rule, triple.mpdt_assignments_rule)) {
       if (FST_FLAGS_show_details && rules_.size() > 1) {
         std::vector<std::pair<std::string, float>> tmp;
-        FstToStrings(output_fst, &tmp, generated_symtab_.get(), type_,
-                     output_symtab_.get(), FST_FLAGS_noutput);
+        FstToStrings(output_fst, &tmp, *formatter_, FST_FLAGS_noutput);
         for (const auto& one_result : tmp) {
           sstrm << "output of rule[" << triple.main_rule
                 << "] is: " << one_result.first << '\n';
@@ -218,8 +227,7 @@ const std::string RewriteTesterUtils::ProcessInput(const std::string& input,
   std::vector<std::pair<std::string, float>> strings;
   std::set<std::string> seen;
   if (succeeded &&
-      FstToStrings(output_fst, &strings, generated_symtab_.get(), type_,
-                   output_symtab_.get(), FST_FLAGS_noutput)) {
+      FstToStrings(output_fst, &strings, *formatter_, FST_FLAGS_noutput)) {
     for (auto it = strings.cbegin(); it != strings.cend(); ++it) {
       const auto sx = seen.find(it->first);
       if (sx != seen.end()) continue;
@@ -240,6 +248,21 @@ const std::string RewriteTesterUtils::ProcessInput(const std::string& input,
   }
 }
 
+void RewriteTesterUtils::PrintMemoryUsage() const {
+  const auto usage = grm_.MemoryUsage();
+  std::cout << "Rule\tType\tStates\tArcs\tFST bytes\tSymbol table bytes"
+            << "\tFlat bytes\n";
+  for (const auto& rule : usage.rules) {
+    std::cout << rule.name << '\t' << rule.type << '\t' << rule.num_states
+              << '\t' << rule.num_arcs << '\t' << rule.fst_bytes << '\t'
+              << rule.symbol_table_bytes << '\t' << rule.flat_bytes << '\n';
+  }
+  for (const auto& [type, bytes] : usage.bytes_by_type) {
+    std::cout << "Total for type " << type << ": " << bytes << " bytes\n";
+  }
+  std::cout << "Total: " << usage.total_bytes << " bytes" << std::endl;
+}
+
 // Run() for interactive mode.
 void RewriteTesterUtils::Run() {
   std::string input;
@@ -26,6 +26,7 @@
 #include <fst/string.h>
 #include <fst/symbol-table.h>
 #include <thrax/grm-manager.h>
+#include <thrax/symbol-index.h>
 #include <../bin/utildefs.h>
 
 class RewriteTesterUtils {
@@ -43,6 +44,9 @@ class RewriteTesterUtils {
   const std::string ProcessInput(const std::string& input,
                                  bool prepend_output = true);
 
+  // Prints the memory usage of the FSTs in the FAR to stdout.
+  void PrintMemoryUsage() const;
+
  private:
   // Reader for the input in interactive version.
   bool ReadInput(std::string* s);
@@ -54,8 +58,11 @@ class RewriteTesterUtils {
   std::unique_ptr<::fst::SymbolTable> utf8_symtab_;
   std::unique_ptr<::fst::SymbolTable> generated_symtab_;
   std::unique_ptr<::fst::SymbolTable> input_symtab_;
+  // Compiles the input in place of compiler_ for a symbol table input mode.
+  std::unique_ptr<::thrax::SymbolIndex> input_index_;
   ::fst::TokenType type_;
   std::unique_ptr<::fst::SymbolTable> output_symtab_;
+  std::unique_ptr<::thrax::LabelFormatter> formatter_;
 
   RewriteTesterUtils(const RewriteTesterUtils&) = delete;
   RewriteTesterUtils& operator=(const RewriteTesterUtils&) = delete;
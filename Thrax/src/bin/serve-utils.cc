@@ -0,0 +1,313 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include <../bin/serve-utils.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <utility>
+
+namespace thrax {
+
+std::string EscapeField(const std::string &field) {
+  std::string escaped;
+  escaped.reserve(field.size());
+  for (const char ch : field) {
+    switch (ch) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\t':
+        escaped += "\\t";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += ch;
+    }
+  }
+  return escaped;
+}
+
+bool UnescapeField(const std::string &field, std::string *output) {
+  output->clear();
+  for (size_t i = 0; i < field.size(); ++i) {
+    if (field[i] != '\\') {
+      output->push_back(field[i]);
+      continue;
+    }
+    if (++i == field.size()) return false;
+    switch (field[i]) {
+      case '\\':
+        output->push_back('\\');
+        break;
+      case 't':
+        output->push_back('\t');
+        break;
+      case 'n':
+        output->push_back('\n');
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+ServeConnection::~ServeConnection() {
+  if (in_fd_ > STDERR_FILENO) close(in_fd_);
+  if (out_fd_ > STDERR_FILENO && out_fd_ != in_fd_) close(out_fd_);
+}
+
+bool ServeConnection::ReadLine(std::string *line) {
+  line->clear();
+  while (true) {
+    const auto pos = buffer_.find('\n');
+    if (pos != std::string::npos) {
+      line->assign(buffer_, 0, pos);
+      buffer_.erase(0, pos + 1);
+      return true;
+    }
+    char chunk[4096];
+    const auto n = read(in_fd_, chunk, sizeof(chunk));
+    if (n <= 0) {
+      // Serves a final line without a newline.
+      line->swap(buffer_);
+      buffer_.clear();
+      return !line->empty();
+    }
+    buffer_.append(chunk, n);
+  }
+}
+
+void ServeConnection::WriteLine(const std::string &line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string data = line + '\n';
+  for (size_t written = 0; written < data.size();) {
+    const auto n = write(out_fd_, data.data() + written, data.size() - written);
+    if (n <= 0) return;  // The client went away.
+    written += n;
+  }
+}
+
+RewriteServer::RewriteServer(int num_threads, size_t max_queue_depth,
+                             int max_batch_size, int64 max_batch_delay_us)
+    : max_batch_size_(std::max(max_batch_size, 1)),
+      max_batch_delay_(max_batch_delay_us),
+      executor_(num_threads, max_queue_depth),
+      stopping_(false),
+      batcher_([this] { Batch(); }) {}
+
+RewriteServer::~RewriteServer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  batcher_.join();
+}
+
+bool RewriteServer::Load(const std::string &fars) {
+  for (const auto &far : ::fst::StringSplit(fars, ',')) {
+    const auto pos = far.find('=');
+    const auto prefix = pos == std::string::npos ? "" : far.substr(0, pos);
+    const auto path = pos == std::string::npos ? far : far.substr(pos + 1);
+    if (!grm_.Mount(prefix, path)) return false;
+  }
+  return !grm_.Prefixes().empty();
+}
+
+void RewriteServer::Serve(std::shared_ptr<ServeConnection> connection) {
+  std::string line;
+  while (connection->ReadLine(&line)) {
+    if (line == "!stats") {
+      WriteStats(connection.get());
+      continue;
+    }
+    Request request;
+    request.connection = connection;
+    request.arrival = Clock::now();
+    const auto first = line.find('\t');
+    const auto second =
+        first == std::string::npos ? first : line.find('\t', first + 1);
+    request.id = line.substr(0, first);
+    if (second == std::string::npos ||
+        !UnescapeField(line.substr(second + 1), &request.input)) {
+      Reply(request, "ERROR");
+      continue;
+    }
+    request.rules = line.substr(first + 1, second - first - 1);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.push_back(std::move(request));
+    }
+    ready_.notify_one();
+  }
+}
+
+void RewriteServer::Reply(const Request &request, const std::string &status,
+                          const std::string &output) {
+  request.connection->WriteLine(request.id + '\t' + status + '\t' +
+                                EscapeField(output));
+}
+
+void RewriteServer::Record(const Request &request, const Cascade &cascade,
+                           bool rejected, bool failed) {
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      Clock::now() - request.arrival)
+                      .count();
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  for (const auto &rule : cascade.rules) {
+    auto &stats = stats_[rule];
+    ++stats.requests;
+    if (rejected) ++stats.rejected;
+    if (failed) ++stats.failed;
+    stats.total_us += us;
+    if (us > stats.max_us) stats.max_us = us;
+  }
+}
+
+void RewriteServer::WriteStats(ServeConnection *connection) const {
+  std::ostringstream strm;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (const auto &[rule, stats] : stats_) {
+      strm << rule << '\t' << stats.requests << '\t' << stats.failed << '\t'
+           << stats.rejected << '\t'
+           << (stats.requests ? stats.total_us / stats.requests : 0) << '\t'
+           << stats.max_us << '\n';
+    }
+  }
+  connection->WriteLine(strm.str());
+}
+
+void RewriteServer::Batch() {
+  const size_t max_size = max_batch_size_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ready_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+    if (pending_.empty()) return;
+    ready_.wait_until(lock, pending_.front().arrival + max_batch_delay_,
+                      [this, max_size] {
+                        return stopping_ || pending_.size() >= max_size;
+                      });
+    std::vector<Request> batch;
+    while (!pending_.empty() && batch.size() < max_size) {
+      batch.push_back(std::move(pending_.front()));
+      pending_.pop_front();
+    }
+    lock.unlock();
+    Dispatch(std::move(batch));
+    lock.lock();
+  }
+}
+
+void RewriteServer::Dispatch(std::vector<Request> batch) {
+  std::map<std::string, std::vector<Request>> groups;
+  for (auto &request : batch) {
+    groups[request.rules].push_back(std::move(request));
+  }
+  for (auto &[rules, requests] : groups) {
+    const auto *cascade = GetCascade(rules);
+    if (!cascade) {
+      for (const auto &request : requests) Reply(request, "ERROR");
+      continue;
+    }
+    auto group = std::make_shared<std::vector<Request>>(std::move(requests));
+    const bool submitted = executor_.TrySubmit([this, cascade, group] {
+      std::string output;
+      for (const auto &request : *group) {
+        const bool success =
+            cascade->cascade->RewriteBytes(request.input, &output);
+        Record(request, *cascade, /*rejected=*/false, /*failed=*/!success);
+        Reply(request, success ? "OK" : "FAILED", success ? output : "");
+      }
+    });
+    if (!submitted) {
+      for (const auto &request : *group) {
+        Record(request, *cascade, /*rejected=*/true, /*failed=*/false);
+        Reply(request, "REJECTED");
+      }
+    }
+  }
+}
+
+const RewriteServer::Cascade *RewriteServer::GetCascade(
+    const std::string &rules) {
+  const auto it = cascades_.find(rules);
+  if (it != cascades_.end()) return &it->second;
+  Cascade cascade;
+  std::vector<RuleTriple> triples;
+  for (const auto &def : ::fst::StringSplit(rules, ',')) {
+    RuleTriple triple(def);
+    for (auto *name : {&triple.main_rule, &triple.pdt_parens_rule,
+                       &triple.mpdt_assignments_rule}) {
+      if (name->empty()) continue;
+      *name = grm_.ResolveRule(*name);
+      if (name->empty()) return nullptr;
+    }
+    cascade.rules.push_back(triple.main_rule);
+    triples.push_back(std::move(triple));
+  }
+  cascade.cascade = std::make_unique<RuleCascade<::fst::StdArc>>();
+  if (triples.empty() || !cascade.cascade->Init(&grm_, std::move(triples))) {
+    return nullptr;
+  }
+  return &(cascades_[rules] = std::move(cascade));
+}
+
+bool ListenOnSocket(const std::string &path, RewriteServer *server) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "Socket path too long: " << path;
+    return false;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG(ERROR) << "Cannot create socket: " << strerror(errno);
+    return false;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    LOG(ERROR) << "Cannot listen on " << path << ": " << strerror(errno);
+    close(fd);
+    return false;
+  }
+  LOG(INFO) << "Listening on " << path;
+  while (true) {
+    const int client = accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      LOG(ERROR) << "accept failed: " << strerror(errno);
+      close(fd);
+      return false;
+    }
+    std::thread([server, client] {
+      server->Serve(std::make_shared<ServeConnection>(client, client));
+    }).detach();
+  }
+}
+
+}  // namespace thrax
@@ -0,0 +1,162 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The rewrite server behind thraxserve; see serve.cc for the protocol.
+
+#ifndef NLP_GRM_LANGUAGE_UTIL_SERVE_UTILS_H_
+#define NLP_GRM_LANGUAGE_UTIL_SERVE_UTILS_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/arc.h>
+#include <thrax/multi-grm-manager.h>
+#include <thrax/rewrite-executor.h>
+
+namespace thrax {
+
+// Escapes backslashes, tabs and newlines as "\\", "\t" and "\n", so that the
+// field fits on one line of the protocol.
+std::string EscapeField(const std::string &field);
+
+// Undoes EscapeField(). Returns false if the field has any other escape, or
+// ends in a lone backslash.
+bool UnescapeField(const std::string &field, std::string *output);
+
+// One client. Replies from several workers are serialized by the mutex. The
+// descriptors, other than those of the standard streams, are closed once the
+// last pending request is answered.
+class ServeConnection {
+ public:
+  ServeConnection(int in_fd, int out_fd) : in_fd_(in_fd), out_fd_(out_fd) {}
+
+  ~ServeConnection();
+
+  // Reads the next line, without its newline, returning false at the end of
+  // the input.
+  bool ReadLine(std::string *line);
+
+  void WriteLine(const std::string &line);
+
+ private:
+  const int in_fd_;
+  const int out_fd_;
+  std::string buffer_;
+  std::mutex mutex_;
+
+  ServeConnection(const ServeConnection &) = delete;
+  ServeConnection &operator=(const ServeConnection &) = delete;
+};
+
+// Gathers requests from any number of connections into batches and runs each
+// cascade's share of a batch as one task on a pool of threads.
+class RewriteServer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Batches hold up to max_batch_size requests, and a request waits at most
+  // max_batch_delay_us for its batch to fill. At most max_queue_depth batches
+  // may wait for one of the num_threads threads.
+  RewriteServer(int num_threads, size_t max_queue_depth, int max_batch_size,
+                int64 max_batch_delay_us);
+
+  // Finishes the pending requests.
+  ~RewriteServer();
+
+  // Mounts the comma-separated FARs, each given as "prefix=path" or as a plain
+  // path for the empty prefix. Returns false if any fails to load.
+  bool Load(const std::string &fars);
+
+  // Reads and queues requests until the end of the client's input.
+  void Serve(std::shared_ptr<ServeConnection> connection);
+
+ private:
+  struct Request {
+    std::string id;
+    std::string rules;
+    std::string input;
+    std::shared_ptr<ServeConnection> connection;
+    Clock::time_point arrival;
+  };
+
+  // A cascade together with the full names of its rules.
+  struct Cascade {
+    std::unique_ptr<RuleCascade<::fst::StdArc>> cascade;
+    std::vector<std::string> rules;
+  };
+
+  // Counters for one rule.
+  struct RuleStats {
+    int64 requests = 0;
+    int64 failed = 0;
+    int64 rejected = 0;
+    int64 total_us = 0;
+    int64 max_us = 0;
+  };
+
+  static void Reply(const Request &request, const std::string &status,
+                    const std::string &output = "");
+
+  // Counts the request towards each rule of the cascade.
+  void Record(const Request &request, const Cascade &cascade, bool rejected,
+              bool failed);
+
+  void WriteStats(ServeConnection *connection) const;
+
+  // Gathers requests into batches and dispatches them.
+  void Batch();
+
+  // Runs each cascade's requests from the batch as one task.
+  void Dispatch(std::vector<Request> batch);
+
+  // Returns the cascade for the rules, building it on first use, or nullptr
+  // if it cannot be built. Only cascades which can be built are kept, so that
+  // bad requests do not fill the table. Only called from the batching thread.
+  const Cascade *GetCascade(const std::string &rules);
+
+  const int max_batch_size_;
+  const std::chrono::microseconds max_batch_delay_;
+  MultiGrmManager grm_;
+  std::map<std::string, Cascade> cascades_;
+  mutable std::mutex stats_mutex_;
+  std::map<std::string, RuleStats> stats_;
+  RewriteExecutor executor_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Request> pending_;
+  bool stopping_;
+  // Declared last, so that it starts once everything else is constructed.
+  std::thread batcher_;
+
+  RewriteServer(const RewriteServer &) = delete;
+  RewriteServer &operator=(const RewriteServer &) = delete;
+};
+
+// Accepts clients on the Unix-domain socket at the path, serving each on its
+// own thread. Returns false if the socket cannot be set up or accept() fails.
+bool ListenOnSocket(const std::string &path, RewriteServer *server);
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_UTIL_SERVE_UTILS_H_
@@ -0,0 +1,89 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stand-alone binary to load up one or more FARs and serve rewrites over a
+// Unix-domain socket, or over stdin and stdout if no socket is given. The FARs
+// share one rule store (see MultiGrmManager); each is mounted under the prefix
+// given as "prefix=path", or under the empty prefix for a plain path.
+//
+// The protocol is line-based. A request is
+//
+//   <id> TAB <rules> TAB <input>
+//
+// where <rules> is a comma-separated cascade in the syntax of
+// thraxrewrite-tester's --rules, with rule names resolved as by
+// MultiGrmManager::ResolveRule(), and the reply is
+//
+//   <id> TAB <status> TAB <output>
+//
+// where <status> is one of OK, FAILED (the cascade rejects the input),
+// REJECTED (the server is overloaded), or ERROR (a malformed request or an
+// unknown rule). Replies may arrive in a different order from the requests.
+// Backslashes, tabs and newlines in <input> and <output> are escaped as "\\",
+// "\t" and "\n"; once unescaped, byte-mode outputs match the first "Output
+// string" of thraxrewrite-tester. The request "!stats" is answered with a line
+// per rule giving
+//
+//   <rule> TAB <requests> TAB <failed> TAB <rejected> TAB <mean us> TAB
+//   <max us>
+//
+// followed by an empty line. A request counts towards each rule of its
+// cascade, with the time taken by the whole cascade.
+//
+// Requests are batched: the server waits up to --max_batch_delay_us after the
+// first pending request, or until --max_batch_size requests are pending, and
+// then hands each cascade's share of the batch to one of --rewrite_threads
+// worker threads. At most --rewrite_queue_depth batches may wait for a worker;
+// requests beyond that are rejected at once.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <../bin/serve-utils.h>
+
+DEFINE_string(far, "",
+              "Comma-separated paths to the FARs, each optionally preceded "
+              "by \"prefix=\".");
+DEFINE_string(socket, "",
+              "Path of the Unix-domain socket to listen on; if empty, "
+              "requests are read from stdin and replies written to stdout.");
+DEFINE_int32(max_batch_size, 64,
+             "The maximum number of requests gathered into one batch.");
+DEFINE_int64(max_batch_delay_us, 500,
+             "The longest a request waits for a batch to fill, in "
+             "microseconds.");
+
+int main(int argc, char **argv) {
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(argv[0], &argc, &argv, true);
+  // Writes to clients which have gone away must fail rather than kill us.
+  signal(SIGPIPE, SIG_IGN);
+  ::thrax::RewriteServer server(
+      FST_FLAGS_rewrite_threads, FST_FLAGS_rewrite_queue_depth,
+      FST_FLAGS_max_batch_size, FST_FLAGS_max_batch_delay_us);
+  if (!server.Load(FST_FLAGS_far)) {
+    LOG(ERROR) << "Cannot load --far=" << FST_FLAGS_far;
+    return 1;
+  }
+  if (!FST_FLAGS_socket.empty()) {
+    return ::thrax::ListenOnSocket(FST_FLAGS_socket, &server) ? 0 : 1;
+  }
+  server.Serve(std::make_shared<::thrax::ServeConnection>(STDIN_FILENO,
+                                                         STDOUT_FILENO));
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stand-alone binary to compare the lookups of the symbol input and output
+// modes through a SymbolIndex with those through the SymbolTable itself. The
+// symbols are read from a text symbol table or, if none is given, made up.
+// The lookups are checked to agree, and their average time is reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/symbol-table.h>
+#include <thrax/symbol-index.h>
+
+using ::fst::SymbolTable;
+using ::thrax::SymbolIndex;
+
+DEFINE_string(symbols, "",
+              "Path to a text symbol table; if empty, --num_symbols symbols "
+              "are made up.");
+DEFINE_int64(num_symbols, 500000, "Number of symbols made up.");
+DEFINE_int64(num_lookups, 10000000, "Number of lookups of each kind timed.");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Times the lookup of each of the keys in turn until num_lookups are done,
+// returning nanoseconds per lookup. The results are summed into *checksum so
+// that the lookups are not optimized away.
+template <class Key, class Lookup>
+double Time(const std::vector<Key> &keys, Lookup lookup, int64 *checksum) {
+  const auto start = Clock::now();
+  for (int64 i = 0; i < FST_FLAGS_num_lookups; ++i) {
+    *checksum += lookup(keys[i % keys.size()]);
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      Clock::now() - start;
+  return elapsed.count() / FST_FLAGS_num_lookups;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(argv[0], &argc, &argv, true);
+
+  std::unique_ptr<SymbolTable> symtab;
+  if (FST_FLAGS_symbols.empty()) {
+    symtab = std::make_unique<SymbolTable>();
+    symtab->AddSymbol("<epsilon>", 0);
+    for (int64 i = 1; i < FST_FLAGS_num_symbols; ++i) {
+      symtab->AddSymbol("token" + std::to_string(i * 7919 % 1000003), i);
+    }
+  } else {
+    symtab = fst::WrapUnique(SymbolTable::ReadText(FST_FLAGS_symbols));
+    if (!symtab) return 1;
+  }
+  if (FST_FLAGS_num_lookups <= 0 || symtab->NumSymbols() == 0) {
+    LOG(ERROR) << "Nothing to look up";
+    return 1;
+  }
+
+  const auto start = Clock::now();
+  const auto index = SymbolIndex::Build(*symtab);
+  const std::chrono::duration<double> build = Clock::now() - start;
+  if (!index) return 1;
+
+  // Looks the symbols up in random order, as the tokens of text would be.
+  std::vector<std::string> symbols;
+  std::vector<int64> labels;
+  for (const auto &item : *symtab) {
+    symbols.emplace_back(item.Symbol());
+    labels.push_back(item.Label());
+  }
+  std::mt19937 rng(0);
+  std::vector<size_t> order(symbols.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<std::string> shuffled_symbols;
+  std::vector<int64> shuffled_labels;
+  for (const auto i : order) {
+    shuffled_symbols.push_back(symbols[i]);
+    shuffled_labels.push_back(labels[i]);
+  }
+
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    std::string_view symbol;
+    if (index->Find(symbols[i]) != symtab->Find(symbols[i]) ||
+        !index->Find(labels[i], &symbol) ||
+        symbol != symtab->Find(labels[i])) {
+      LOG(ERROR) << "Lookups disagree for symbol " << symbols[i];
+      return 1;
+    }
+  }
+
+  int64 checksum = 0;
+  const auto table_labels =
+      Time(shuffled_symbols,
+           [&symtab](const std::string &s) { return symtab->Find(s); },
+           &checksum);
+  const auto index_labels =
+      Time(shuffled_symbols,
+           [&index](const std::string &s) { return index->Find(s); },
+           &checksum);
+  const auto table_symbols =
+      Time(shuffled_labels,
+           [&symtab](int64 label) { return symtab->Find(label).size(); },
+           &checksum);
+  const auto index_symbols = Time(
+      shuffled_labels,
+      [&index](int64 label) {
+        std::string_view symbol;
+        index->Find(label, &symbol);
+        return symbol.size();
+      },
+      &checksum);
+
+  std::cout << "Symbols: " << index->NumSymbols() << "\n"
+            << "Index built in " << build.count() << " s, holding "
+            << index->NumBytes() << " bytes\n"
+            << "Symbol to label, ns per lookup: SymbolTable " << table_labels
+            << ", SymbolIndex " << index_labels << "\n"
+            << "Label to symbol, ns per lookup: SymbolTable " << table_symbols
+            << ", SymbolIndex " << index_symbols << "\n"
+            << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
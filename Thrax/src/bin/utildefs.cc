@@ -18,9 +18,11 @@
 #include <thrax/compat/compat.h>
 #include <../bin/utildefs.h>
 
+#include <algorithm>
 #include <memory>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -39,7 +41,6 @@ namespace thrax {
 namespace {
 
 using ::fst::kNoStateId;
-using ::fst::LabelsToUTF8String;
 using ::fst::PathIterator;
 using ::fst::Project;
 using ::fst::ProjectType;
@@ -52,49 +53,110 @@ using ::fst::TokenType;
 
 using Label = StdArc::Label;
 
-inline bool AppendLabel(Label label, TokenType type,
-                        const SymbolTable *generated_symtab,
-                        SymbolTable *symtab, std::string *path) {
-  if (label != 0) {
-    // Check first to see if this label is in the generated symbol set. Note
-    // that this should not conflict with a user-provided symbol table since
-    // the parser used by GrmCompiler doesn't generate extra labels if a
-    // string is parsed using a user-provided symbol table.
-    if (generated_symtab && !generated_symtab->Find(label).empty()) {
-      const auto &sym = generated_symtab->Find(label);
-      *path += "[" + sym + "]";
-    } else if (type == TokenType::SYMBOL) {
-      const auto &sym = symtab->Find(label);
-      if (sym.empty()) {
-        LOG(ERROR) << "Missing symbol in symbol table for id: " << label;
-        return false;
+// Appends the UTF-8 encoding of a code point. Returns false if the label is
+// not a code point.
+bool AppendUTF8(Label label, std::string *output) {
+  if (label < 0) return false;
+  if (label < 0x80) {
+    output->push_back(label);
+  } else if (label < 0x800) {
+    output->push_back(0xC0 | (label >> 6));
+    output->push_back(0x80 | (label & 0x3F));
+  } else if (label < 0x10000) {
+    output->push_back(0xE0 | (label >> 12));
+    output->push_back(0x80 | ((label >> 6) & 0x3F));
+    output->push_back(0x80 | (label & 0x3F));
+  } else if (label < 0x110000) {
+    output->push_back(0xF0 | (label >> 18));
+    output->push_back(0x80 | ((label >> 12) & 0x3F));
+    output->push_back(0x80 | ((label >> 6) & 0x3F));
+    output->push_back(0x80 | (label & 0x3F));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+LabelFormatter::LabelFormatter(const SymbolTable *generated_symtab,
+                               TokenType type, const SymbolTable *symtab)
+    : type_(type),
+      separator_(FST_FLAGS_field_separator),
+      min_generated_(1),
+      max_generated_(0) {
+  // Generated labels take precedence. Note that they should not conflict with
+  // a user-provided symbol table since the parser used by GrmCompiler doesn't
+  // generate extra labels if a string is parsed using a user-provided symbol
+  // table.
+  if (generated_symtab) {
+    for (const auto &item : *generated_symtab) {
+      const Label label = item.Label();
+      if (generated_.count(label)) continue;
+      const auto text = "[" + std::string(item.Symbol()) + "]";
+      generated_[label] = {static_cast<uint32>(pool_.size()),
+                           static_cast<uint32>(text.size())};
+      pool_ += text;
+      if (generated_.size() == 1) {
+        min_generated_ = max_generated_ = label;
+      } else {
+        min_generated_ = std::min(min_generated_, label);
+        max_generated_ = std::max(max_generated_, label);
       }
-      // For non-byte, non-UTF8 symbols, one overwhelmingly wants these to be
-      // space-separated.
-      if (!path->empty()) *path += FST_FLAGS_field_separator;
-      *path += sym;
-    } else if (type == TokenType::BYTE) {
-      path->push_back(label);
-    } else if (type == TokenType::UTF8) {
-      std::string utf8_string;
-      std::vector<Label> labels;
-      labels.push_back(label);
-      if (!LabelsToUTF8String(labels, &utf8_string)) {
-        LOG(ERROR) << "LabelsToUTF8String: Bad code point: " << label;
+    }
+  }
+  if (type == TokenType::SYMBOL && symtab) {
+    symbols_ = SymbolIndex::Build(*symtab);
+    if (!symbols_) LOG(FATAL) << "Cannot index symbol table " << symtab->Name();
+  }
+}
+
+bool LabelFormatter::Append(Label label, std::string *output) const {
+  if (label == 0) return true;
+  if (label >= min_generated_ && label <= max_generated_) {
+    const auto it = generated_.find(label);
+    if (it != generated_.end()) {
+      // Generated labels are not preceded by separators.
+      output->append(pool_, it->second.offset, it->second.size);
+      return true;
+    }
+  }
+  std::string_view symbol;
+  if (symbols_ && symbols_->Find(label, &symbol)) {
+    // For non-byte, non-UTF8 symbols, one overwhelmingly wants these to be
+    // space-separated.
+    if (!output->empty()) *output += separator_;
+    output->append(symbol.data(), symbol.size());
+    return true;
+  }
+  switch (type_) {
+    case TokenType::SYMBOL:
+      LOG(ERROR) << "Missing symbol in symbol table for id: " << label;
+      return false;
+    case TokenType::BYTE:
+      output->push_back(label);
+      return true;
+    case TokenType::UTF8:
+      if (!AppendUTF8(label, output)) {
+        LOG(ERROR) << "AppendUTF8: Bad code point: " << label;
         return false;
       }
-      *path += utf8_string;
-    }
+      return true;
   }
   return true;
 }
 
-}  // namespace
-
 bool FstToStrings(const StdVectorFst &fst,
                   std::vector<std::pair<std::string, float>> *strings,
                   const SymbolTable *generated_symtab, TokenType type,
                   SymbolTable *symtab, size_t n) {
+  const LabelFormatter formatter(generated_symtab, type, symtab);
+  return FstToStrings(fst, strings, formatter, n);
+}
+
+bool FstToStrings(const StdVectorFst &fst,
+                  std::vector<std::pair<std::string, float>> *strings,
+                  const LabelFormatter &formatter, size_t n) {
   StdVectorFst shortest_path;
   if (n == 1) {
     ShortestPath(fst, &shortest_path, n);
@@ -107,15 +169,13 @@ bool FstToStrings(const StdVectorFst &fst,
     ShortestPath(temp, &shortest_path, n, /*unique=*/true);
   }
   if (shortest_path.Start() == kNoStateId) return false;
+  // Every path is formatted into the same buffer, which then only grows
+  // while formatting the first few paths.
+  std::string path;
   for (PathIterator<StdArc> iter(shortest_path, /*check_acyclic=*/false);
        !iter.Done(); iter.Next()) {
-    std::string path;
-    for (const auto label : iter.OLabels()) {
-      if (!AppendLabel(label, type, generated_symtab, symtab, &path)) {
-        return false;
-      }
-    }
-    strings->emplace_back(std::move(path), iter.Weight().Value());
+    if (!formatter.Format(iter.OLabels(), &path)) return false;
+    strings->emplace_back(path, iter.Weight().Value());
   }
   return true;
 }
@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -29,9 +30,56 @@
 #include <fst/symbol-table.h>
 #include <fst/vector-fst.h>
 #include <thrax/grm-manager.h>
+#include <thrax/symbol-index.h>
 
 namespace thrax {
 
+// Turns output labels into text, as described for FstToStrings() below. The
+// text of every generated label is computed once, at construction, and for
+// TokenType::SYMBOL the symbol table is indexed by label (see SymbolIndex), so
+// formatting only copies bytes into the caller's buffer. A formatter is meant
+// to be built once per manager and output mode and shared by everything that
+// prints rewrites.
+class LabelFormatter {
+ public:
+  using Label = ::fst::StdArc::Label;
+
+  LabelFormatter(const ::fst::SymbolTable *generated_symtab,
+                 ::fst::TokenType type = ::fst::TokenType::BYTE,
+                 const ::fst::SymbolTable *symtab = nullptr);
+
+  // Appends the text of the label to the output. Returns false if the label
+  // has no symbol or is not a valid code point.
+  bool Append(Label label, std::string *output) const;
+
+  // Replaces the output with the text of the labels.
+  template <class Labels>
+  bool Format(const Labels &labels, std::string *output) const {
+    output->clear();
+    for (const auto label : labels) {
+      if (!Append(label, output)) return false;
+    }
+    return true;
+  }
+
+ private:
+  struct Entry {
+    uint32 offset;
+    uint32 size;
+  };
+
+  const ::fst::TokenType type_;
+  const std::string separator_;
+  // Texts of the generated labels, stored back to back.
+  std::string pool_;
+  std::unordered_map<Label, Entry> generated_;
+  // The range of the generated labels, which spares most labels the lookup.
+  Label min_generated_;
+  Label max_generated_;
+  // The symbols, for TokenType::SYMBOL.
+  std::unique_ptr<const SymbolIndex> symbols_;
+};
+
 // Computes the n-shortest paths and returns a vector of strings, each string
 // corresponding to each path. The mapping of labels to strings is controlled by
 // the type and the symtab. Elements that are in the generated label set from
@@ -44,6 +92,11 @@ bool FstToStrings(const ::fst::VectorFst<::fst::StdArc> &fst,
                   ::fst::TokenType type = ::fst::TokenType::BYTE,
                   ::fst::SymbolTable *symtab = nullptr, size_t n = 1);
 
+// Does the same with a prebuilt formatter.
+bool FstToStrings(const ::fst::VectorFst<::fst::StdArc> &fst,
+                  std::vector<std::pair<std::string, float>> *strings,
+                  const LabelFormatter &formatter, size_t n = 1);
+
 // Find the generated labels from the grammar.
 std::unique_ptr<::fst::SymbolTable> GetGeneratedSymbolTable(
     GrmManagerSpec<::fst::StdArc> *grm);
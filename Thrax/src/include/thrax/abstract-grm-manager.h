@@ -19,9 +19,21 @@
 #ifndef NLP_GRM_LANGUAGE_ABSTRACT_GRM_MANAGER_H_
 #define NLP_GRM_LANGUAGE_ABSTRACT_GRM_MANAGER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <streambuf>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <fst/compat.h>
@@ -36,11 +48,262 @@
 #include <fst/fstlib.h>
 #include <fst/string.h>
 #include <fst/vector-fst.h>
+#include <thrax/algo/chunked_rewrite.h>
+#include <thrax/algo/composition_profile.h>
+#include <thrax/algo/flat_dfa.h>
+#include <thrax/algo/incremental_rewrite.h>
+#include <thrax/algo/linear_compose.h>
+#include <thrax/algo/longest_match.h>
+#include <thrax/algo/packed_fst.h>
+#include <thrax/algo/state_order.h>
+#include <thrax/algo/streaming_rewrite.h>
+#include <thrax/algo/viterbi_rewrite.h>
+#include <thrax/grm-image.h>
 #include <thrax/make-parens-pair-vector.h>
+#include <thrax/rewrite-executor.h>
+#include <thrax/rule-metadata.h>
+#include <thrax/rule-profile.h>
+#include <thrax/shared-fst-registry.h>
 #include <unordered_map>
 
+DECLARE_int32(rewrite_threads);             // From util/flags.cc.
+DECLARE_int32(rewrite_queue_depth);         // From util/flags.cc.
+DECLARE_int64(parallel_rewrite_min_chunk);  // From util/flags.cc.
+DECLARE_int64(sequentialize_max_states);    // From util/flags.cc.
+DECLARE_bool(viterbi_rewrites);             // From util/flags.cc.
+DECLARE_bool(normalize_rule_epsilons);      // From util/flags.cc.
+DECLARE_bool(reorder_rule_states);          // From util/flags.cc.
+DECLARE_string(rule_state_profile);         // From util/flags.cc.
+DECLARE_bool(pack_rules);                   // From util/flags.cc.
+DECLARE_bool(verify_grm_image);             // From util/flags.cc.
+DECLARE_bool(share_identical_rules);        // From util/flags.cc.
+
 namespace thrax {
 
+// The name of the special FST that holds the symbol table of the generated
+// labels. This name should be one disallowed by the variable naming rules
+// (i.e., the user shouldn't be able to create this).
+static const char kStringFstSymtabFst[] = "*StringFstSymbolTable";
+
+// The prefix of the names of the FSTs holding rule triggers: the trigger of
+// rule "foo" is stored as "*Trigger:foo". Like the generated labels symbol
+// table, these names cannot be created by the user.
+static const char kTriggerFstPrefix[] = "*Trigger:";
+
+// The name of the special FST whose input symbol table lists the rules which
+// are input-deterministic, and so can be applied without composition.
+static const char kSequentialRulesFst[] = "*SequentialRules";
+
+// The name of the special FST whose input symbol table holds the metadata of
+// the exported rules; see RuleMetadata.
+static const char kRuleMetadataFst[] = "*RuleMetadata";
+
+// A rule resolved by AbstractGrmManager::PrepareRule() and made ready for
+// rewriting: the rule transducer, its flat form and trigger if it has them,
+// and, for a PDT or MPDT, the parentheses and assignments already extracted.
+// A prepared rule is immutable, so any number of threads may rewrite with it
+// at once, without copying the transducers or touching reference counts. It
+// refers to the FSTs of the manager, so it must not outlive the manager or be
+// used after SetFst() or a reload.
+template <typename Arc>
+struct PreparedRule {
+  using Label = typename Arc::Label;
+
+  const ::fst::Fst<Arc>* fst = nullptr;
+  const ::fst::Fst<Arc>* trigger = nullptr;
+  const ::fst::FlatDfa<Arc>* flat = nullptr;
+  // If the rule is known to have no input epsilons, composition needs no
+  // epsilon filter.
+  bool no_input_epsilons = false;
+  // If set, the bytes for which the rule has arcs; inputs with any other byte
+  // are rejected without rewriting.
+  const std::bitset<256>* byte_alphabet = nullptr;
+  bool pdt = false;
+  std::vector<std::pair<Label, Label>> pdt_parens;
+  bool mpdt = false;
+  std::vector<Label> mpdt_assignments;
+  // Hold the rule transducer and trigger when the manager's own are not safe
+  // for concurrent reads (e.g., a lazy FST with a mutable cache).
+  std::unique_ptr<const ::fst::Fst<Arc>> owned_fst;
+  std::unique_ptr<const ::fst::Fst<Arc>> owned_trigger;
+};
+
+// Rewrites one byte string with a rule as the string is edited, recomputing
+// after each edit only the part of the search the edit affects; see
+// IncrementalRewriter. Sessions are started by
+// AbstractGrmManager::StartRewriteSession(), and like a prepared rule they
+// must not outlive the manager or be used after SetFst() or a reload. A
+// session is not thread-safe.
+template <typename Arc>
+class RewriteSession {
+ public:
+  explicit RewriteSession(std::unique_ptr<const PreparedRule<Arc>> rule)
+      : rule_(std::move(rule)), rewriter_(*rule_->fst) {}
+
+  // Sets the input and rewrites it. Returns false if the rule does not accept
+  // the input, in which case the input is still set, so that later edits can
+  // make it acceptable.
+  bool SetInput(const std::string& input, std::string* output) {
+    output->clear();
+    const auto* begin = reinterpret_cast<const unsigned char*>(input.data());
+    return rewriter_.Reset(begin, begin + input.size(), output) ==
+           ::fst::ViterbiStatus::kSuccess;
+  }
+
+  // Replaces length bytes of the input from byte pos on with text, and
+  // rewrites the edited input just as SetInput() does.
+  bool Replace(size_t pos, size_t length, const std::string& text,
+               std::string* output) {
+    output->clear();
+    const auto* begin = reinterpret_cast<const unsigned char*>(text.data());
+    return rewriter_.Replace(pos, length, begin, begin + text.size(),
+                             output) == ::fst::ViterbiStatus::kSuccess;
+  }
+
+  std::string Input() const {
+    const auto& labels = rewriter_.Input();
+    return std::string(labels.begin(), labels.end());
+  }
+
+  // The number of input positions the last call recomputed.
+  size_t NumRecomputed() const { return rewriter_.NumRecomputed(); }
+
+ private:
+  std::unique_ptr<const PreparedRule<Arc>> rule_;
+  ::fst::IncrementalRewriter<Arc> rewriter_;
+};
+
+// Rewrites an unbounded stream of bytes with a rule, returning output as soon
+// as it is determined; see StreamingRewriter. Streams are started by
+// AbstractGrmManager::StartRewriteStream(), and like a prepared rule they
+// must not outlive the manager or be used after SetFst() or a reload. A
+// stream is not thread-safe.
+template <typename Arc>
+class RewriteStream {
+ public:
+  RewriteStream(std::unique_ptr<const PreparedRule<Arc>> rule,
+                size_t max_pending)
+      : rule_(std::move(rule)), rewriter_(*rule_->fst, max_pending) {}
+
+  // Reads the next chunk of the stream and sets the output to the bytes it
+  // determines, which may be none. Returns false once the rule cannot accept
+  // the stream, however it continues.
+  bool Write(const std::string& chunk, std::string* output) {
+    output->clear();
+    const auto* begin = reinterpret_cast<const unsigned char*>(chunk.data());
+    return rewriter_.Write(begin, begin + chunk.size(), output) ==
+           ::fst::ViterbiStatus::kSuccess;
+  }
+
+  // Ends the stream and sets the output to the rest of its rewrite. Returns
+  // false if the rule does not accept the stream. The next Write() starts a
+  // new stream.
+  bool Flush(std::string* output) {
+    output->clear();
+    return rewriter_.Flush(output) == ::fst::ViterbiStatus::kSuccess;
+  }
+
+  // The bytes of output held back until the input decides between the live
+  // hypotheses.
+  size_t NumPending() const { return rewriter_.NumPending(); }
+
+ private:
+  std::unique_ptr<const PreparedRule<Arc>> rule_;
+  ::fst::StreamingRewriter<Arc> rewriter_;
+};
+
+// The memory held by one FST of a manager. VectorFsts are measured by the
+// vectors holding their states and arcs, other FST types by their serialized
+// size, which for ConstFst and CompactFst is close to their size in memory.
+struct RuleMemoryUsage {
+  std::string name;
+  std::string type;
+  int64 num_states = 0;
+  int64 num_arcs = 0;
+  size_t fst_bytes = 0;
+  size_t symbol_table_bytes = 0;  // Input and output tables, if attached.
+  size_t flat_bytes = 0;          // The flat form, if the rule has one.
+  // Whether the FST shares its states and arcs with an identical FST loaded
+  // before it, by this manager or another; see SharedFstRegistry.
+  bool shared = false;
+
+  size_t TotalBytes() const {
+    return fst_bytes + symbol_table_bytes + flat_bytes;
+  }
+};
+
+struct GrmMemoryUsage {
+  std::vector<RuleMemoryUsage> rules;
+  std::map<std::string, size_t> bytes_by_type;
+  size_t total_bytes = 0;
+  // The part of total_bytes taken by the shared FSTs, which the manager does
+  // not hold memory for.
+  size_t shared_bytes = 0;
+};
+
+namespace internal {
+
+// A stream buffer which only counts the bytes written to it.
+class ByteCounter : public std::streambuf {
+ public:
+  size_t Count() const { return count_; }
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    count_ += n;
+    return n;
+  }
+
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) ++count_;
+    return traits_type::not_eof(ch);
+  }
+
+ private:
+  size_t count_ = 0;
+};
+
+// Copies the FST, which is typically computed on demand, to output, polling
+// interrupted every few states. Returns false, leaving output incomplete, if
+// interrupted returns true.
+template <class Arc>
+bool CopyInterruptibly(const ::fst::Fst<Arc>& fst,
+                       ::fst::MutableFst<Arc>* output,
+                       const std::function<bool()>& interrupted) {
+  using StateId = typename Arc::StateId;
+  constexpr StateId kPollInterval = 256;
+  output->DeleteStates();
+  if (fst.Start() == ::fst::kNoStateId) return true;
+  // Output states by input state, and the input state of each output state.
+  std::vector<StateId> output_states;
+  std::vector<StateId> input_states;
+  const auto find_state = [&](StateId s) {
+    if (s >= static_cast<StateId>(output_states.size())) {
+      output_states.resize(s + 1, ::fst::kNoStateId);
+    }
+    if (output_states[s] == ::fst::kNoStateId) {
+      output_states[s] = output->AddState();
+      input_states.push_back(s);
+    }
+    return output_states[s];
+  };
+  output->SetStart(find_state(fst.Start()));
+  for (StateId t = 0; t < static_cast<StateId>(input_states.size()); ++t) {
+    if (t % kPollInterval == 0 && interrupted()) return false;
+    const auto s = input_states[t];
+    output->SetFinal(t, fst.Final(s));
+    for (::fst::ArcIterator<::fst::Fst<Arc>> aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      auto arc = aiter.Value();
+      arc.nextstate = find_state(arc.nextstate);
+      output->AddArc(t, arc);
+    }
+  }
+  return true;
+}
+
+}  // namespace internal
+
 template <typename Arc>
 class AbstractGrmManager {
  public:
@@ -95,10 +358,136 @@ class AbstractGrmManager {
                const std::string& pdt_parens_rule = "",
                const std::string& mpdt_assignments_rule = "") const;
 
+  // Resolves the named rules (with the same meaning as above) once, for use
+  // by any number of subsequent rewrites from any number of threads; see
+  // PreparedRule. Returns nullptr if any of the rules cannot be found.
+  std::unique_ptr<const PreparedRule<Arc>> PrepareRule(
+      const std::string& rule, const std::string& pdt_parens_rule = "",
+      const std::string& mpdt_assignments_rule = "") const;
+
+  // These behave just like the functions above, but with a prepared rule. If
+  // control is given and interrupts the rewrite, they return false.
+
+  bool RewriteBytes(const PreparedRule<Arc>& rule, const std::string& input,
+                    std::string* output,
+                    const RewriteControl* control = nullptr) const;
+
+  bool RewriteBytes(const PreparedRule<Arc>& rule, const Transducer& input,
+                    std::string* output,
+                    const RewriteControl* control = nullptr) const;
+
+  bool Rewrite(const PreparedRule<Arc>& rule, const Transducer& input,
+               MutableTransducer* output,
+               const RewriteControl* control = nullptr) const;
+
+  // Runs RewriteBytes() on a pool of --rewrite_threads threads owned by the
+  // manager, started on first use, or on the calling thread if that is 0. At
+  // most --rewrite_queue_depth rewrites may wait for a thread; beyond that,
+  // requests are rejected at once with kRejected. If control is given, it may
+  // cancel the rewrite or set a deadline for it; this is checked as the rewrite
+  // proceeds, except within composition with a PDT or the final search of a
+  // composed lattice, which run to completion once started. The manager must
+  // outlive the rewrites it runs.
+  std::future<RewriteResult> RewriteAsync(
+      const std::string& rule, std::string input,
+      std::shared_ptr<const RewriteControl> control = nullptr,
+      const std::string& pdt_parens_rule = "",
+      const std::string& mpdt_assignments_rule = "") const;
+
+  // Does the same, but passes the result to done, which is called on a pool
+  // thread, or on the calling thread if the request is rejected.
+  void RewriteAsync(const std::string& rule, std::string input,
+                    std::shared_ptr<const RewriteControl> control,
+                    std::function<void(RewriteResult)> done,
+                    const std::string& pdt_parens_rule = "",
+                    const std::string& mpdt_assignments_rule = "") const;
+
+  // Rewrites one input with each of the named rules, which must not be PDTs,
+  // returning a result per rule in the same order. The input is compiled and
+  // the rules are looked up once per call, rather than once per rule. If
+  // parallel is true, the manager's threads help the calling thread work
+  // through the rules; requests are never rejected, and the calling thread
+  // runs any rules the threads do not get to. The help is queued apart from
+  // RewriteAsync() requests, so it never causes them to be rejected.
+  std::vector<RewriteResult> RewriteMany(const std::string& input,
+                                         const std::vector<std::string>& rules,
+                                         bool parallel = false) const;
+
+  // Rewrites one long input just like RewriteBytes(), but splits it into
+  // chunks of at least --parallel_rewrite_min_chunk bytes which the manager's
+  // threads rewrite at once; see ChunkedDfaRewriter. The output is the same
+  // as RewriteBytes()'s. Only rules with a flat form are split, and others
+  // are rewritten on the calling thread.
+  bool ParallelRewriteBytes(const std::string& rule, const std::string& input,
+                            std::string* output) const;
+
+  // Starts a session for rewriting a byte string with the named rule as the
+  // string is edited; see RewriteSession. Returns nullptr if the rule cannot
+  // be found, is not sorted on input labels, or has weights without the path
+  // property. Triggers are not consulted, since the session keeps the search
+  // state of the whole input anyway.
+  std::unique_ptr<RewriteSession<Arc>> StartRewriteSession(
+      const std::string& rule) const;
+
+  // Starts a stream of bytes to be rewritten with the named rule as they
+  // arrive; see RewriteStream. If max_pending is positive, at most that many
+  // bytes of output are held back, at the cost of exactness; see
+  // StreamingRewriter. Returns nullptr under the same conditions as
+  // StartRewriteSession().
+  std::unique_ptr<RewriteStream<Arc>> StartRewriteStream(
+      const std::string& rule, size_t max_pending = 0) const;
+
+  // Rewrites the input bytes just like RewriteBytes(), and adds to the profile
+  // under the rule's name the states and arcs of the rule which composition
+  // with the input visits; see CompositionProfiler. Nothing is counted for
+  // PDTs and MPDTs, or for inputs which the rule's trigger passes through.
+  bool ProfileRewriteBytes(const std::string& rule, const std::string& input,
+                           std::string* output, RuleProfile* profile,
+                           const std::string& pdt_parens_rule = "",
+                           const std::string& mpdt_assignments_rule = "") const;
+
+  // Segments the input bytes greedily from left to right, emitting the output
+  // of the longest entry of the named rule matching at each position; see
+  // LongestMatchSegmenter. Returns false if the rule cannot be found or made
+  // input-deterministic within --sequentialize_max_states states, or if the
+  // policy is kFail and some byte matches no entry.
+  bool SegmentBytes(
+      const std::string& rule, const std::string& input, std::string* output,
+      ::fst::UnmatchedPolicy policy = ::fst::UnmatchedPolicy::kCopy,
+      Label separator = 0) const;
+
+  // Prepares a segmenter for the named rule, for repeated use by any number of
+  // threads, or returns nullptr if SegmentBytes() would fail for this reason.
+  std::unique_ptr<const ::fst::LongestMatchSegmenter<Arc>> PrepareSegmenter(
+      const std::string& rule,
+      ::fst::UnmatchedPolicy policy = ::fst::UnmatchedPolicy::kCopy,
+      Label separator = 0) const;
+
   // This helper function (when given a potential string fst) takes the shortest
   // path, projects the output, and then removes epsilon arcs.
   static void StringifyFst(MutableTransducer* output);
 
+  // Returns true if the input is a string which the rule guarded by the
+  // trigger maps to itself, i.e., if every output label of the string has a
+  // transition in the trigger but no prefix of it reaches a final state. The
+  // trigger must be deterministic and sorted on input labels.
+  static bool PassesThrough(const Transducer& trigger,
+                            const Transducer& input);
+
+  // Does the same for a byte string.
+  static bool PassesThrough(const Transducer& trigger,
+                            const std::string& input);
+
+  // Computes the best rewrite of the input bytes under the prepared rule,
+  // which must not be a PDT, with the Viterbi kernel rather than by
+  // composition and ShortestPath(). Returns kUnsupported if the kernel does not
+  // apply, or is not enabled by --viterbi_rewrites, in which case the caller
+  // should compose instead, and kInterrupted if control interrupts the search.
+  // Inputs which pass through the rule's trigger are rewritten regardless.
+  static ::fst::ViterbiStatus ViterbiRewriteBytes(
+      const PreparedRule<Arc>& rule, const std::string& input,
+      std::string* output, const RewriteControl* control = nullptr);
+
   // ***************************************************************************
   // The following functions give access to, modify, or serialize internal data.
 
@@ -113,7 +502,8 @@ class AbstractGrmManager {
   std::unique_ptr<Transducer> GetFstSafe(const std::string& name) const;
 
   // Modify the transducer under the given name. If no such rule name exists,
-  // returns false, otherwise returns true. Note: For thread-safety, it is
+  // returns false, otherwise returns true. The flat form, trigger and
+  // metadata of the old transducer are dropped. Note: For thread-safety, it is
   // assumed this function will not be used in a multi-threaded context.
   bool SetFst(const std::string& name, const Transducer& input);
 
@@ -121,13 +511,69 @@ class AbstractGrmManager {
   // provided filename.
   virtual void ExportFar(const std::string& filename) const = 0;
 
+  // Returns the metadata of the named rule recorded in the FAR, or nullptr if
+  // there is none or the rule has changed since.
+  const RuleMetadata* GetRuleMetadata(const std::string& name) const;
+
   // Sorts input labels of all FSTs in the archive.
   void SortRuleInputLabels();
 
+  // Removes epsilon transitions from the rules which have input epsilons,
+  // keeping the result only where it is no larger, and logs the sizes before
+  // and after. Either way, it records whether each rule has input epsilons,
+  // so that rewriting can choose a cheaper composition filter. Rules which
+  // are not VectorFsts, such as packed rules, are not changed. Called on
+  // loading if --normalize_rule_epsilons is set.
+  void NormalizeRuleEpsilons();
+
+  // Renumbers the states of the rules for locality of reference: by visit
+  // count where --rule_state_profile has counts for the rule, and in
+  // breadth-first order otherwise. Rules which are not VectorFsts, such as
+  // packed rules, are not changed. Called on loading if --reorder_rule_states
+  // is set.
+  void ReorderRuleStates();
+
+  // Stores the rules which fit in packed form (see PackedFst), which takes
+  // half the memory of a VectorFst, and logs the bytes saved. Special FSTs,
+  // such as triggers, are not packed. Called on loading if --pack_rules is
+  // set; rules stored packed in the FAR stay packed either way.
+  void PackRules();
+
+  // Returns the flat form of the named rule if the archive lists it as
+  // sequential (see kSequentialRulesFst), and nullptr otherwise.
+  const ::fst::FlatDfa<Arc>* GetFlatRule(const std::string& name) const;
+
   // Alternative to LoadArchive, allowing you to provide the FSTs and keys
   // directly.
   void LoadFstMap(FstMap named_fsts);
 
+  // Writes the rules as they are now, after the preparation done on loading,
+  // to a runtime image; see grm-image.h. Expanded FSTs are stored as
+  // ConstFsts, so that they can be memory-mapped, and the flat forms and
+  // metadata of the rules are stored with them.
+  bool WriteImage(const std::string& path) const;
+
+  // Replaces the rules with those of a runtime image written by WriteImage(),
+  // memory-mapping the FSTs where their type allows. None of the preparation
+  // done on loading a FAR is repeated, whatever the flags; only the metadata
+  // of the rules is parsed again. If --verify_grm_image is set, the checksum
+  // of the image is checked first. Returns false, leaving the manager empty,
+  // if the image cannot be read.
+  bool LoadImage(const std::string& path);
+
+  // Reports the memory held by each FST, special FSTs included, and in total.
+  // Symbol tables shared by several FSTs are counted for each of them.
+  GrmMemoryUsage MemoryUsage() const;
+
+  // Replaces each FST identical to one already loaded, by this manager or any
+  // other in the process, with a copy of that one, which shares its states
+  // and arcs; see SharedFstRegistry. Only VectorFsts and ConstFsts are
+  // shared, so rules packed on loading are not. Logs the memory saved. Called
+  // on loading if --share_identical_rules is set, which it is not by default,
+  // since hashing and comparing every FST slows loading down for grammars
+  // with nothing to share.
+  void ShareIdenticalRules();
+
  protected:
   AbstractGrmManager();
 
@@ -136,10 +582,107 @@ class AbstractGrmManager {
   template <typename FarReader>
   bool LoadArchive(FarReader *reader);
 
+  // Builds the flat form of the named rule, returning false if it is not
+  // input-deterministic.
+  bool InitFlatRule(const std::string& name);
+
+  // Removes the named FST, and its flat form and trigger if it has them.
+  void RemoveFst(const std::string& name);
+
+  // Does the same as ShareIdenticalRules() for the named FSTs only, returning
+  // the bytes saved.
+  size_t ShareIdenticalFsts(const std::vector<std::string>& names);
+
+  // Records the rule metadata listed in the symbols, as in kRuleMetadataFst,
+  // checking it against the rules.
+  void AddRuleMetadata(const ::fst::SymbolTable& symbols);
+
+  // Prepares the named FSTs, just stored with their metadata recorded, as
+  // loading a FAR does: normalizes, reorders, sorts and packs them as the
+  // flags say, builds the flat forms of the rules listed in sequential_rules,
+  // and shares them if --share_identical_rules is set. Rules merely recorded
+  // as sequential in their metadata are not flattened, since the flat form
+  // takes memory of its own.
+  void PrepareFsts(const std::vector<std::string>& names,
+                   const std::set<std::string>& sequential_rules);
+
   // The list of FSTs held by this manager.
   FstMap fsts_;
 
  private:
+  // Returns the names of all the FSTs.
+  std::vector<std::string> FstNames() const;
+
+  // Returns the rules listed in kSequentialRulesFst, if any.
+  std::set<std::string> ListedSequentialRules() const;
+
+  // These do the same as the public functions above for the named FSTs only.
+  void SortRuleInputLabels(const std::vector<std::string>& names);
+  void NormalizeRuleEpsilons(const std::vector<std::string>& names);
+  void ReorderRuleStates(const std::vector<std::string>& names);
+  void PackRules(const std::vector<std::string>& names);
+
+  // Reads the rule metadata stored in the FAR, if any, checking it against
+  // the rules.
+  void InitRuleMetadata();
+
+  // Forgets what is known about the named rule when it changes.
+  void ClearRuleMetadata(const std::string& name);
+
+  // Fills in a prepared rule, logging and returning false if any of the rules
+  // cannot be found. Rules which are not safe for concurrent reads are copied
+  // if shared is false, and converted to a VectorFst if it is true.
+  bool InitPreparedRule(const std::string& rule,
+                        const std::string& pdt_parens_rule,
+                        const std::string& mpdt_assignments_rule, bool shared,
+                        PreparedRule<Arc>* prepared) const;
+
+  // Rewrites the input bytes directly, with the flat rule or the Viterbi
+  // kernel, if either applies. Returns kUnsupported if the caller must
+  // compose instead.
+  static ::fst::ViterbiStatus FastRewriteBytes(const PreparedRule<Arc>& rule,
+                                               const std::string& input,
+                                               std::string* output,
+                                               const RewriteControl* control);
+
+  // Returns the executor, creating it if necessary.
+  RewriteExecutor* GetExecutor() const;
+
+  // Measures the memory held by the states and arcs of an FST; see
+  // RuleMemoryUsage.
+  static size_t FstBytes(const std::string& name, const Transducer& fst,
+                         int64 num_states, int64 num_arcs);
+
+  // Returns a copy of the FST whose state and arc vectors are allocated to
+  // their size. OpenFst does not expose the capacities of these vectors, so
+  // the passes which edit a VectorFst in place, and may leave them larger
+  // than needed, end with such a copy for FstBytes() to measure exactly.
+  static std::unique_ptr<MutableTransducer> Compacted(
+      const MutableTransducer& fst) {
+    // Conversion from the Fst interface, unlike the copy constructor, builds
+    // new vectors, reserving each to its final size.
+    return std::make_unique<MutableTransducer>(
+        static_cast<const Transducer&>(fst));
+  }
+
+  std::map<std::string, std::unique_ptr<const ::fst::FlatDfa<Arc>>>
+      flat_rules_;
+
+  std::map<std::string, RuleMetadata> metadata_;
+  // The byte alphabets of the rules which lack arcs for some bytes.
+  std::map<std::string, std::bitset<256>> byte_alphabets_;
+
+  // The FSTs which share storage with one loaded before them, and by name the
+  // references which keep the FSTs of this manager in the registry, whether
+  // they were shared from it or registered for others to share. An entry goes
+  // with the FST it stands for.
+  std::set<std::string> shared_rules_;
+  std::map<std::string, std::shared_ptr<const Transducer>> registered_fsts_;
+
+  // Runs RewriteAsync() requests; created on first use.
+  mutable std::once_flag executor_once_;
+  mutable std::unique_ptr<RewriteExecutor> executor_;
+
   AbstractGrmManager(const AbstractGrmManager&) = delete;
   AbstractGrmManager& operator=(const AbstractGrmManager&) = delete;
 };
@@ -149,17 +692,28 @@ AbstractGrmManager<Arc>::AbstractGrmManager() {}
 
 template <typename Arc>
 AbstractGrmManager<Arc>::~AbstractGrmManager() {
+  // Finishes pending asynchronous rewrites while the rules still exist.
+  executor_.reset();
 }
 
 template <typename Arc>
 template <typename FarReader>
 bool AbstractGrmManager<Arc>::LoadArchive(FarReader *reader) {
   fsts_.clear();
+  shared_rules_.clear();
+  registered_fsts_.clear();
   for (reader->Reset(); !reader->Done(); reader->Next()) {
     const auto& name = reader->GetKey();
-    fsts_[name] = std::make_unique<MutableTransducer>(*reader->GetFst());
+    const auto* fst = reader->GetFst();
+    if (::fst::IsPackedFst(*fst)) {
+      fsts_[name] = ::fst::WrapUnique(fst->Copy());
+    } else {
+      fsts_[name] = std::make_unique<MutableTransducer>(*fst);
+    }
   }
-  SortRuleInputLabels();
+  flat_rules_.clear();
+  InitRuleMetadata();
+  PrepareFsts(FstNames(), ListedSequentialRules());
   return true;
 }
 
@@ -169,24 +723,515 @@ void AbstractGrmManager<Arc>::LoadFstMap(FstMap named_fsts) {
     CHECK_NE(key_and_fst.second, nullptr);
   }
   fsts_ = std::move(named_fsts);
-  SortRuleInputLabels();
+  shared_rules_.clear();
+  registered_fsts_.clear();
+  flat_rules_.clear();
+  InitRuleMetadata();
+  PrepareFsts(FstNames(), ListedSequentialRules());
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::WriteImage(const std::string& path) const {
+  GrmImageHeader header;
+  header.arc_type = Arc::Type();
+  // The metadata is written as the manager knows it, since preparation may
+  // have changed the rules it describes.
+  std::unique_ptr<MutableTransducer> metadata_fst;
+  if (!metadata_.empty()) {
+    ::fst::SymbolTable symbols(kRuleMetadataFst);
+    for (const auto& [name, metadata] : metadata_) {
+      symbols.AddSymbol(metadata.ToString(name));
+    }
+    metadata_fst = std::make_unique<MutableTransducer>();
+    metadata_fst->SetInputSymbols(&symbols);
+  }
+  std::vector<const Transducer*> fsts;
+  for (const auto& [name, fst] : fsts_) {
+    if (name == kRuleMetadataFst) continue;
+    header.entries.push_back({name, GrmImageEntry::kFst});
+    fsts.push_back(fst.get());
+  }
+  if (metadata_fst) {
+    header.entries.push_back({kRuleMetadataFst, GrmImageEntry::kFst});
+    fsts.push_back(metadata_fst.get());
+  }
+  for (const auto& [name, flat_rule] : flat_rules_) {
+    header.entries.push_back({name, GrmImageEntry::kFlatRule});
+  }
+  std::ofstream strm(path, std::ios_base::out | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "Unable to create image: " << path;
+    return false;
+  }
+  // Writes the header with placeholder offsets, then the payload.
+  header.Write(strm);
+  const int64 payload = strm.tellp();
+  ::fst::FstWriteOptions opts(path);
+  opts.align = true;
+  auto flat_it = flat_rules_.begin();
+  for (size_t i = 0; i < header.entries.size(); ++i) {
+    auto& entry = header.entries[i];
+    entry.offset = strm.tellp();
+    if (entry.kind == GrmImageEntry::kFst) {
+      const auto& fst = *fsts[i];
+      if (fst.Type() == "const" || ::fst::IsPackedFst(fst)) {
+        fst.Write(strm, opts);
+      } else {
+        ::fst::ConstFst<Arc>(fst).Write(strm, opts);
+      }
+    } else {
+      (flat_it++)->second->Write(strm, path);
+    }
+    entry.size = static_cast<int64>(strm.tellp()) - entry.offset;
+  }
+  strm.close();
+  if (strm.fail()) {
+    LOG(ERROR) << "Unable to write image: " << path;
+    return false;
+  }
+  // Fills in the offsets and the checksum, which should leave the size of
+  // the header unchanged; if it did not, the header would now overlap the
+  // payload.
+  std::fstream update(path, std::ios_base::in | std::ios_base::out |
+                                std::ios_base::binary);
+  header.checksum = GrmImageChecksum(update, payload);
+  update.seekp(0);
+  header.Write(update);
+  const int64 header_end = update.tellp();
+  update.close();
+  if (update.fail()) {
+    LOG(ERROR) << "Unable to write image: " << path;
+    return false;
+  }
+  if (header_end != payload) {
+    LOG(ERROR) << "Image header changed size from " << payload << " to "
+               << header_end << " bytes: " << path;
+    return false;
+  }
+  return true;
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::LoadImage(const std::string& path) {
+  fsts_.clear();
+  shared_rules_.clear();
+  registered_fsts_.clear();
+  flat_rules_.clear();
+  metadata_.clear();
+  byte_alphabets_.clear();
+  std::ifstream strm(path, std::ios_base::in | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "Unable to open image: " << path;
+    return false;
+  }
+  GrmImageHeader header;
+  if (!header.Read(strm, path)) return false;
+  if (header.arc_type != Arc::Type()) {
+    LOG(ERROR) << "Image " << path << " has arc type " << header.arc_type
+               << ", not " << Arc::Type();
+    return false;
+  }
+  if (FST_FLAGS_verify_grm_image &&
+      GrmImageChecksum(strm, strm.tellg()) != header.checksum) {
+    LOG(ERROR) << "Checksum mismatch in image: " << path;
+    return false;
+  }
+  ::fst::FstReadOptions opts(path);
+  opts.mode = ::fst::FstReadOptions::MAP;
+  for (const auto& entry : header.entries) {
+    strm.seekg(entry.offset);
+    if (entry.kind == GrmImageEntry::kFst) {
+      fsts_[entry.name] = ::fst::WrapUnique(Transducer::Read(strm, opts));
+      if (!fsts_[entry.name]) {
+        LOG(ERROR) << "Unable to read FST " << entry.name << " from image: "
+                   << path;
+        fsts_.clear();
+        flat_rules_.clear();
+        return false;
+      }
+    } else {
+      flat_rules_[entry.name] = ::fst::WrapUnique(
+          ::fst::FlatDfa<Arc>::Read(strm, path));
+      if (!flat_rules_[entry.name]) {
+        LOG(ERROR) << "Unable to read flat rule " << entry.name
+                   << " from image: " << path;
+        fsts_.clear();
+        flat_rules_.clear();
+        return false;
+      }
+    }
+  }
+  InitRuleMetadata();
+  return true;
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::PrepareFsts(
+    const std::vector<std::string>& names,
+    const std::set<std::string>& sequential_rules) {
+  if (FST_FLAGS_normalize_rule_epsilons) NormalizeRuleEpsilons(names);
+  if (FST_FLAGS_reorder_rule_states) ReorderRuleStates(names);
+  SortRuleInputLabels(names);
+  if (FST_FLAGS_pack_rules) PackRules(names);
+  for (const auto& name : names) {
+    if (sequential_rules.count(name)) InitFlatRule(name);
+  }
+  if (FST_FLAGS_share_identical_rules) ShareIdenticalFsts(names);
+}
+
+template <typename Arc>
+std::vector<std::string> AbstractGrmManager<Arc>::FstNames() const {
+  std::vector<std::string> names;
+  for (const auto& [name, fst] : fsts_) names.push_back(name);
+  return names;
+}
+
+template <typename Arc>
+std::set<std::string> AbstractGrmManager<Arc>::ListedSequentialRules() const {
+  std::set<std::string> rules;
+  const auto* sequential_fst = GetFst(kSequentialRulesFst);
+  if (sequential_fst && sequential_fst->InputSymbols()) {
+    for (const auto& item : *sequential_fst->InputSymbols()) {
+      rules.emplace(item.Symbol());
+    }
+  }
+  return rules;
 }
 
 template <typename Arc>
 void AbstractGrmManager<Arc>::SortRuleInputLabels() {
-  for (auto &pair : fsts_) {
-    const auto& fst = *pair.second;
+  SortRuleInputLabels(FstNames());
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::SortRuleInputLabels(
+    const std::vector<std::string>& names) {
+  for (const auto& name : names) {
+    const auto it = fsts_.find(name);
+    if (it == fsts_.end()) continue;
+    const auto& fst = *it->second;
     // Arc-sorts if the FST is not known to be input-sorted.
     if (fst.Properties(::fst::kILabelSorted, false) !=
         ::fst::kILabelSorted) {
       auto sorted_fst = std::make_unique<MutableTransducer>(fst);
       static const ::fst::ILabelCompare<Arc> icomp;
       ::fst::ArcSort(sorted_fst.get(), icomp);
-      pair.second = std::move(sorted_fst);
+      it->second = std::move(sorted_fst);
+    }
+  }
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::NormalizeRuleEpsilons() {
+  NormalizeRuleEpsilons(FstNames());
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::NormalizeRuleEpsilons(
+    const std::vector<std::string>& names) {
+  int64 states_before = 0, arcs_before = 0, states_after = 0, arcs_after = 0;
+  for (const auto& name : names) {
+    const auto it = fsts_.find(name);
+    if (it == fsts_.end()) continue;
+    auto& fst = it->second;
+    // Special FSTs, such as triggers, are left alone.
+    if (name.empty() || name[0] == '*') continue;
+    const auto* metadata = GetRuleMetadata(name);
+    if (metadata ? metadata->HasProperties(::fst::kNoIEpsilons)
+                 : fst->Properties(::fst::kNoIEpsilons, true) ==
+                       ::fst::kNoIEpsilons) {
+      continue;
+    }
+    // Rules stored in another form, such as packed or const FSTs from the
+    // FAR, would have to be unpacked; they are left as they are.
+    if (fst->Type() != "vector") continue;
+    auto normalized = std::make_unique<MutableTransducer>(*fst);
+    const auto states = normalized->NumStates();
+    const auto arcs = ::fst::CountArcs(*normalized);
+    // Only transitions with epsilon on both sides can go; those with an
+    // output label stay, but removing the others often leaves none.
+    ::fst::RmEpsilon(normalized.get());
+    const auto new_states = normalized->NumStates();
+    const auto new_arcs = ::fst::CountArcs(*normalized);
+    states_before += states;
+    arcs_before += arcs;
+    VLOG(1) << "Rule " << name << ": " << states << " states, " << arcs
+            << " arcs before epsilon removal; " << new_states << " states, "
+            << new_arcs << " arcs after";
+    if (new_states + new_arcs > states + arcs) {
+      VLOG(1) << "Keeping rule " << name << " as it was";
+      states_after += states;
+      arcs_after += arcs;
+      continue;
+    }
+    states_after += new_states;
+    arcs_after += new_arcs;
+    // Records the property for InitPreparedRule().
+    normalized->Properties(::fst::kNoIEpsilons, true);
+    fst = Compacted(*normalized);
+    ClearRuleMetadata(name);
+  }
+  LOG(INFO) << "Epsilon normalization: " << states_before << " states, "
+            << arcs_before << " arcs before; " << states_after << " states, "
+            << arcs_after << " arcs after";
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::ReorderRuleStates() {
+  ReorderRuleStates(FstNames());
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::ReorderRuleStates(
+    const std::vector<std::string>& names) {
+  RuleProfile profile;
+  if (!FST_FLAGS_rule_state_profile.empty() &&
+      !profile.Read(FST_FLAGS_rule_state_profile)) {
+    LOG(WARNING) << "Ignoring the state profile";
+    profile = RuleProfile();
+  }
+  for (const auto& name : names) {
+    const auto it = fsts_.find(name);
+    if (it == fsts_.end()) continue;
+    auto& fst = it->second;
+    // As in NormalizeRuleEpsilons(), rules in other forms are left alone.
+    if (fst->Start() == ::fst::kNoStateId || fst->Type() != "vector") {
+      continue;
+    }
+    const auto* visits = profile.StateVisits(name);
+    auto reordered = std::make_unique<MutableTransducer>(*fst);
+    // The counts are indexed by the states of the rule as stored, so they do
+    // not apply to a rule which has since been changed.
+    if (visits &&
+        visits->size() > static_cast<size_t>(reordered->NumStates())) {
+      LOG(WARNING) << "State profile does not match rule " << name;
+      visits = nullptr;
+    }
+    ::fst::ReorderStates(reordered.get(), visits);
+    fst = Compacted(*reordered);
+  }
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::PackRules() {
+  PackRules(FstNames());
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::PackRules(const std::vector<std::string>& names) {
+  size_t num_packed = 0;
+  int64 arcs_packed = 0;
+  for (const auto& name : names) {
+    const auto it = fsts_.find(name);
+    if (it == fsts_.end()) continue;
+    auto& fst = it->second;
+    // Special FSTs, such as triggers, are left alone.
+    if (name.empty() || name[0] == '*') continue;
+    if (fst->Start() == ::fst::kNoStateId || ::fst::IsPackedFst(*fst)) {
+      continue;
+    }
+    std::unique_ptr<const MutableTransducer> expanded;
+    if (fst->Properties(::fst::kExpanded, false) != ::fst::kExpanded) {
+      expanded = std::make_unique<MutableTransducer>(*fst);
     }
+    const auto& source = expanded
+        ? *expanded
+        : static_cast<const ::fst::ExpandedFst<Arc>&>(*fst);
+    auto packed = ::fst::MakePackedFst(source);
+    if (!packed) {
+      VLOG(1) << "Rule " << name << " does not fit in packed form";
+      continue;
+    }
+    ++num_packed;
+    arcs_packed += ::fst::CountArcs(*packed);
+    fst = std::move(packed);
+  }
+  // A standard arc takes 16 bytes and a packed one 8.
+  LOG(INFO) << "Packed " << num_packed << " rules, saving about "
+            << arcs_packed * (sizeof(Arc) - sizeof(::fst::PackedArcElement))
+            << " bytes";
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::InitRuleMetadata() {
+  metadata_.clear();
+  byte_alphabets_.clear();
+  const auto* metadata_fst = GetFst(kRuleMetadataFst);
+  if (metadata_fst && metadata_fst->InputSymbols()) {
+    AddRuleMetadata(*metadata_fst->InputSymbols());
+  }
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::AddRuleMetadata(
+    const ::fst::SymbolTable& symbols) {
+  for (const auto& item : symbols) {
+    std::string name;
+    RuleMetadata metadata;
+    if (!RuleMetadata::FromString(std::string(item.Symbol()), &name,
+                                  &metadata)) {
+      LOG(WARNING) << "Ignoring malformed rule metadata: " << item.Symbol();
+      continue;
+    }
+    const auto* fst = GetFst(name);
+    if (!fst) continue;
+    if (fst->Properties(::fst::kExpanded, false) == ::fst::kExpanded &&
+        static_cast<const ::fst::ExpandedFst<Arc>*>(fst)->NumStates() !=
+            metadata.num_states) {
+      LOG(WARNING) << "Ignoring metadata which does not match rule " << name;
+      continue;
+    }
+    std::bitset<256> byte_alphabet;
+    for (int byte = 1; byte < 256; ++byte) {
+      byte_alphabet[byte] = metadata.HasInputLabel(byte);
+    }
+    if (byte_alphabet.count() < 255) byte_alphabets_[name] = byte_alphabet;
+    metadata_[name] = std::move(metadata);
   }
 }
 
+template <typename Arc>
+void AbstractGrmManager<Arc>::ClearRuleMetadata(const std::string& name) {
+  metadata_.erase(name);
+  byte_alphabets_.erase(name);
+}
+
+template <typename Arc>
+const RuleMetadata* AbstractGrmManager<Arc>::GetRuleMetadata(
+    const std::string& name) const {
+  const auto it = metadata_.find(name);
+  return it == metadata_.end() ? nullptr : &it->second;
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::InitFlatRule(const std::string& name) {
+  const auto* fst = GetFst(name);
+  if (!fst) return false;
+  auto flat_rule = std::make_unique<::fst::FlatDfa<Arc>>();
+  if (!flat_rule->Init(*fst)) {
+    LOG(WARNING) << "Rule " << name << " is listed as sequential but is not "
+                 << "input-deterministic";
+    return false;
+  }
+  flat_rules_[name] = std::move(flat_rule);
+  return true;
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::RemoveFst(const std::string& name) {
+  fsts_.erase(name);
+  fsts_.erase(kTriggerFstPrefix + name);
+  flat_rules_.erase(name);
+  shared_rules_.erase(name);
+  registered_fsts_.erase(name);
+  registered_fsts_.erase(kTriggerFstPrefix + name);
+  ClearRuleMetadata(name);
+}
+
+template <typename Arc>
+GrmMemoryUsage AbstractGrmManager<Arc>::MemoryUsage() const {
+  GrmMemoryUsage usage;
+  for (const auto& [name, fst] : fsts_) {
+    RuleMemoryUsage rule;
+    rule.name = name;
+    rule.type = fst->Type();
+    for (::fst::StateIterator<Transducer> siter(*fst); !siter.Done();
+         siter.Next()) {
+      ++rule.num_states;
+      rule.num_arcs += fst->NumArcs(siter.Value());
+    }
+    rule.fst_bytes = FstBytes(name, *fst, rule.num_states, rule.num_arcs);
+    rule.shared = shared_rules_.count(name) > 0;
+    const auto* isymbols = fst->InputSymbols();
+    const auto* osymbols = fst->OutputSymbols();
+    // An acceptor commonly has the same table on both sides.
+    if (osymbols == isymbols) osymbols = nullptr;
+    for (const auto* symbols : {isymbols, osymbols}) {
+      if (!symbols) continue;
+      internal::ByteCounter counter;
+      std::ostream strm(&counter);
+      symbols->Write(strm);
+      rule.symbol_table_bytes += counter.Count();
+    }
+    if (const auto* flat_rule = GetFlatRule(name)) {
+      rule.flat_bytes = flat_rule->SizeInBytes();
+    }
+    usage.bytes_by_type[rule.type] += rule.fst_bytes;
+    usage.total_bytes += rule.TotalBytes();
+    if (rule.shared) usage.shared_bytes += rule.fst_bytes;
+    usage.rules.push_back(std::move(rule));
+  }
+  return usage;
+}
+
+template <typename Arc>
+size_t AbstractGrmManager<Arc>::FstBytes(const std::string& name,
+                                         const Transducer& fst,
+                                         int64 num_states, int64 num_arcs) {
+  if (fst.Type() == "vector") {
+    // The FST object and its implementation, the vector of state pointers,
+    // and each state with its vector of arcs. The vectors are allocated to
+    // their size as loaded or as left by Compacted(); see there.
+    return sizeof(MutableTransducer) +
+           sizeof(::fst::internal::VectorFstImpl<::fst::VectorState<Arc>>) +
+           num_states * (sizeof(::fst::VectorState<Arc>) +
+                         sizeof(::fst::VectorState<Arc>*)) +
+           num_arcs * sizeof(Arc);
+  }
+  internal::ByteCounter counter;
+  std::ostream strm(&counter);
+  fst.Write(strm, ::fst::FstWriteOptions(name, /*write_header=*/true,
+                                         /*write_isymbols=*/false,
+                                         /*write_osymbols=*/false));
+  return counter.Count();
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::ShareIdenticalRules() {
+  ShareIdenticalFsts(FstNames());
+}
+
+template <typename Arc>
+size_t AbstractGrmManager<Arc>::ShareIdenticalFsts(
+    const std::vector<std::string>& names) {
+  auto* registry = SharedFstRegistry<Arc>::Get();
+  registry->Prune();
+  size_t num_shared = 0;
+  size_t bytes_saved = 0;
+  for (const auto& name : names) {
+    const auto it = fsts_.find(name);
+    // FSTs already in the registry would only be found there again.
+    if (it == fsts_.end() || registered_fsts_.count(name)) continue;
+    // Copies of lazy FSTs would not share their states and arcs, and copies
+    // of cached ones would share a cache; see SharedFstRegistry.
+    if (!SharedFstRegistry<Arc>::Shareable(*it->second)) continue;
+    std::shared_ptr<const Transducer> registered;
+    if (registry->Share(&it->second, &registered)) {
+      ++num_shared;
+      bytes_saved += FstBytes(name, *it->second,
+                              ::fst::CountStates(*it->second),
+                              ::fst::CountArcs(*it->second));
+      shared_rules_.insert(name);
+    }
+    // Shared or not, the FST is now in the registry; without a holder,
+    // Prune() would drop one this manager registered before another manager
+    // could share it.
+    registered_fsts_[name] = std::move(registered);
+  }
+  if (num_shared > 0) {
+    LOG(INFO) << "Shared " << num_shared << " FSTs identical to ones already "
+              << "loaded, saving " << bytes_saved << " bytes";
+  }
+  return bytes_saved;
+}
+
+template <typename Arc>
+const ::fst::FlatDfa<Arc>* AbstractGrmManager<Arc>::GetFlatRule(
+    const std::string& name) const {
+  const auto it = flat_rules_.find(name);
+  return it == flat_rules_.end() ? nullptr : it->second.get();
+}
+
 template <typename Arc>
 const typename AbstractGrmManager<Arc>::Transducer*
 AbstractGrmManager<Arc>::GetFst(const std::string& name) const {
@@ -207,22 +1252,123 @@ bool AbstractGrmManager<Arc>::SetFst(const std::string& name,
   auto it = fsts_.find(name);
   if (it != fsts_.end()) {
     it->second = fst::WrapUnique(input.Copy(true));
+    // The new transducer need not be sequential, and the trigger of the old
+    // one says nothing about which inputs it rewrites.
+    fsts_.erase(kTriggerFstPrefix + name);
+    flat_rules_.erase(name);
+    shared_rules_.erase(name);
+    registered_fsts_.erase(name);
+    registered_fsts_.erase(kTriggerFstPrefix + name);
+    ClearRuleMetadata(name);
     return true;
   }
   return false;
 }
 
+template <typename Arc>
+bool AbstractGrmManager<Arc>::InitPreparedRule(
+    const std::string& rule, const std::string& pdt_parens_rule,
+    const std::string& mpdt_assignments_rule, bool shared,
+    PreparedRule<Arc>* prepared) const {
+  const auto* rule_fst = GetFst(rule);
+  if (!rule_fst) {
+    LOG(ERROR) << "Rule " << rule << " not found.";
+    return false;
+  }
+  // Expanded FSTs without caches can be read by many threads at once; others
+  // get a private copy, as GetFstSafe() would make.
+  const auto& type = rule_fst->Type();
+  if (type == "vector" || type == "const") {
+    prepared->fst = rule_fst;
+  } else {
+    if (shared) {
+      prepared->owned_fst = std::make_unique<MutableTransducer>(*rule_fst);
+    } else {
+      prepared->owned_fst = fst::WrapUnique(rule_fst->Copy(true));
+    }
+    prepared->fst = prepared->owned_fst.get();
+  }
+  const Transducer* pdt_parens_fst = nullptr;
+  if (!pdt_parens_rule.empty()) {
+    pdt_parens_fst = GetFst(pdt_parens_rule);
+    if (!pdt_parens_fst) {
+      LOG(ERROR) << "PDT parentheses rule " << pdt_parens_rule << " not found.";
+      return false;
+    }
+  }
+  const Transducer* mpdt_assignments_fst = nullptr;
+  if (!mpdt_assignments_rule.empty()) {
+    mpdt_assignments_fst = GetFst(mpdt_assignments_rule);
+    if (!mpdt_assignments_fst) {
+      LOG(ERROR) << "MPDT assignments rule " << mpdt_assignments_rule
+                 << " not found.";
+      return false;
+    }
+  }
+  if (pdt_parens_fst) {
+    // Only reads the helper rules, which is safe even for lazy FSTs as they
+    // are reached through their own copies.
+    const std::unique_ptr<const Transducer> parens(pdt_parens_fst->Copy(true));
+    prepared->pdt = true;
+    MakeParensPairVector(*parens, &prepared->pdt_parens);
+    if (mpdt_assignments_fst) {
+      const std::unique_ptr<const Transducer> assignments(
+          mpdt_assignments_fst->Copy(true));
+      prepared->mpdt = true;
+      MakeAssignmentsVector(*assignments, prepared->pdt_parens,
+                            &prepared->mpdt_assignments);
+    }
+  } else {
+    prepared->flat = GetFlatRule(rule);
+    prepared->trigger = GetFst(kTriggerFstPrefix + rule);
+    // Triggers are not packed by this manager, but may have been stored in
+    // another form; they then get a private copy like the rule.
+    if (prepared->trigger && prepared->trigger->Type() != "vector" &&
+        prepared->trigger->Type() != "const") {
+      if (shared) {
+        prepared->owned_trigger =
+            std::make_unique<MutableTransducer>(*prepared->trigger);
+      } else {
+        prepared->owned_trigger =
+            fst::WrapUnique(prepared->trigger->Copy(true));
+      }
+      prepared->trigger = prepared->owned_trigger.get();
+    }
+    // The recorded metadata saves testing properties which are not known.
+    const auto* metadata = GetRuleMetadata(rule);
+    prepared->no_input_epsilons =
+        (metadata && metadata->HasProperties(::fst::kNoIEpsilons)) ||
+        prepared->fst->Properties(::fst::kNoIEpsilons, false) ==
+            ::fst::kNoIEpsilons;
+    const auto it = byte_alphabets_.find(rule);
+    if (it != byte_alphabets_.end()) prepared->byte_alphabet = &it->second;
+  }
+  return true;
+}
+
+template <typename Arc>
+std::unique_ptr<const PreparedRule<Arc>> AbstractGrmManager<Arc>::PrepareRule(
+    const std::string& rule, const std::string& pdt_parens_rule,
+    const std::string& mpdt_assignments_rule) const {
+  auto prepared = std::make_unique<PreparedRule<Arc>>();
+  if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                        /*shared=*/true, prepared.get())) {
+    return nullptr;
+  }
+  return prepared;
+}
+
 template <typename Arc>
 bool AbstractGrmManager<Arc>::RewriteBytes(
     const std::string& rule, const std::string& input, std::string* output,
     const std::string& pdt_parens_rule,
     const std::string& mpdt_assignments_rule) const {
-  static const ::fst::StringCompiler<Arc> compiler(
-      ::fst::TokenType::BYTE);
-  MutableTransducer str_fst;
-  if (!compiler(input, &str_fst)) return false;
-  return RewriteBytes(rule, str_fst, output, pdt_parens_rule,
-                      mpdt_assignments_rule);
+  PreparedRule<Arc> prepared;
+  if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                        /*shared=*/false, &prepared)) {
+    return false;
+  }
+  return RewriteBytes(prepared, input, output);
 }
 
 template <typename Arc>
@@ -230,16 +1376,12 @@ bool AbstractGrmManager<Arc>::RewriteBytes(
     const std::string& rule, const Transducer& input, std::string* output,
     const std::string& pdt_parens_rule,
     const std::string& mpdt_assignments_rule) const {
-  MutableTransducer output_fst;
-  if (!Rewrite(rule, input, &output_fst, pdt_parens_rule,
-               mpdt_assignments_rule)) {
+  PreparedRule<Arc> prepared;
+  if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                        /*shared=*/false, &prepared)) {
     return false;
   }
-  StringifyFst(&output_fst);
-  if (output_fst.Start() == ::fst::kNoStateId) return false;
-  static const ::fst::StringPrinter<Arc> printer(
-      ::fst::TokenType::BYTE);
-  return printer(output_fst, output);
+  return RewriteBytes(prepared, input, output);
 }
 
 template <typename Arc>
@@ -260,57 +1402,474 @@ bool AbstractGrmManager<Arc>::Rewrite(
     const std::string& rule, const Transducer& input, MutableTransducer* output,
     const std::string& pdt_parens_rule,
     const std::string& mpdt_assignments_rule) const {
-  const std::unique_ptr<const Transducer> rule_fst = GetFstSafe(rule);
-  if (!rule_fst) {
-    LOG(ERROR) << "Rule " << rule << " not found.";
+  PreparedRule<Arc> prepared;
+  if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                        /*shared=*/false, &prepared)) {
     return false;
   }
-  std::unique_ptr<const Transducer> pdt_parens_fst;
-  if (!pdt_parens_rule.empty()) {
-    pdt_parens_fst = GetFstSafe(pdt_parens_rule);
-    if (!pdt_parens_fst) {
-      LOG(ERROR) << "PDT parentheses rule " << pdt_parens_rule << " not found.";
+  return Rewrite(prepared, input, output);
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::RewriteBytes(
+    const PreparedRule<Arc>& rule, const std::string& input,
+    std::string* output, const RewriteControl* control) const {
+  switch (FastRewriteBytes(rule, input, output, control)) {
+    case ::fst::ViterbiStatus::kSuccess:
+      return true;
+    case ::fst::ViterbiStatus::kNoPath:
+    case ::fst::ViterbiStatus::kInterrupted:
       return false;
+    case ::fst::ViterbiStatus::kUnsupported:
+      break;
+  }
+  static const ::fst::StringCompiler<Arc> compiler(
+      ::fst::TokenType::BYTE);
+  MutableTransducer str_fst;
+  if (!compiler(input, &str_fst)) return false;
+  return RewriteBytes(rule, str_fst, output, control);
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::RewriteBytes(
+    const PreparedRule<Arc>& rule, const Transducer& input,
+    std::string* output, const RewriteControl* control) const {
+  MutableTransducer output_fst;
+  if (!Rewrite(rule, input, &output_fst, control)) return false;
+  if (control && control->Interrupted()) return false;
+  StringifyFst(&output_fst);
+  if (output_fst.Start() == ::fst::kNoStateId) return false;
+  static const ::fst::StringPrinter<Arc> printer(
+      ::fst::TokenType::BYTE);
+  return printer(output_fst, output);
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::ParallelRewriteBytes(const std::string& rule,
+                                                   const std::string& input,
+                                                   std::string* output) const {
+  PreparedRule<Arc> prepared;
+  if (!InitPreparedRule(rule, "", "", /*shared=*/false, &prepared)) {
+    return false;
+  }
+  const auto min_chunk = static_cast<size_t>(
+      std::max<int64>(FST_FLAGS_parallel_rewrite_min_chunk, 1));
+  const auto threads =
+      static_cast<size_t>(std::max(FST_FLAGS_rewrite_threads, 0));
+  if (!prepared.flat || threads == 0 || input.size() < 2 * min_chunk) {
+    return RewriteBytes(prepared, input, output);
+  }
+  if (prepared.byte_alphabet) {
+    for (const unsigned char ch : input) {
+      if (ch != 0 && !prepared.byte_alphabet->test(ch)) return false;
     }
   }
-  std::unique_ptr<const Transducer> mpdt_assignments_fst;
-  if (!mpdt_assignments_rule.empty()) {
-    mpdt_assignments_fst = GetFstSafe(mpdt_assignments_rule);
-    if (!mpdt_assignments_fst) {
-      LOG(ERROR) << "MPDT assignments rule " << mpdt_assignments_rule
-                 << " not found.";
-      return false;
+  using Rewriter = ::fst::ChunkedDfaRewriter<Arc>;
+  // Everything the chunks share, held by a shared pointer since helper tasks
+  // may start after the calling thread has finished all the chunks.
+  struct FanOut {
+    std::string input;
+    std::unique_ptr<Rewriter> rewriter;
+    std::vector<typename Rewriter::Chunk> chunks;
+    std::vector<std::vector<typename Rewriter::Run>> runs;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining;
+  };
+  auto fan_out = std::make_shared<FanOut>();
+  fan_out->input = input;
+  fan_out->rewriter = std::make_unique<Rewriter>(*prepared.flat);
+  const auto* begin =
+      reinterpret_cast<const unsigned char*>(fan_out->input.data());
+  fan_out->chunks = fan_out->rewriter->Split(
+      begin, begin + input.size(),
+      std::min(threads + 1, input.size() / min_chunk));
+  const auto num_chunks = fan_out->chunks.size();
+  fan_out->runs.resize(num_chunks);
+  fan_out->remaining = num_chunks;
+  const auto work = [fan_out, begin] {
+    size_t done = 0;
+    for (auto i = fan_out->next.fetch_add(1); i < fan_out->chunks.size();
+         i = fan_out->next.fetch_add(1), ++done) {
+      fan_out->runs[i] =
+          fan_out->rewriter->RewriteChunk(fan_out->chunks[i], begin);
+    }
+    if (done == 0) return;
+    std::lock_guard<std::mutex> lock(fan_out->mutex);
+    fan_out->remaining -= done;
+    if (fan_out->remaining == 0) fan_out->finished.notify_all();
+  };
+  if (num_chunks > 1) {
+    auto* executor = GetExecutor();
+    for (size_t i = 0; i + 1 < num_chunks; ++i) {
+      if (!executor->TrySubmitHelper(work)) break;
     }
   }
-  if (pdt_parens_fst) {
-    MutableTransducer mut_pdt_parens_fst(*pdt_parens_fst);
-    std::vector<std::pair<Label, Label>> pdt_parens;
-    MakeParensPairVector(mut_pdt_parens_fst, &pdt_parens);
+  work();
+  {
+    std::unique_lock<std::mutex> lock(fan_out->mutex);
+    fan_out->finished.wait(lock,
+                           [&fan_out] { return fan_out->remaining == 0; });
+  }
+  output->clear();
+  if (fan_out->rewriter->Stitch(fan_out->runs, output)) return true;
+  output->clear();
+  return false;
+}
+
+template <typename Arc>
+std::unique_ptr<RewriteSession<Arc>>
+AbstractGrmManager<Arc>::StartRewriteSession(const std::string& rule) const {
+  if constexpr (::fst::IsPath<typename Arc::Weight>::value) {
+    auto prepared = PrepareRule(rule);
+    if (!prepared) return nullptr;
+    if (prepared->fst->Properties(::fst::kILabelSorted, true) !=
+        ::fst::kILabelSorted) {
+      LOG(ERROR) << "Rule is not sorted on input labels: " << rule;
+      return nullptr;
+    }
+    return std::make_unique<RewriteSession<Arc>>(std::move(prepared));
+  } else {
+    return nullptr;
+  }
+}
+
+template <typename Arc>
+std::unique_ptr<RewriteStream<Arc>> AbstractGrmManager<Arc>::StartRewriteStream(
+    const std::string& rule, size_t max_pending) const {
+  if constexpr (::fst::IsPath<typename Arc::Weight>::value) {
+    auto prepared = PrepareRule(rule);
+    if (!prepared) return nullptr;
+    if (prepared->fst->Properties(::fst::kILabelSorted, true) !=
+        ::fst::kILabelSorted) {
+      LOG(ERROR) << "Rule is not sorted on input labels: " << rule;
+      return nullptr;
+    }
+    return std::make_unique<RewriteStream<Arc>>(std::move(prepared),
+                                                max_pending);
+  } else {
+    return nullptr;
+  }
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::ProfileRewriteBytes(
+    const std::string& rule, const std::string& input, std::string* output,
+    RuleProfile* profile, const std::string& pdt_parens_rule,
+    const std::string& mpdt_assignments_rule) const {
+  PreparedRule<Arc> prepared;
+  if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                        /*shared=*/false, &prepared)) {
+    return false;
+  }
+  if (!prepared.pdt &&
+      !(prepared.trigger && PassesThrough(*prepared.trigger, input))) {
+    // Byte strings are compiled to labels 1 through 255.
+    std::vector<Label> labels(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+      labels[i] = static_cast<unsigned char>(input[i]);
+    }
+    ::fst::CompositionProfiler<Arc> profiler(*prepared.fst);
+    if (profiler(labels.begin(), labels.end())) {
+      const auto& state_visits = profiler.StateVisits();
+      for (size_t s = 0; s < state_visits.size(); ++s) {
+        if (state_visits[s] > 0) {
+          profile->AddStateVisits(rule, s, state_visits[s]);
+        }
+      }
+      const auto& arc_visits = profiler.ArcVisits();
+      for (size_t s = 0; s < arc_visits.size(); ++s) {
+        for (size_t a = 0; a < arc_visits[s].size(); ++a) {
+          if (arc_visits[s][a] > 0) {
+            profile->AddArcVisits(rule, s, a, arc_visits[s][a]);
+          }
+        }
+      }
+    }
+  }
+  return RewriteBytes(prepared, input, output);
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::Rewrite(const PreparedRule<Arc>& rule,
+                                      const Transducer& input,
+                                      MutableTransducer* output,
+                                      const RewriteControl* control) const {
+  // Composition with a PDT cannot be stopped midway, so the control is checked
+  // beforehand.
+  if (control && control->Interrupted()) return false;
+  if (rule.pdt) {
     // PdtComposeFilter::EXPAND removes the parentheses, allowing for subsequent
     // application of PDTs. At the end (in StringifyFst() we use ordinary
     // ShortestPath().
-    if (mpdt_assignments_fst) {
-      MutableTransducer mut_mpdt_assignments_fst(*mpdt_assignments_fst);
-      std::vector<Label> mpdt_assignments;
-      MakeAssignmentsVector(mut_mpdt_assignments_fst, pdt_parens,
-                            &mpdt_assignments);
+    if (rule.mpdt) {
       static const ::fst::MPdtComposeOptions opts(
           true, ::fst::PdtComposeFilter::EXPAND);
-      ::fst::Compose(input, *rule_fst, pdt_parens, mpdt_assignments, output,
-                         opts);
+      ::fst::Compose(input, *rule.fst, rule.pdt_parens, rule.mpdt_assignments,
+                     output, opts);
     } else {
       static const ::fst::PdtComposeOptions opts(
           true, ::fst::PdtComposeFilter::EXPAND);
-      ::fst::Compose(input, *rule_fst, pdt_parens, output, opts);
+      ::fst::Compose(input, *rule.fst, rule.pdt_parens, output, opts);
     }
-  } else {
+    return true;
+  }
+  // If the rule was exported with a trigger and the input cannot set it off,
+  // composition would just reproduce the input.
+  if (rule.trigger && PassesThrough(*rule.trigger, input)) {
+    *output = input;
+    return true;
+  }
+  // String inputs, such as those compiled by the functions above, take the
+  // specialized kernel, and anything else takes general composition.
+  static thread_local ::fst::LinearComposer<Arc> composer;
+  std::function<bool()> interrupted;
+  if (control) interrupted = [control] { return control->Interrupted(); };
+  if (composer(input, *rule.fst, output, control ? &interrupted : nullptr)) {
+    return !control || !control->Interrupted();
+  }
+  // With no input epsilons in the rule, there are no redundant epsilon paths
+  // for a filter to remove.
+  if (!control) {
     static const ::fst::ComposeOptions opts(true,
                                                 ::fst::ALT_SEQUENCE_FILTER);
-    ::fst::Compose(input, *rule_fst, output, opts);
+    static const ::fst::ComposeOptions trivial_opts(true,
+                                                    ::fst::TRIVIAL_FILTER);
+    ::fst::Compose(input, *rule.fst, output,
+                   rule.no_input_epsilons ? trivial_opts : opts);
+    return true;
   }
-  return true;
+  // Otherwise the composition is expanded one state at a time, as Compose()
+  // does, so that the control can stop it midway.
+  using Matcher = ::fst::Matcher<Transducer>;
+  bool completed;
+  if (rule.no_input_epsilons) {
+    ::fst::ComposeFstOptions<Arc, Matcher, ::fst::TrivialComposeFilter<Matcher>>
+        opts;
+    opts.gc_limit = 0;
+    completed = internal::CopyInterruptibly(
+        ::fst::ComposeFst<Arc>(input, *rule.fst, opts), output, interrupted);
+  } else {
+    ::fst::ComposeFstOptions<Arc, Matcher,
+                             ::fst::AltSequenceComposeFilter<Matcher>>
+        opts;
+    opts.gc_limit = 0;
+    completed = internal::CopyInterruptibly(
+        ::fst::ComposeFst<Arc>(input, *rule.fst, opts), output, interrupted);
+  }
+  if (!completed) return false;
+  ::fst::Connect(output);
+  return !control->Interrupted();
 }
 
+template <typename Arc>
+std::future<RewriteResult> AbstractGrmManager<Arc>::RewriteAsync(
+    const std::string& rule, std::string input,
+    std::shared_ptr<const RewriteControl> control,
+    const std::string& pdt_parens_rule,
+    const std::string& mpdt_assignments_rule) const {
+  auto promise = std::make_shared<std::promise<RewriteResult>>();
+  auto future = promise->get_future();
+  RewriteAsync(
+      rule, std::move(input), std::move(control),
+      [promise](RewriteResult result) {
+        promise->set_value(std::move(result));
+      },
+      pdt_parens_rule, mpdt_assignments_rule);
+  return future;
+}
+
+template <typename Arc>
+void AbstractGrmManager<Arc>::RewriteAsync(
+    const std::string& rule, std::string input,
+    std::shared_ptr<const RewriteControl> control,
+    std::function<void(RewriteResult)> done,
+    const std::string& pdt_parens_rule,
+    const std::string& mpdt_assignments_rule) const {
+  // The task holds its own copy of done, so it is still ours to call if the
+  // executor rejects the task.
+  const bool submitted = GetExecutor()->TrySubmit(
+      [this, rule, input = std::move(input), control, done, pdt_parens_rule,
+       mpdt_assignments_rule] {
+        RewriteResult result;
+        result.status = control ? control->Check() : RewriteStatus::kOk;
+        if (result.status != RewriteStatus::kOk) {
+          done(std::move(result));
+          return;
+        }
+        PreparedRule<Arc> prepared;
+        if (!InitPreparedRule(rule, pdt_parens_rule, mpdt_assignments_rule,
+                              /*shared=*/false, &prepared) ||
+            !RewriteBytes(prepared, input, &result.output, control.get())) {
+          result.output.clear();
+          result.status = control ? control->Check() : RewriteStatus::kOk;
+          if (result.status == RewriteStatus::kOk) {
+            result.status = RewriteStatus::kFailed;
+          }
+        }
+        done(std::move(result));
+      });
+  if (!submitted) {
+    RewriteResult result;
+    result.status = RewriteStatus::kRejected;
+    done(std::move(result));
+  }
+}
+
+
+template <typename Arc>
+std::vector<RewriteResult> AbstractGrmManager<Arc>::RewriteMany(
+    const std::string& input, const std::vector<std::string>& rules,
+    bool parallel) const {
+  // Everything the rules share, held by a shared pointer since helper tasks
+  // may start after the calling thread has finished all the rules.
+  struct FanOut {
+    std::string input;
+    MutableTransducer input_fst;
+    std::vector<PreparedRule<Arc>> rules;
+    std::vector<bool> found;
+    std::vector<RewriteResult> results;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining;
+  };
+  auto fan_out = std::make_shared<FanOut>();
+  fan_out->input = input;
+  fan_out->rules.resize(rules.size());
+  fan_out->found.resize(rules.size());
+  fan_out->results.resize(rules.size());
+  fan_out->remaining = rules.size();
+  bool needs_input_fst = false;
+  for (size_t i = 0; i < rules.size(); ++i) {
+    auto& rule = fan_out->rules[i];
+    fan_out->found[i] = InitPreparedRule(rules[i], "", "", /*shared=*/false,
+                                         &rule);
+    if (fan_out->found[i] && !rule.flat) needs_input_fst = true;
+  }
+  // Rules without a flat form might need to compose, so the input is compiled
+  // up front, once, rather than by whichever rule first needs it.
+  if (needs_input_fst) {
+    static const ::fst::StringCompiler<Arc> compiler(
+        ::fst::TokenType::BYTE);
+    if (!compiler(input, &fan_out->input_fst)) {
+      return std::vector<RewriteResult>(rules.size());
+    }
+  }
+  const auto work = [this, fan_out] {
+    size_t done = 0;
+    for (auto i = fan_out->next.fetch_add(1); i < fan_out->rules.size();
+         i = fan_out->next.fetch_add(1), ++done) {
+      const auto& rule = fan_out->rules[i];
+      auto& result = fan_out->results[i];
+      bool success = false;
+      if (fan_out->found[i]) {
+        switch (FastRewriteBytes(rule, fan_out->input, &result.output,
+                                 nullptr)) {
+          case ::fst::ViterbiStatus::kSuccess:
+            success = true;
+            break;
+          case ::fst::ViterbiStatus::kNoPath:
+          case ::fst::ViterbiStatus::kInterrupted:
+            break;
+          case ::fst::ViterbiStatus::kUnsupported:
+            success = RewriteBytes(rule, fan_out->input_fst, &result.output);
+            break;
+        }
+      }
+      if (success) {
+        result.status = RewriteStatus::kOk;
+      } else {
+        result.output.clear();
+      }
+    }
+    if (done == 0) return;
+    std::lock_guard<std::mutex> lock(fan_out->mutex);
+    fan_out->remaining -= done;
+    if (fan_out->remaining == 0) fan_out->finished.notify_all();
+  };
+  if (parallel && rules.size() > 1) {
+    auto* executor = GetExecutor();
+    const auto helpers =
+        std::min<size_t>(rules.size() - 1, executor->NumThreads());
+    for (size_t i = 0; i < helpers; ++i) {
+      if (!executor->TrySubmitHelper(work)) break;
+    }
+  }
+  work();
+  std::unique_lock<std::mutex> lock(fan_out->mutex);
+  fan_out->finished.wait(lock, [&fan_out] { return fan_out->remaining == 0; });
+  return std::move(fan_out->results);
+}
+
+template <typename Arc>
+std::unique_ptr<const ::fst::LongestMatchSegmenter<Arc>>
+AbstractGrmManager<Arc>::PrepareSegmenter(const std::string& rule,
+                                          ::fst::UnmatchedPolicy policy,
+                                          Label separator) const {
+  auto segmenter =
+      std::make_unique<::fst::LongestMatchSegmenter<Arc>>(policy, separator);
+  if (const auto* flat_rule = GetFlatRule(rule)) {
+    segmenter->Init(*flat_rule);
+    return segmenter;
+  }
+  const auto rule_fst = GetFstSafe(rule);
+  if (!rule_fst) {
+    LOG(ERROR) << "Rule " << rule << " not found.";
+    return nullptr;
+  }
+  if (!segmenter->Init(*rule_fst, FST_FLAGS_sequentialize_max_states)) {
+    LOG(ERROR) << "Rule " << rule << " cannot be made input-deterministic";
+    return nullptr;
+  }
+  return segmenter;
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::SegmentBytes(const std::string& rule,
+                                           const std::string& input,
+                                           std::string* output,
+                                           ::fst::UnmatchedPolicy policy,
+                                           Label separator) const {
+  const auto segmenter = PrepareSegmenter(rule, policy, separator);
+  if (!segmenter) return false;
+  output->clear();
+  const auto* begin = reinterpret_cast<const unsigned char*>(input.data());
+  return (*segmenter)(begin, begin + input.size(), output);
+}
+
+template <typename Arc>
+::fst::ViterbiStatus AbstractGrmManager<Arc>::FastRewriteBytes(
+    const PreparedRule<Arc>& rule, const std::string& input,
+    std::string* output, const RewriteControl* control) {
+  // Sequential rules are applied directly to the bytes, and other rules
+  // without parentheses by the Viterbi kernel where possible.
+  if (rule.pdt) return ::fst::ViterbiStatus::kUnsupported;
+  if (rule.byte_alphabet) {
+    // NUL bytes compile to epsilons, which every rule accepts.
+    for (const unsigned char byte : input) {
+      if (byte != 0 && !(*rule.byte_alphabet)[byte]) {
+        return ::fst::ViterbiStatus::kNoPath;
+      }
+    }
+  }
+  if (rule.flat) {
+    return rule.flat->RewriteBytes(input, output)
+               ? ::fst::ViterbiStatus::kSuccess
+               : ::fst::ViterbiStatus::kNoPath;
+  }
+  return ViterbiRewriteBytes(rule, input, output, control);
+}
+
+template <typename Arc>
+RewriteExecutor* AbstractGrmManager<Arc>::GetExecutor() const {
+  std::call_once(executor_once_, [this] {
+    executor_ = std::make_unique<RewriteExecutor>(
+        FST_FLAGS_rewrite_threads, FST_FLAGS_rewrite_queue_depth);
+  });
+  return executor_.get();
+}
 
 template <typename Arc>
 void AbstractGrmManager<Arc>::StringifyFst(MutableTransducer* fst) {
@@ -321,6 +1880,75 @@ void AbstractGrmManager<Arc>::StringifyFst(MutableTransducer* fst) {
   *fst = temp;
 }
 
+template <typename Arc>
+bool AbstractGrmManager<Arc>::PassesThrough(const Transducer& trigger,
+                                            const std::string& input) {
+  auto state = trigger.Start();
+  if (state == ::fst::kNoStateId) return false;
+  ::fst::SortedMatcher<Transducer> matcher(&trigger, ::fst::MATCH_INPUT);
+  for (const unsigned char ch : input) {
+    if (trigger.Final(state) != Arc::Weight::Zero()) return false;
+    // A NUL byte compiles to an epsilon, which the rewrite drops from the
+    // output, so the input cannot be passed through as it is.
+    if (ch == 0) return false;
+    matcher.SetState(state);
+    if (!matcher.Find(ch)) return false;
+    state = matcher.Value().nextstate;
+  }
+  return trigger.Final(state) == Arc::Weight::Zero();
+}
+
+template <typename Arc>
+::fst::ViterbiStatus AbstractGrmManager<Arc>::ViterbiRewriteBytes(
+    const PreparedRule<Arc>& rule, const std::string& input,
+    std::string* output, const RewriteControl* control) {
+  if constexpr (::fst::IsPath<typename Arc::Weight>::value) {
+    if (rule.pdt) return ::fst::ViterbiStatus::kUnsupported;
+    if (rule.trigger && PassesThrough(*rule.trigger, input)) {
+      *output = input;
+      return ::fst::ViterbiStatus::kSuccess;
+    }
+    // Among several best paths, the kernel may choose another than
+    // ShortestPath() does, so it is only used when asked for.
+    if (!FST_FLAGS_viterbi_rewrites) return ::fst::ViterbiStatus::kUnsupported;
+    // The rewriter is the only mutable state, so each thread has its own.
+    static thread_local ::fst::ViterbiRewriter<Arc> rewriter;
+    output->clear();
+    const auto* begin = reinterpret_cast<const unsigned char*>(input.data());
+    std::function<bool()> interrupted;
+    if (control) interrupted = [control] { return control->Interrupted(); };
+    return rewriter(*rule.fst, begin, begin + input.size(), output,
+                    control ? &interrupted : nullptr);
+  } else {
+    return ::fst::ViterbiStatus::kUnsupported;
+  }
+}
+
+template <typename Arc>
+bool AbstractGrmManager<Arc>::PassesThrough(const Transducer& trigger,
+                                            const Transducer& input) {
+  if (input.Start() == ::fst::kNoStateId ||
+      input.Properties(::fst::kString, true) != ::fst::kString) {
+    return false;
+  }
+  auto state = trigger.Start();
+  if (state == ::fst::kNoStateId) return false;
+  ::fst::SortedMatcher<Transducer> matcher(&trigger, ::fst::MATCH_INPUT);
+  for (auto s = input.Start();;) {
+    if (trigger.Final(state) != Arc::Weight::Zero()) return false;
+    ::fst::ArcIterator<Transducer> aiter(input, s);
+    if (aiter.Done()) return true;
+    const auto& arc = aiter.Value();
+    if (arc.olabel != 0) {
+      matcher.SetState(state);
+      // Symbols outside the alphabet of the rule are rejected by it.
+      if (!matcher.Find(arc.olabel)) return false;
+      state = matcher.Value().nextstate;
+    }
+    s = arc.nextstate;
+  }
+}
+
 // Triple of main rule, pdt_parens and mpdt assignments
 
 struct RuleTriple {
@@ -345,7 +1973,8 @@ struct RuleTriple {
   }
 };
 
-// Does not own the grm pointer.
+// Does not own the grm pointer. The rules are prepared once at initialization,
+// so a cascade may be shared by several threads.
 template <typename Arc>
 class RuleCascade {
   using Transducer = ::fst::Fst<Arc>;
@@ -371,10 +2000,11 @@ class RuleCascade {
   bool Rewrite(const Transducer& input, MutableTransducer* output) const;
 
  private:
-  // Validates all rules.
+  // Validates and prepares all rules.
   bool ValidateRules();
   const AbstractGrmManager<Arc>* grm_;
   std::vector<RuleTriple> rule_triples_;
+  std::vector<std::unique_ptr<const PreparedRule<Arc>>> rules_;
 };
 
 template <typename Arc>
@@ -395,6 +2025,14 @@ bool RuleCascade<Arc>::ValidateRules() {
       return false;
     }
   }
+  rules_.clear();
+  for (const auto& rule_triple : rule_triples_) {
+    auto rule = grm_->PrepareRule(rule_triple.main_rule,
+                                  rule_triple.pdt_parens_rule,
+                                  rule_triple.mpdt_assignments_rule);
+    if (!rule) return false;
+    rules_.push_back(std::move(rule));
+  }
   return true;
 }
 
@@ -417,6 +2055,43 @@ bool RuleCascade<Arc>::InitFromDefs(const AbstractGrmManager<Arc>* grm,
 template <typename Arc>
 bool RuleCascade<Arc>::RewriteBytes(const std::string& input,
                                     std::string* output) const {
+  // The best path through the cascade can be found one rule at a time as long
+  // as every rule but the last has a unique output: sequential rules, and
+  // rules whose trigger the intermediate string cannot set off. Otherwise, a
+  // later rule might reject the best output of an earlier one.
+  bool fast = !rules_.empty();
+  std::string tmp_input = input;
+  for (size_t i = 0; fast && i < rules_.size(); ++i) {
+    const auto& rule = *rules_[i];
+    if (rule.pdt) {
+      fast = false;
+    } else if (rule.flat) {
+      if (!rule.flat->RewriteBytes(tmp_input, output)) return false;
+    } else if (rule.trigger &&
+               AbstractGrmManager<Arc>::PassesThrough(*rule.trigger,
+                                                      tmp_input)) {
+      *output = tmp_input;
+    } else if (i + 1 == rules_.size()) {
+      switch (AbstractGrmManager<Arc>::ViterbiRewriteBytes(rule, tmp_input,
+                                                           output)) {
+        case ::fst::ViterbiStatus::kSuccess:
+          break;
+        case ::fst::ViterbiStatus::kNoPath:
+        case ::fst::ViterbiStatus::kInterrupted:
+          return false;
+        case ::fst::ViterbiStatus::kUnsupported:
+          fast = false;
+          break;
+      }
+    } else {
+      fast = false;
+    }
+    if (fast) tmp_input.swap(*output);
+  }
+  if (fast) {
+    output->swap(tmp_input);
+    return true;
+  }
   static const ::fst::StringCompiler<Arc> compiler(
       ::fst::TokenType::BYTE);
   MutableTransducer input_fst;
@@ -456,12 +2131,8 @@ template <typename Arc>
 bool RuleCascade<Arc>::Rewrite(const Transducer& input,
                                MutableTransducer* output) const {
   MutableTransducer tmp_input(input);
-  for (auto& rule_triple : rule_triples_) {
-    if (!grm_->Rewrite(rule_triple.main_rule, tmp_input, output,
-                       rule_triple.pdt_parens_rule,
-                       rule_triple.mpdt_assignments_rule)) {
-      return false;
-    }
+  for (const auto& rule : rules_) {
+    if (!grm_->Rewrite(*rule, tmp_input, output)) return false;
     tmp_input = *output;
   }
   return true;
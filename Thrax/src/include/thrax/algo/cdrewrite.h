@@ -917,6 +917,35 @@ void CDRewriteCompile(const Fst<Arc> &tau, const Fst<Arc> &lambda,
                    initial_boundary_marker, final_boundary_marker);
 }
 
+// Builds the trigger for the rule compiled from tau over sigma: an unweighted,
+// deterministic and minimal acceptor for sigma phi sigma, where phi is the
+// input projection of tau and sigma is the closure of the alphabet. A string
+// over the alphabet which is not accepted by the trigger contains no match of
+// phi, so the rule maps it to itself with weight One, regardless of the
+// contexts, direction or mode; the contexts are deliberately ignored, so the
+// trigger may overapproximate the strings which the rule actually changes.
+// Strings containing symbols outside the alphabet have no path through the
+// trigger and must not be treated as untriggered.
+template <class Arc>
+void CDRewriteTrigger(const Fst<Arc> &tau, const Fst<Arc> &sigma,
+                      MutableFst<Arc> *trigger) {
+  VectorFst<Arc> phi(tau);
+  Project(&phi, ProjectType::INPUT);
+  phi.SetInputSymbols(nullptr);
+  phi.SetOutputSymbols(nullptr);
+  VectorFst<Arc> closure(sigma);
+  closure.SetInputSymbols(nullptr);
+  closure.SetOutputSymbols(nullptr);
+  VectorFst<Arc> pattern(closure);
+  Concat(&pattern, phi);
+  Concat(&pattern, closure);
+  ArcMap(&pattern, RmWeightMapper<Arc>());
+  RmEpsilon(&pattern);
+  Determinize(pattern, trigger);
+  Minimize(trigger);
+  ArcSort(trigger, ILabelCompare<Arc>());
+}
+
 }  // namespace fst
 
 #endif  // FST_UTIL_OPERATORS_CDREWRITE_H_
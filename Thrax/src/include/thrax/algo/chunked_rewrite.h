@@ -0,0 +1,234 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_CHUNKED_REWRITE_H_
+#define FST_UTIL_OPERATORS_CHUNKED_REWRITE_H_
+
+// Applies a flat DFA to a long input in independent chunks, so that the chunks
+// can be rewritten on several threads at once.
+//
+// The state in which the DFA enters a chunk is only known once the chunks
+// before it have been rewritten, so each chunk is rewritten speculatively from
+// every state the DFA could be in at its start, and the runs are then stitched
+// together by matching the state at the end of each chunk to the start of a
+// run of the next. The candidate states come from a synchronizing analysis: the
+// states the DFA can reach from any state at all on the few labels just before
+// the chunk boundary. For most rewrite rules a handful of labels of context
+// narrows these down to one or two states, and boundaries which are not
+// narrowed down enough are moved or dropped. As the DFA is deterministic, the
+// stitched output is the one the DFA produces on the whole input.
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <fst/types.h>
+#include <thrax/algo/flat_dfa.h>
+
+namespace fst {
+
+// This class is thread-compatible; a const instance may be shared by the
+// threads rewriting the chunks.
+template <class A>
+class ChunkedDfaRewriter {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using Weight = typename Arc::Weight;
+  using Dfa = FlatDfa<Arc>;
+
+  static constexpr uint32 kNoState = Dfa::kNoState;
+
+  // A part [begin, end) of the input, by position, with the states the DFA may
+  // be in at its start.
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    std::vector<uint32> candidates;
+  };
+
+  // The result of rewriting a chunk from one candidate state.
+  struct Run {
+    uint32 start;
+    uint32 end;  // kNoState if the chunk is rejected from the start state.
+    std::vector<Label> output;
+    Weight weight;
+  };
+
+  // The DFA must outlive the rewriter. A boundary is considered after
+  // lookbehind labels of context, and is kept if that leaves at most
+  // max_candidates states. Construction takes time linear in the number of
+  // arcs of the DFA.
+  explicit ChunkedDfaRewriter(const Dfa &dfa, size_t lookbehind = 16,
+                              size_t max_candidates = 4);
+
+  // Splits the label string [begin, end) into at most num_chunks chunks of
+  // roughly equal size.
+  template <class Iterator>
+  std::vector<Chunk> Split(Iterator begin, Iterator end,
+                           size_t num_chunks) const;
+
+  // Rewrites the chunk of the label string starting at input from each of its
+  // candidate states.
+  template <class Iterator>
+  std::vector<Run> RewriteChunk(const Chunk &chunk, Iterator input) const;
+
+  // Stitches together the runs of the chunks, in input order, appending the
+  // output to any sink supporting push_back(Label). Returns false if the DFA
+  // rejects the input.
+  template <class Sink>
+  bool Stitch(const std::vector<std::vector<Run>> &runs, Sink *output,
+              Weight *weight = nullptr) const;
+
+ private:
+  // Returns the states the DFA can be in at position pos of the input, which
+  // are those it reaches from any state on the lookbehind labels before it.
+  template <class Iterator>
+  std::vector<uint32> Candidates(Iterator begin, size_t pos) const;
+
+  const Dfa &dfa_;
+  const size_t lookbehind_;
+  const size_t max_candidates_;
+  // For each input label, the distinct states reached on it from any state.
+  std::unordered_map<Label, std::vector<uint32>> images_;
+};
+
+template <class Arc>
+ChunkedDfaRewriter<Arc>::ChunkedDfaRewriter(const Dfa &dfa, size_t lookbehind,
+                                            size_t max_candidates)
+    : dfa_(dfa),
+      lookbehind_(std::max<size_t>(lookbehind, 1)),
+      max_candidates_(std::max<size_t>(max_candidates, 1)) {
+  for (uint32 s = 0; s < dfa_.NumStates(); ++s) {
+    for (const auto *arc = dfa_.ArcsBegin(s); arc != dfa_.ArcsEnd(s); ++arc) {
+      images_[arc->ilabel].push_back(arc->nextstate);
+    }
+  }
+  for (auto &[label, states] : images_) {
+    std::sort(states.begin(), states.end());
+    states.erase(std::unique(states.begin(), states.end()), states.end());
+  }
+}
+
+template <class Arc>
+template <class Iterator>
+std::vector<uint32> ChunkedDfaRewriter<Arc>::Candidates(Iterator begin,
+                                                        size_t pos) const {
+  const auto context = std::min(lookbehind_, pos);
+  // Label 0 is epsilon, which leaves the DFA where it is (NUL bytes compile
+  // to it), so the analysis starts from the first other label.
+  auto i = pos - context;
+  while (i < pos && *(begin + i) == 0) ++i;
+  std::vector<uint32> states;
+  if (i == pos) {
+    // Without context, the DFA may be in any state.
+    states.resize(dfa_.NumStates());
+    for (uint32 s = 0; s < dfa_.NumStates(); ++s) states[s] = s;
+    return states;
+  }
+  const auto it = images_.find(*(begin + i));
+  if (it == images_.end()) return {};
+  states = it->second;
+  std::vector<uint32> next_states;
+  for (++i; i < pos; ++i) {
+    const Label label = *(begin + i);
+    if (label == 0) continue;
+    next_states.clear();
+    for (const auto s : states) {
+      if (const auto *arc = dfa_.Find(s, label)) {
+        next_states.push_back(arc->nextstate);
+      }
+    }
+    std::sort(next_states.begin(), next_states.end());
+    next_states.erase(std::unique(next_states.begin(), next_states.end()),
+                      next_states.end());
+    states.swap(next_states);
+    if (states.empty()) break;
+  }
+  return states;
+}
+
+template <class Arc>
+template <class Iterator>
+std::vector<typename ChunkedDfaRewriter<Arc>::Chunk>
+ChunkedDfaRewriter<Arc>::Split(Iterator begin, Iterator end,
+                               size_t num_chunks) const {
+  const size_t size = end - begin;
+  num_chunks = std::max<size_t>(std::min(num_chunks, size), 1);
+  std::vector<Chunk> chunks;
+  chunks.push_back({0, size, {dfa_.Start()}});
+  const auto step = size / num_chunks;
+  for (size_t i = 1; i < num_chunks; ++i) {
+    // Tries the boundaries from the ideal one on, up to the lookbehind
+    // further, for one which leaves few enough candidates.
+    const auto ideal = i * step;
+    for (auto pos = std::max(ideal, chunks.back().begin + 1);
+         pos < std::min(ideal + lookbehind_, size); ++pos) {
+      auto candidates = Candidates(begin, pos);
+      if (candidates.size() > max_candidates_) continue;
+      chunks.back().end = pos;
+      chunks.push_back({pos, size, std::move(candidates)});
+      break;
+    }
+  }
+  return chunks;
+}
+
+template <class Arc>
+template <class Iterator>
+std::vector<typename ChunkedDfaRewriter<Arc>::Run>
+ChunkedDfaRewriter<Arc>::RewriteChunk(const Chunk &chunk,
+                                      Iterator input) const {
+  std::vector<Run> runs;
+  for (const auto start : chunk.candidates) {
+    if (start == kNoState) continue;
+    runs.push_back({start, start, {}, Weight::One()});
+    auto &run = runs.back();
+    for (auto pos = chunk.begin; pos < chunk.end && run.end != kNoState;
+         ++pos) {
+      const Label label = *(input + pos);
+      if (label == 0) continue;
+      run.end = dfa_.Step(run.end, label, &run.output, &run.weight);
+    }
+  }
+  return runs;
+}
+
+template <class Arc>
+template <class Sink>
+bool ChunkedDfaRewriter<Arc>::Stitch(const std::vector<std::vector<Run>> &runs,
+                                     Sink *output, Weight *weight) const {
+  auto s = dfa_.Start();
+  if (s == kNoState) return false;
+  auto total = Weight::One();
+  for (const auto &chunk_runs : runs) {
+    const auto it = std::find_if(
+        chunk_runs.begin(), chunk_runs.end(),
+        [s](const Run &run) { return run.start == s; });
+    // The analysis never misses the state the DFA is in, so a missing run
+    // means that the DFA rejected the input before the chunk.
+    if (it == chunk_runs.end() || it->end == kNoState) return false;
+    for (const auto label : it->output) output->push_back(label);
+    total = Times(total, it->weight);
+    s = it->end;
+  }
+  if (!dfa_.Finish(s, output, &total)) return false;
+  if (weight) *weight = total;
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_CHUNKED_REWRITE_H_
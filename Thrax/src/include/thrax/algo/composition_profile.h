@@ -0,0 +1,157 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_COMPOSITION_PROFILE_H_
+#define FST_UTIL_OPERATORS_COMPOSITION_PROFILE_H_
+
+// Counts the states and arcs of a rule which composition with strings visits.
+//
+// The profiler explores the composition of each string with the rule the way
+// LinearComposer builds it: position by position, following the epsilon arcs
+// of the rule within a position and the arcs matching the next label of the
+// string to the next position. A state is counted once for each position at
+// which it is reached and an arc each time it is followed, dead ends
+// included, since composition pays for those too. Arcs are identified by
+// their position among the arcs leaving their state.
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fst.h>
+#include <fst/properties.h>
+
+namespace fst {
+
+// An instance accumulates counts over any number of strings; it is not
+// thread-safe.
+template <class A>
+class CompositionProfiler {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+
+  // The rule must outlive the profiler.
+  explicit CompositionProfiler(const Fst<Arc> &rule)
+      : rule_(rule), stamp_(0) {}
+
+  // Counts the visits made in composing the label string [begin, end) with
+  // the rule. Returns false, counting nothing, if the rule is not known to be
+  // sorted on input labels.
+  template <class Iterator>
+  bool operator()(Iterator begin, Iterator end);
+
+  // Visits by state; states past the end were never visited.
+  const std::vector<uint64> &StateVisits() const { return state_visits_; }
+
+  // Visits by state and arc position; either index may be past the end of
+  // the vectors if the arc was never followed.
+  const std::vector<std::vector<uint64>> &ArcVisits() const {
+    return arc_visits_;
+  }
+
+ private:
+  // Counts a visit to q at the position with the given stamp, queuing it for
+  // expansion if it is the first.
+  void Visit(uint64 stamp, StateId q, std::vector<StateId> *queue);
+
+  void CountArc(StateId q, size_t position);
+
+  const Fst<Arc> &rule_;
+  std::vector<uint64> state_visits_;
+  std::vector<std::vector<uint64>> arc_visits_;
+  // The stamp of the last position at which each state was reached, which
+  // avoids clearing a table between positions.
+  std::vector<uint64> stamps_;
+  std::vector<StateId> queue_[2];
+  uint64 stamp_;
+};
+
+template <class Arc>
+template <class Iterator>
+bool CompositionProfiler<Arc>::operator()(Iterator begin, Iterator end) {
+  if (rule_.Properties(kILabelSorted, false) != kILabelSorted) return false;
+  const auto start = rule_.Start();
+  if (start == kNoStateId) return true;
+  auto *queue = &queue_[0];
+  auto *next_queue = &queue_[1];
+  queue->clear();
+  Visit(++stamp_, start, queue);
+  for (auto it = begin;; ++it) {
+    const bool at_end = it == end;
+    const auto next_stamp = ++stamp_;
+    next_queue->clear();
+    // Epsilon moves may queue further states at this position.
+    for (size_t k = 0; k < queue->size(); ++k) {
+      const auto q = (*queue)[k];
+      ArcIterator<Fst<Arc>> aiter(rule_, q);
+      // Epsilons sort first.
+      for (; !aiter.Done() && aiter.Value().ilabel == 0; aiter.Next()) {
+        CountArc(q, aiter.Position());
+        Visit(next_stamp - 1, aiter.Value().nextstate, queue);
+      }
+      if (at_end) continue;
+      const Label label = *it;
+      // Binary search for the first arc with the label.
+      size_t low = aiter.Position();
+      size_t high = rule_.NumArcs(q);
+      while (low < high) {
+        const auto mid = low + (high - low) / 2;
+        aiter.Seek(mid);
+        if (aiter.Value().ilabel < label) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      for (aiter.Seek(low); !aiter.Done() && aiter.Value().ilabel == label;
+           aiter.Next()) {
+        CountArc(q, aiter.Position());
+        Visit(next_stamp, aiter.Value().nextstate, next_queue);
+      }
+    }
+    if (at_end) break;
+    std::swap(queue, next_queue);
+  }
+  return true;
+}
+
+template <class Arc>
+void CompositionProfiler<Arc>::Visit(uint64 stamp, StateId q,
+                                     std::vector<StateId> *queue) {
+  if (q >= static_cast<StateId>(stamps_.size())) {
+    stamps_.resize(q + 1, 0);
+    state_visits_.resize(q + 1, 0);
+  }
+  if (stamps_[q] == stamp) return;
+  stamps_[q] = stamp;
+  ++state_visits_[q];
+  queue->push_back(q);
+}
+
+template <class Arc>
+void CompositionProfiler<Arc>::CountArc(StateId q, size_t position) {
+  if (q >= static_cast<StateId>(arc_visits_.size())) {
+    arc_visits_.resize(q + 1);
+  }
+  auto &visits = arc_visits_[q];
+  if (position >= visits.size()) visits.resize(position + 1, 0);
+  ++visits[position];
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_COMPOSITION_PROFILE_H_
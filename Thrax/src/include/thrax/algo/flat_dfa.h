@@ -0,0 +1,501 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_FLAT_DFA_H_
+#define FST_UTIL_OPERATORS_FLAT_DFA_H_
+
+// A flat, table-driven representation of input-deterministic transducers.
+//
+// States are numbered in breadth-first order from the start state and stored
+// contiguously. The arcs leaving each state are stored, sorted by input label,
+// in a single array shared by all states and addressed with 32-bit offsets.
+// Single-label outputs are stored inline in the arc, while longer output
+// strings live in a separate label pool.
+//
+// Determinizing a functional transducer leaves its final output strings on a
+// chain of input-epsilon arcs leading to a final state. Such chains are folded
+// into the state at which they begin, so the machine can be applied by a single
+// loop over the input with no epsilon handling. Any other input-epsilon arc, or
+// two arcs leaving the same state with the same input label, makes the input
+// FST unsuitable for this representation.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/fst.h>
+#include <fst/util.h>
+
+namespace fst {
+
+constexpr int32 kFlatDfaMagicNumber = 0x46444641;  // "FDFA".
+constexpr int32 kFlatDfaFileVersion = 1;
+
+// This class is thread-compatible; a const FlatDfa may be shared by many
+// threads.
+template <class A>
+class FlatDfa {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  static constexpr uint32 kNoState = std::numeric_limits<uint32>::max();
+
+  // States with no more than this many arcs are searched linearly.
+  static constexpr uint32 kLinearSearchArcs = 8;
+
+  // If the output size is 1, `output` holds the output label itself; if it is
+  // greater than 1, it holds the offset of the output string in the pool.
+  struct FlatArc {
+    Label ilabel;
+    uint32 nextstate;
+    uint32 output;
+    uint32 output_size;
+    Weight weight;
+  };
+
+  struct FlatState {
+    uint32 arc_offset;
+    uint32 num_arcs;
+    uint32 final_output;
+    uint32 final_output_size;
+    Weight final_weight;
+  };
+
+  FlatDfa() : start_(kNoState) {}
+
+  // Builds the flat representation of an FST. Returns false, leaving this
+  // object empty, if the FST is not input-deterministic in the sense above.
+  bool Init(const Fst<Arc> &fst);
+
+  void Clear() {
+    start_ = kNoState;
+    states_.clear();
+    arcs_.clear();
+    pool_.clear();
+  }
+
+  uint32 Start() const { return start_; }
+
+  uint32 NumStates() const { return states_.size(); }
+
+  size_t NumArcs() const { return arcs_.size(); }
+
+  const FlatState &GetState(uint32 s) const { return states_[s]; }
+
+  // Returns a pointer to the arc leaving `s` with input label `label`, or
+  // nullptr if there is none.
+  const FlatArc *Find(uint32 s, Label label) const {
+    const auto &state = states_[s];
+    const auto *begin = arcs_.data() + state.arc_offset;
+    const auto *end = begin + state.num_arcs;
+    if (state.num_arcs <= kLinearSearchArcs) {
+      for (const auto *it = begin; it != end; ++it) {
+        if (it->ilabel >= label) return it->ilabel == label ? it : nullptr;
+      }
+      return nullptr;
+    }
+    const auto *it = std::lower_bound(
+        begin, end, label,
+        [](const FlatArc &arc, Label label) { return arc.ilabel < label; });
+    return it != end && it->ilabel == label ? it : nullptr;
+  }
+
+  // Returns the arcs leaving `s`, in input label order.
+  const FlatArc *ArcsBegin(uint32 s) const {
+    return arcs_.data() + states_[s].arc_offset;
+  }
+
+  const FlatArc *ArcsEnd(uint32 s) const {
+    return ArcsBegin(s) + states_[s].num_arcs;
+  }
+
+  // Appends an output string to any sink supporting push_back(Label), such as
+  // std::vector<Label> or, for byte output, std::string.
+  template <class Sink>
+  void AppendOutput(uint32 output, uint32 output_size, Sink *sink) const {
+    if (output_size == 1) {
+      sink->push_back(static_cast<Label>(output));
+    } else {
+      for (uint32 i = 0; i < output_size; ++i) {
+        sink->push_back(pool_[output + i]);
+      }
+    }
+  }
+
+  // Advances from `s` on `label`, appending the output to `sink` and
+  // accumulating the arc weight. Returns kNoState if there is no transition.
+  template <class Sink>
+  uint32 Step(uint32 s, Label label, Sink *sink, Weight *weight) const {
+    const auto *arc = Find(s, label);
+    if (!arc) return kNoState;
+    AppendOutput(arc->output, arc->output_size, sink);
+    *weight = Times(*weight, arc->weight);
+    return arc->nextstate;
+  }
+
+  // Appends the final output of `s` and accumulates its final weight. Returns
+  // false if `s` is not final.
+  template <class Sink>
+  bool Finish(uint32 s, Sink *sink, Weight *weight) const {
+    const auto &state = states_[s];
+    if (state.final_weight == Weight::Zero()) return false;
+    AppendOutput(state.final_output, state.final_output_size, sink);
+    *weight = Times(*weight, state.final_weight);
+    return true;
+  }
+
+  // Applies the machine to a sequence of input labels, appending the output
+  // labels to `sink`. Returns false if the input is rejected, in which case
+  // the contents of `sink` are unspecified.
+  template <class Iterator, class Sink>
+  bool Apply(Iterator begin, Iterator end, Sink *sink,
+             Weight *weight = nullptr) const {
+    if (start_ == kNoState) return false;
+    auto total = Weight::One();
+    auto s = start_;
+    for (; begin != end; ++begin) {
+      s = Step(s, *begin, sink, &total);
+      if (s == kNoState) return false;
+    }
+    if (!Finish(s, sink, &total)) return false;
+    if (weight) *weight = total;
+    return true;
+  }
+
+  // Applies the machine to a byte string, as the composition of the rule with
+  // a byte string FST followed by printing the output as bytes would. A NUL
+  // byte compiles to an epsilon, which composition passes over, so it is
+  // skipped here too.
+  bool RewriteBytes(const std::string &input, std::string *output,
+                    Weight *weight = nullptr) const {
+    output->clear();
+    if (start_ == kNoState) return false;
+    auto total = Weight::One();
+    auto s = start_;
+    for (const unsigned char ch : input) {
+      if (ch == 0) continue;
+      s = Step(s, ch, output, &total);
+      if (s == kNoState) return false;
+    }
+    if (!Finish(s, output, &total)) return false;
+    if (weight) *weight = total;
+    return true;
+  }
+
+  // Approximate heap footprint of the tables, in bytes.
+  size_t SizeInBytes() const {
+    return sizeof(*this) + states_.capacity() * sizeof(FlatState) +
+           arcs_.capacity() * sizeof(FlatArc) +
+           pool_.capacity() * sizeof(Label);
+  }
+
+  bool Write(std::ostream &strm, const std::string &source) const;
+
+  bool Write(const std::string &source) const {
+    std::ofstream strm(source, std::ios_base::out | std::ios_base::binary);
+    if (!strm) {
+      LOG(ERROR) << "FlatDfa::Write: Can't open file: " << source;
+      return false;
+    }
+    return Write(strm, source);
+  }
+
+  static FlatDfa *Read(std::istream &strm, const std::string &source);
+
+  static FlatDfa *Read(const std::string &source) {
+    std::ifstream strm(source, std::ios_base::in | std::ios_base::binary);
+    if (!strm) {
+      LOG(ERROR) << "FlatDfa::Read: Can't open file: " << source;
+      return nullptr;
+    }
+    return Read(strm, source);
+  }
+
+ private:
+  // Stores an output string, returning its (output, output_size) encoding.
+  void AddOutput(const std::vector<Label> &labels, uint32 *output,
+                 uint32 *output_size) {
+    *output_size = labels.size();
+    if (labels.empty()) {
+      *output = 0;
+    } else if (labels.size() == 1) {
+      *output = static_cast<uint32>(labels[0]);
+    } else {
+      *output = pool_.size();
+      pool_.insert(pool_.end(), labels.begin(), labels.end());
+    }
+  }
+
+  // Follows a chain of input-epsilon arcs, beginning with `arc`, to a final
+  // state, collecting its output labels and weight. Returns false if the chain
+  // branches, consumes input or never reaches a final state.
+  static bool FollowFinalChain(const Fst<Arc> &fst, const Arc &arc,
+                               std::vector<Label> *output, Weight *weight);
+
+  // Checks that the offsets read from a file are in range and that the arcs
+  // of each state are sorted by input label.
+  bool Validate() const;
+
+  uint32 start_;
+  std::vector<FlatState> states_;
+  std::vector<FlatArc> arcs_;
+  std::vector<Label> pool_;
+};
+
+template <class Arc>
+bool FlatDfa<Arc>::FollowFinalChain(const Fst<Arc> &fst, const Arc &arc,
+                                    std::vector<Label> *output,
+                                    Weight *weight) {
+  std::unordered_set<StateId> visited;
+  *weight = arc.weight;
+  if (arc.olabel != 0) output->push_back(arc.olabel);
+  auto s = arc.nextstate;
+  while (visited.insert(s).second) {
+    const auto final_weight = fst.Final(s);
+    const auto num_arcs = fst.NumArcs(s);
+    if (final_weight != Weight::Zero()) {
+      if (num_arcs != 0) return false;
+      *weight = Times(*weight, final_weight);
+      return true;
+    }
+    if (num_arcs != 1) return false;
+    ArcIterator<Fst<Arc>> aiter(fst, s);
+    const auto &next = aiter.Value();
+    if (next.ilabel != 0) return false;
+    *weight = Times(*weight, next.weight);
+    if (next.olabel != 0) output->push_back(next.olabel);
+    s = next.nextstate;
+  }
+  return false;  // Epsilon cycle.
+}
+
+template <class Arc>
+bool FlatDfa<Arc>::Init(const Fst<Arc> &fst) {
+  Clear();
+  const auto start = fst.Start();
+  if (start == kNoStateId) return true;
+  // Maps from input state IDs to flat state IDs, assigned in discovery order.
+  std::vector<uint32> flat_ids;
+  std::queue<StateId> queue;
+  // Discovery order and queue order coincide, so the flat ID of a newly
+  // discovered state is the number of states discovered so far.
+  uint32 num_discovered = 0;
+  const auto assign = [&flat_ids, &queue, &num_discovered](StateId s) {
+    if (static_cast<size_t>(s) >= flat_ids.size()) {
+      flat_ids.resize(s + 1, kNoState);
+    }
+    if (flat_ids[s] == kNoState) {
+      flat_ids[s] = num_discovered++;
+      queue.push(s);
+    }
+    return flat_ids[s];
+  };
+  start_ = assign(start);
+  std::vector<Label> final_output;
+  while (!queue.empty()) {
+    const auto s = queue.front();
+    queue.pop();
+    FlatState state;
+    state.arc_offset = arcs_.size();
+    state.final_output = 0;
+    state.final_output_size = 0;
+    state.final_weight = fst.Final(s);
+    for (ArcIterator<Fst<Arc>> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      if (arc.ilabel == 0) {
+        final_output.clear();
+        Weight final_weight;
+        if (state.final_weight != Weight::Zero() ||
+            !FollowFinalChain(fst, arc, &final_output, &final_weight)) {
+          VLOG(1) << "FlatDfa: State " << s
+                  << " has an input-epsilon arc which is not a final output";
+          Clear();
+          return false;
+        }
+        state.final_weight = final_weight;
+        AddOutput(final_output, &state.final_output, &state.final_output_size);
+        continue;
+      }
+      FlatArc flat_arc;
+      flat_arc.ilabel = arc.ilabel;
+      flat_arc.nextstate = assign(arc.nextstate);
+      flat_arc.output = arc.olabel == 0 ? 0 : static_cast<uint32>(arc.olabel);
+      flat_arc.output_size = arc.olabel == 0 ? 0 : 1;
+      flat_arc.weight = arc.weight;
+      arcs_.push_back(flat_arc);
+    }
+    const auto begin = arcs_.begin() + state.arc_offset;
+    std::sort(begin, arcs_.end(), [](const FlatArc &lhs, const FlatArc &rhs) {
+      return lhs.ilabel < rhs.ilabel;
+    });
+    const auto duplicate = std::adjacent_find(
+        begin, arcs_.end(), [](const FlatArc &lhs, const FlatArc &rhs) {
+          return lhs.ilabel == rhs.ilabel;
+        });
+    if (duplicate != arcs_.end()) {
+      VLOG(1) << "FlatDfa: State " << s << " is not input-deterministic";
+      Clear();
+      return false;
+    }
+    state.num_arcs = arcs_.size() - state.arc_offset;
+    states_.push_back(state);
+    if (arcs_.size() >= kNoState || pool_.size() >= kNoState) {
+      LOG(ERROR) << "FlatDfa: FST too large for 32-bit offsets";
+      Clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Arc>
+bool FlatDfa<Arc>::Write(std::ostream &strm, const std::string &source) const {
+  WriteType(strm, kFlatDfaMagicNumber);
+  WriteType(strm, kFlatDfaFileVersion);
+  WriteType(strm, Arc::Type());
+  WriteType(strm, start_);
+  WriteType(strm, static_cast<int64>(states_.size()));
+  for (const auto &state : states_) {
+    WriteType(strm, state.arc_offset);
+    WriteType(strm, state.num_arcs);
+    WriteType(strm, state.final_output);
+    WriteType(strm, state.final_output_size);
+    state.final_weight.Write(strm);
+  }
+  WriteType(strm, static_cast<int64>(arcs_.size()));
+  for (const auto &arc : arcs_) {
+    WriteType(strm, arc.ilabel);
+    WriteType(strm, arc.nextstate);
+    WriteType(strm, arc.output);
+    WriteType(strm, arc.output_size);
+    arc.weight.Write(strm);
+  }
+  WriteType(strm, pool_);
+  strm.flush();
+  if (!strm) {
+    LOG(ERROR) << "FlatDfa::Write: Write failed: " << source;
+    return false;
+  }
+  return true;
+}
+
+template <class Arc>
+FlatDfa<Arc> *FlatDfa<Arc>::Read(std::istream &strm,
+                                 const std::string &source) {
+  int32 magic_number = 0;
+  ReadType(strm, &magic_number);
+  if (magic_number != kFlatDfaMagicNumber) {
+    LOG(ERROR) << "FlatDfa::Read: Bad magic number: " << source;
+    return nullptr;
+  }
+  int32 version = 0;
+  ReadType(strm, &version);
+  if (version != kFlatDfaFileVersion) {
+    LOG(ERROR) << "FlatDfa::Read: Unsupported version " << version << ": "
+               << source;
+    return nullptr;
+  }
+  std::string arc_type;
+  ReadType(strm, &arc_type);
+  if (arc_type != Arc::Type()) {
+    LOG(ERROR) << "FlatDfa::Read: Arc type " << arc_type
+               << " does not match " << Arc::Type() << ": " << source;
+    return nullptr;
+  }
+  auto dfa = std::make_unique<FlatDfa>();
+  ReadType(strm, &dfa->start_);
+  int64 num_states = 0;
+  ReadType(strm, &num_states);
+  if (!strm || num_states < 0) {
+    LOG(ERROR) << "FlatDfa::Read: Read failed: " << source;
+    return nullptr;
+  }
+  dfa->states_.resize(num_states);
+  for (auto &state : dfa->states_) {
+    ReadType(strm, &state.arc_offset);
+    ReadType(strm, &state.num_arcs);
+    ReadType(strm, &state.final_output);
+    ReadType(strm, &state.final_output_size);
+    state.final_weight.Read(strm);
+  }
+  int64 num_arcs = 0;
+  ReadType(strm, &num_arcs);
+  if (!strm || num_arcs < 0) {
+    LOG(ERROR) << "FlatDfa::Read: Read failed: " << source;
+    return nullptr;
+  }
+  dfa->arcs_.resize(num_arcs);
+  for (auto &arc : dfa->arcs_) {
+    ReadType(strm, &arc.ilabel);
+    ReadType(strm, &arc.nextstate);
+    ReadType(strm, &arc.output);
+    ReadType(strm, &arc.output_size);
+    arc.weight.Read(strm);
+  }
+  ReadType(strm, &dfa->pool_);
+  if (!strm) {
+    LOG(ERROR) << "FlatDfa::Read: Read failed: " << source;
+    return nullptr;
+  }
+  if (!dfa->Validate()) {
+    LOG(ERROR) << "FlatDfa::Read: Inconsistent tables: " << source;
+    return nullptr;
+  }
+  return dfa.release();
+}
+
+template <class Arc>
+bool FlatDfa<Arc>::Validate() const {
+  if (states_.empty()) return start_ == kNoState;
+  if (start_ >= states_.size()) return false;
+  const auto output_ok = [this](uint32 output, uint32 output_size) {
+    return output_size <= 1 ||
+           static_cast<size_t>(output) + output_size <= pool_.size();
+  };
+  for (const auto &state : states_) {
+    if (static_cast<size_t>(state.arc_offset) + state.num_arcs > arcs_.size()) {
+      return false;
+    }
+    if (!output_ok(state.final_output, state.final_output_size)) return false;
+    // Find() relies on the arcs being sorted, and there is no input epsilon.
+    Label previous = 0;
+    for (uint32 i = 0; i < state.num_arcs; ++i) {
+      const auto ilabel = arcs_[state.arc_offset + i].ilabel;
+      if (ilabel <= previous) return false;
+      previous = ilabel;
+    }
+  }
+  for (const auto &arc : arcs_) {
+    if (arc.nextstate >= states_.size()) return false;
+    if (!output_ok(arc.output, arc.output_size)) return false;
+  }
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_FLAT_DFA_H_
@@ -0,0 +1,351 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_INCREMENTAL_REWRITE_H_
+#define FST_UTIL_OPERATORS_INCREMENTAL_REWRITE_H_
+
+// Top-1 rewriting of a string which is edited a little at a time.
+//
+// The rewriter searches the composition of the input with the rule the way
+// ViterbiRewriter does, but keeps the lattice column of every input position:
+// the rule states reached after reading that much of the input, each with its
+// best cost and a back-pointer. A column only depends on the one before it and
+// on the next input label, so after an edit the columns before the edit point
+// still hold, and columns are recomputed from there on until one matches the
+// column at the same position in the previous run, from which point on the
+// old columns hold again. Costs in a column are stored relative to the best
+// one, so that columns match even when the edit changed the cost of reaching
+// them; for a rule which forgets its context after a few labels, such as
+// most context-dependent rewrites, the work per edit is then proportional to
+// the size of the edit rather than to the length of the input.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fst.h>
+#include <fst/matcher.h>
+#include <fst/properties.h>
+#include <fst/weight.h>
+#include <thrax/algo/viterbi_rewrite.h>
+
+namespace fst {
+
+// An instance holds the input and its lattice between calls; it is not
+// thread-safe. The weights must have the path property and be divisible
+// (e.g., tropical weights).
+template <class A>
+class IncrementalRewriter {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  static_assert(IsPath<Weight>::value, "Weight must have path property");
+
+  // The rule must outlive the rewriter.
+  explicit IncrementalRewriter(const Fst<Arc> &rule)
+      : rule_(rule), stamp_(0), num_recomputed_(0) {}
+
+  // Sets the input to the label string [begin, end), and appends the
+  // non-epsilon output labels of its best path through the rule to any sink
+  // supporting push_back(Label). The status has the same meaning as for
+  // ViterbiRewriter.
+  template <class Iterator, class Sink>
+  ViterbiStatus Reset(Iterator begin, Iterator end, Sink *output) {
+    input_.clear();
+    columns_.clear();
+    return Replace(0, 0, begin, end, output);
+  }
+
+  // Replaces the length labels of the input from position pos on with the
+  // label string [begin, end), and appends the output of the edited input
+  // just as Reset() does. Positions past the end of the input are clamped to
+  // it, so Replace(Input().size(), 0, ...) appends to the input.
+  template <class Iterator, class Sink>
+  ViterbiStatus Replace(size_t pos, size_t length, Iterator begin,
+                        Iterator end, Sink *output);
+
+  const std::vector<Label> &Input() const { return input_; }
+
+  // The number of lattice columns the last call computed, including the one
+  // at which the lattice matched the previous run.
+  size_t NumRecomputed() const { return num_recomputed_; }
+
+  // The number of lattice nodes held for the current input.
+  size_t NumNodes() const {
+    size_t num_nodes = 0;
+    for (const auto &column : columns_) num_nodes += column.size();
+    return num_nodes;
+  }
+
+ private:
+  struct Node {
+    StateId state;
+    // Index of the previous node on the best path, or -1. It lies in the same
+    // column if the node was reached by an epsilon move, and in the column
+    // before otherwise.
+    int32 back;
+    Label olabel;  // Output label of the arc from the previous node.
+    Weight cost;   // Relative to the best node of the column.
+    bool epsilon;
+    bool queued;
+  };
+
+  using Column = std::vector<Node>;
+
+  struct Slot {
+    uint64 stamp = 0;
+    int32 node = -1;
+  };
+
+  // Appends the column for position k, which must be the next one, computing
+  // it from the column before. Returns false if its epsilon closure does not
+  // converge.
+  bool Compute(size_t k, SortedMatcher<Fst<Arc>> *matcher);
+
+  // Returns the node for rule state q in the column being computed, creating
+  // it (with cost Zero) if necessary.
+  int32 FindNode(Column *column, StateId q);
+
+  // Relaxes the node for q through the node `from` and an arc with the given
+  // output label and weight; see ViterbiRewriter::Relax().
+  int32 Relax(Column *column, const Weight &from_cost, int32 from,
+              bool epsilon, StateId q, Label olabel, const Weight &weight);
+
+  bool CloseEpsilons(Column *column);
+
+  // Whether two columns reach the same states, in the same order and with the
+  // same relative costs, in which case the columns following them agree too.
+  static bool SameFrontier(const Column &column1, const Column &column2);
+
+  template <class Sink>
+  ViterbiStatus BestOutput(Sink *output) const;
+
+  const Fst<Arc> &rule_;
+  std::vector<Label> input_;
+  // The column for each position from 0 to the length of the input; only a
+  // prefix of the columns is valid after a failure.
+  std::vector<Column> columns_;
+  std::vector<Slot> slots_;
+  std::vector<int32> queue_;
+  uint64 stamp_;
+  size_t num_recomputed_;
+  NaturalLess<Weight> less_;
+};
+
+template <class Arc>
+template <class Iterator, class Sink>
+ViterbiStatus IncrementalRewriter<Arc>::Replace(size_t pos, size_t length,
+                                                Iterator begin, Iterator end,
+                                                Sink *output) {
+  num_recomputed_ = 0;
+  const size_t old_size = input_.size();
+  pos = std::min(pos, old_size);
+  length = std::min(length, old_size - pos);
+  const std::vector<Label> inserted(begin, end);
+  input_.erase(input_.begin() + pos, input_.begin() + pos + length);
+  input_.insert(input_.begin() + pos, inserted.begin(), inserted.end());
+  if (rule_.Properties(kILabelSorted, false) != kILabelSorted) {
+    columns_.clear();
+    return ViterbiStatus::kUnsupported;
+  }
+  // The old columns from the end of the edit on, which are those for
+  // positions from pos + inserted.size() on once shifted, are kept aside if
+  // the previous run completed; the columns up to the edit point still hold.
+  const bool complete = columns_.size() == old_size + 1;
+  std::vector<Column> tail;
+  const size_t keep = std::min(columns_.size(), pos + 1);
+  if (complete) {
+    for (auto j = pos + length; j <= old_size; ++j) {
+      if (j < keep) {
+        tail.push_back(columns_[j]);
+      } else {
+        tail.push_back(std::move(columns_[j]));
+      }
+    }
+  }
+  columns_.resize(keep);
+  SortedMatcher<Fst<Arc>> matcher(&rule_, MATCH_INPUT);
+  if (columns_.empty()) {
+    if (!Compute(0, &matcher)) return ViterbiStatus::kUnsupported;
+    ++num_recomputed_;
+  }
+  const auto resync = pos + inserted.size();
+  for (auto k = columns_.size() - 1;;) {
+    if (complete && k >= resync &&
+        SameFrontier(columns_[k], tail[k - resync])) {
+      // Keeps the new column, whose back-pointers may differ, and reuses the
+      // old ones after it.
+      for (auto j = k - resync + 1; j < tail.size(); ++j) {
+        columns_.push_back(std::move(tail[j]));
+      }
+      break;
+    }
+    if (++k > input_.size()) break;
+    if (!Compute(k, &matcher)) return ViterbiStatus::kUnsupported;
+    ++num_recomputed_;
+  }
+  return BestOutput(output);
+}
+
+template <class Arc>
+bool IncrementalRewriter<Arc>::Compute(size_t k,
+                                       SortedMatcher<Fst<Arc>> *matcher) {
+  columns_.emplace_back();
+  auto &column = columns_.back();
+  ++stamp_;
+  if (k == 0) {
+    if (rule_.Start() == kNoStateId) return true;
+    const auto start = FindNode(&column, rule_.Start());
+    column[start].cost = Weight::One();
+  } else {
+    const auto &previous = columns_[k - 1];
+    const Label label = input_[k - 1];
+    for (size_t i = 0; i < previous.size(); ++i) {
+      // Label 0 is epsilon, which composition skips (NUL bytes compile to
+      // it), so the column carries over unchanged.
+      if (label == 0) {
+        Relax(&column, previous[i].cost, i, false, previous[i].state, 0,
+              Weight::One());
+        continue;
+      }
+      matcher->SetState(previous[i].state);
+      for (matcher->Find(label); !matcher->Done(); matcher->Next()) {
+        const auto &arc = matcher->Value();
+        Relax(&column, previous[i].cost, i, false, arc.nextstate, arc.olabel,
+              arc.weight);
+      }
+    }
+  }
+  if (!CloseEpsilons(&column)) {
+    columns_.pop_back();
+    return false;
+  }
+  auto best = Weight::Zero();
+  for (const auto &node : column) best = Plus(best, node.cost);
+  if (best == Weight::Zero()) {
+    column.clear();
+  } else {
+    for (auto &node : column) node.cost = Divide(node.cost, best);
+  }
+  return true;
+}
+
+template <class Arc>
+int32 IncrementalRewriter<Arc>::FindNode(Column *column, StateId q) {
+  if (q >= static_cast<StateId>(slots_.size())) slots_.resize(q + 1);
+  auto &slot = slots_[q];
+  if (slot.stamp != stamp_) {
+    slot.stamp = stamp_;
+    slot.node = column->size();
+    column->push_back({q, -1, 0, Weight::Zero(), false, false});
+  }
+  return slot.node;
+}
+
+template <class Arc>
+int32 IncrementalRewriter<Arc>::Relax(Column *column, const Weight &from_cost,
+                                      int32 from, bool epsilon, StateId q,
+                                      Label olabel, const Weight &weight) {
+  const auto cost = Times(from_cost, weight);
+  const auto to = FindNode(column, q);
+  auto &node = (*column)[to];
+  if (!less_(cost, node.cost)) return -1;
+  node.cost = cost;
+  node.back = from;
+  node.olabel = olabel;
+  node.epsilon = epsilon;
+  return to;
+}
+
+template <class Arc>
+bool IncrementalRewriter<Arc>::CloseEpsilons(Column *column) {
+  queue_.clear();
+  for (size_t i = 0; i < column->size(); ++i) {
+    (*column)[i].queued = true;
+    queue_.push_back(i);
+  }
+  // Bounds the pops as ViterbiRewriter::CloseEpsilons() does.
+  size_t pops = 0;
+  for (size_t head = 0; head < queue_.size(); ++head) {
+    const auto n = column->size();
+    if (++pops > n * n + 1) return false;
+    const auto i = queue_[head];
+    (*column)[i].queued = false;
+    for (ArcIterator<Fst<Arc>> aiter(rule_, (*column)[i].state);
+         !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      if (arc.ilabel != 0) break;
+      // Copies the cost, since Relax() may reallocate the column.
+      const auto cost = (*column)[i].cost;
+      const auto to =
+          Relax(column, cost, i, true, arc.nextstate, arc.olabel, arc.weight);
+      if (to != -1 && !(*column)[to].queued) {
+        (*column)[to].queued = true;
+        queue_.push_back(to);
+      }
+    }
+  }
+  return true;
+}
+
+template <class Arc>
+bool IncrementalRewriter<Arc>::SameFrontier(const Column &column1,
+                                            const Column &column2) {
+  if (column1.size() != column2.size()) return false;
+  for (size_t i = 0; i < column1.size(); ++i) {
+    if (column1[i].state != column2[i].state ||
+        column1[i].cost != column2[i].cost) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Arc>
+template <class Sink>
+ViterbiStatus IncrementalRewriter<Arc>::BestOutput(Sink *output) const {
+  const auto &last = columns_.back();
+  int32 best = -1;
+  auto best_cost = Weight::Zero();
+  for (size_t i = 0; i < last.size(); ++i) {
+    const auto cost = Times(last[i].cost, rule_.Final(last[i].state));
+    if (less_(cost, best_cost)) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  if (best == -1) return ViterbiStatus::kNoPath;
+  // Follows the back-pointers across the columns, then appends the labels in
+  // path order.
+  std::vector<Label> labels;
+  auto k = columns_.size() - 1;
+  for (auto i = best; columns_[k][i].back != -1;) {
+    const auto &node = columns_[k][i];
+    if (node.olabel != 0) labels.push_back(node.olabel);
+    if (!node.epsilon) --k;
+    i = node.back;
+  }
+  for (auto rit = labels.rbegin(); rit != labels.rend(); ++rit) {
+    output->push_back(*rit);
+  }
+  return ViterbiStatus::kSuccess;
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_INCREMENTAL_REWRITE_H_
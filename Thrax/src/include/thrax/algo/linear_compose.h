@@ -0,0 +1,202 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_LINEAR_COMPOSE_H_
+#define FST_UTIL_OPERATORS_LINEAR_COMPOSE_H_
+
+// Composition of a string FST (a linear chain, such as the output of
+// StringCompiler) with an input-label-sorted FST.
+//
+// The general Compose() must treat its left argument as an arbitrary FST, and
+// so pays for a hashed state table, a compose filter, and on-demand caching.
+// When the left argument is a string, a composed state is simply a pair of a
+// position in the string and a state of the right argument, so the states can
+// be found in a table indexed by rule state and stamped by position, and the
+// result is built eagerly, one position at a time.
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/connect.h>
+#include <fst/fst.h>
+#include <fst/matcher.h>
+#include <fst/mutable-fst.h>
+#include <fst/properties.h>
+
+namespace fst {
+
+// Composes strings with rules. An instance keeps its scratch space between
+// calls, so reusing one avoids reallocation; it is not thread-safe.
+template <class A>
+class LinearComposer {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  LinearComposer()
+      : final_weight_(Weight::Zero()), stamp_(0), next_stamp_(1) {}
+
+  // Writes the connected composition of input with rule to output. Returns
+  // false, leaving output untouched, if input is not a string whose output
+  // labels are all non-epsilon, or if rule is not known to be sorted on input
+  // labels; the caller should then fall back to Compose(). Under these
+  // conditions each path of the result corresponds to exactly one pair of
+  // matching paths, just as with Compose() and any of its filters.
+  //
+  // If interrupted is given, it is polled once per position of the input, and
+  // if it returns true the composition stops, leaving output empty.
+  bool operator()(const Fst<Arc> &input, const Fst<Arc> &rule,
+                  MutableFst<Arc> *output,
+                  const std::function<bool()> *interrupted = nullptr);
+
+ private:
+  struct Slot {
+    uint64_t stamp = 0;
+    StateId state = kNoStateId;
+  };
+
+  // Copies the arcs along the single path of input into string_ and its final
+  // weight into final_weight_.
+  bool ReadString(const Fst<Arc> &input);
+
+  // Returns the output state for the given position and rule state, creating
+  // and enqueuing it if necessary.
+  StateId FindState(size_t position, StateId q, MutableFst<Arc> *output);
+
+  std::vector<Arc> string_;
+  Weight final_weight_;
+  // Output states by rule state, for the current and the next position.
+  // Entries are valid only if their stamp matches stamp_ plus the position,
+  // which avoids clearing the tables between positions or calls.
+  std::vector<Slot> slots_[2];
+  // (rule state, output state) pairs still to be expanded, for the current
+  // and the next position.
+  std::vector<std::pair<StateId, StateId>> queue_[2];
+  // Stamp of position 0 of the current string, and the first stamp not yet
+  // used by any string. Slots start out with stamp 0, which is never used.
+  uint64_t stamp_;
+  uint64_t next_stamp_;
+};
+
+template <class Arc>
+bool LinearComposer<Arc>::operator()(const Fst<Arc> &input,
+                                     const Fst<Arc> &rule,
+                                     MutableFst<Arc> *output,
+                                     const std::function<bool()> *interrupted) {
+  if (rule.Properties(kILabelSorted, false) != kILabelSorted) return false;
+  if (!ReadString(input)) return false;
+  // Reserves a fresh stamp for every position of this string, past all those
+  // of earlier strings, however long they were.
+  stamp_ = next_stamp_;
+  next_stamp_ = stamp_ + string_.size() + 1;
+  queue_[0].clear();
+  queue_[1].clear();
+  output->DeleteStates();
+  output->SetInputSymbols(input.InputSymbols());
+  output->SetOutputSymbols(rule.OutputSymbols());
+  if (rule.Start() == kNoStateId) return true;
+  output->SetStart(FindState(0, rule.Start(), output));
+  SortedMatcher<Fst<Arc>> matcher(&rule, MATCH_INPUT);
+  for (size_t i = 0; i <= string_.size(); ++i) {
+    if (interrupted && (*interrupted)()) {
+      output->DeleteStates();
+      return true;
+    }
+    auto &queue = queue_[i % 2];
+    // Epsilon moves of the rule may enqueue further states at this position.
+    for (size_t k = 0; k < queue.size(); ++k) {
+      const auto q = queue[k].first;
+      const auto s = queue[k].second;
+      // Epsilons sort first, so we can stop at the first labeled arc.
+      for (ArcIterator<Fst<Arc>> aiter(rule, q); !aiter.Done();
+           aiter.Next()) {
+        const auto &arc = aiter.Value();
+        if (arc.ilabel != 0) break;
+        const auto nextstate = FindState(i, arc.nextstate, output);
+        output->AddArc(s, Arc(0, arc.olabel, arc.weight, nextstate));
+      }
+      if (i == string_.size()) {
+        const auto weight = rule.Final(q);
+        if (weight != Weight::Zero()) {
+          output->SetFinal(s, Times(final_weight_, weight));
+        }
+        continue;
+      }
+      const auto &iarc = string_[i];
+      matcher.SetState(q);
+      for (matcher.Find(iarc.olabel); !matcher.Done(); matcher.Next()) {
+        const auto &arc = matcher.Value();
+        const auto nextstate = FindState(i + 1, arc.nextstate, output);
+        output->AddArc(s, Arc(iarc.ilabel, arc.olabel,
+                              Times(iarc.weight, arc.weight), nextstate));
+      }
+    }
+    queue.clear();
+  }
+  Connect(output);
+  return true;
+}
+
+template <class Arc>
+bool LinearComposer<Arc>::ReadString(const Fst<Arc> &input) {
+  // Compiled strings carry this property, so the check is usually free.
+  if (input.Start() == kNoStateId ||
+      input.Properties(kString, true) != kString) {
+    return false;
+  }
+  string_.clear();
+  for (auto s = input.Start();;) {
+    ArcIterator<Fst<Arc>> aiter(input, s);
+    if (aiter.Done()) {
+      final_weight_ = input.Final(s);
+      return true;
+    }
+    const auto &arc = aiter.Value();
+    if (arc.olabel == 0) return false;
+    string_.push_back(arc);
+    s = arc.nextstate;
+  }
+}
+
+template <class Arc>
+typename Arc::StateId LinearComposer<Arc>::FindState(size_t position,
+                                                     StateId q,
+                                                     MutableFst<Arc> *output) {
+  auto &slots = slots_[position % 2];
+  if (q >= static_cast<StateId>(slots.size())) slots.resize(q + 1);
+  auto &slot = slots[q];
+  if (slot.stamp != stamp_ + position) {
+    slot.stamp = stamp_ + position;
+    slot.state = output->AddState();
+    queue_[position % 2].emplace_back(q, slot.state);
+  }
+  return slot.state;
+}
+
+// Convenience wrapper around LinearComposer which uses fresh scratch space.
+template <class Arc>
+bool LinearCompose(const Fst<Arc> &input, const Fst<Arc> &rule,
+                   MutableFst<Arc> *output) {
+  LinearComposer<Arc> composer;
+  return composer(input, rule, output);
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_LINEAR_COMPOSE_H_
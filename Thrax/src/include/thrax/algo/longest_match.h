@@ -0,0 +1,149 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_LONGEST_MATCH_H_
+#define FST_UTIL_OPERATORS_LONGEST_MATCH_H_
+
+// Greedy left-to-right longest-match segmentation with a dictionary rule.
+//
+// The rule, an acceptor or a functional transducer whose paths are the
+// dictionary entries, is made input-deterministic and flattened. Segmentation
+// then walks the flat machine from each input position, remembering the last
+// final state reached, and emits the output of the longest entry matching at
+// that position before moving past it. In a sequential transducer the output
+// read along a path is a prefix of the output of every entry extending it, so
+// the output of a match is the arc output up to its end plus the final output
+// of the state reached there. Each position is scanned at most as far as the
+// longest entry, so the cost is linear in the input for bounded entries.
+
+#include <cstdint>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fst.h>
+#include <fst/vector-fst.h>
+#include <thrax/algo/flat_dfa.h>
+#include <thrax/algo/optimize.h>
+
+namespace fst {
+
+// What to do with an input label at which no dictionary entry matches.
+enum class UnmatchedPolicy {
+  kCopy,  // Copies it to the output as a segment of its own.
+  kDrop,  // Leaves it out of the output.
+  kFail,  // Rejects the input.
+};
+
+// This class is thread-compatible; a const segmenter may be shared by many
+// threads.
+template <class A>
+class LongestMatchSegmenter {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+
+  // If separator is not 0, it is emitted between consecutive segments.
+  explicit LongestMatchSegmenter(
+      UnmatchedPolicy policy = UnmatchedPolicy::kCopy, Label separator = 0)
+      : policy_(policy), separator_(separator) {}
+
+  // Prepares the dictionary. Rules which are not already input-deterministic
+  // are sequentialized, giving up after max_states states. Returns false if
+  // the rule cannot be made input-deterministic, e.g., because it is not
+  // functional.
+  bool Init(const Fst<Arc> &rule, int64 max_states);
+
+  // Uses an existing flat form of the dictionary.
+  void Init(const FlatDfa<Arc> &dfa) { dfa_ = dfa; }
+
+  // Segments the label string [begin, end), appending the output to any sink
+  // supporting push_back(Label). Returns false if the policy is kFail and some
+  // position matches no entry; the contents of sink are then unspecified.
+  // Entries matching the empty string are ignored.
+  template <class Iterator, class Sink>
+  bool operator()(Iterator begin, Iterator end, Sink *sink) const;
+
+  const FlatDfa<Arc> &Dictionary() const { return dfa_; }
+
+ private:
+  using Dfa = FlatDfa<Arc>;
+
+  FlatDfa<Arc> dfa_;
+  UnmatchedPolicy policy_;
+  Label separator_;
+};
+
+template <class Arc>
+bool LongestMatchSegmenter<Arc>::Init(const Fst<Arc> &rule, int64 max_states) {
+  if (dfa_.Init(rule)) return true;
+  VectorFst<Arc> sequential(rule);
+  return Sequentialize(&sequential, max_states) && dfa_.Init(sequential);
+}
+
+template <class Arc>
+template <class Iterator, class Sink>
+bool LongestMatchSegmenter<Arc>::operator()(Iterator begin, Iterator end,
+                                            Sink *sink) const {
+  // Output of the entry being scanned; the weights are not needed.
+  std::vector<Label> scratch;
+  auto weight = Arc::Weight::One();
+  bool first = true;
+  const auto emit_separator = [&first, sink, this] {
+    if (!first && separator_ != 0) sink->push_back(separator_);
+    first = false;
+  };
+  for (auto it = begin; it != end;) {
+    scratch.clear();
+    // The end of the longest match so far, how much of the scratch output
+    // belongs to it, and the state at which it ends.
+    auto match_end = it;
+    size_t match_output = 0;
+    auto match_state = Dfa::kNoState;
+    auto s = dfa_.Start();
+    for (auto next = it; s != Dfa::kNoState && next != end;) {
+      s = dfa_.Step(s, *next, &scratch, &weight);
+      ++next;
+      if (s != Dfa::kNoState &&
+          dfa_.GetState(s).final_weight != Arc::Weight::Zero()) {
+        match_end = next;
+        match_output = scratch.size();
+        match_state = s;
+      }
+    }
+    if (match_state == Dfa::kNoState) {
+      switch (policy_) {
+        case UnmatchedPolicy::kCopy:
+          emit_separator();
+          sink->push_back(*it);
+          break;
+        case UnmatchedPolicy::kDrop:
+          break;
+        case UnmatchedPolicy::kFail:
+          return false;
+      }
+      ++it;
+      continue;
+    }
+    emit_separator();
+    scratch.resize(match_output);
+    dfa_.Finish(match_state, &scratch, &weight);
+    for (const auto label : scratch) sink->push_back(label);
+    it = match_end;
+  }
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_LONGEST_MATCH_H_
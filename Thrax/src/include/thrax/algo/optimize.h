@@ -24,6 +24,8 @@
 // construction of integrated speech recognition transducers. In Proc. ICASSP,
 // pages 761-764.
 
+#include <vector>
+
 #include <fst/arcsort.h>
 #include <fst/determinize.h>
 #include <fst/encode.h>
@@ -31,6 +33,7 @@
 #include <fst/mutable-fst.h>
 #include <fst/rmepsilon.h>
 #include <fst/state-map.h>
+#include <fst/vector-fst.h>
 
 // These functions are generic optimization methods for mutable FSTs, inspired
 // by those originally included in Thrax.
@@ -157,6 +160,50 @@ void OptimizeDifferenceRhs(MutableFst<Arc> *fst, bool compute_props = false) {
   ArcSort(fst, comp);
 }
 
+// Attempts to make a functional transducer p-subsequential, so that it can be
+// applied in a single deterministic pass, by determinizing it over the string
+// semiring: output is delayed until the input determines it, and output still
+// pending at a final state is emitted along input-epsilon arcs to a new final
+// state. Determinization terminates only if the transducer has bounded delay
+// (the twins property), so it is abandoned once more than max_states states
+// have been expanded. Returns true on success; otherwise, including when the
+// transducer turns out not to be functional, returns false and leaves the FST
+// unchanged.
+template <class Arc>
+bool Sequentialize(MutableFst<Arc> *fst, int64 max_states) {
+  using StateId = typename Arc::StateId;
+  VectorFst<Arc> ifst(*fst);
+  internal::MaybeRmEpsilon(&ifst, true);
+  DeterminizeFstOptions<Arc> opts;
+  opts.type = DETERMINIZE_FUNCTIONAL;
+  opts.gc = false;  // Keeps the expanded states for the copy below.
+  const DeterminizeFst<Arc> dfst(ifst, opts);
+  // Expands the result breadth-first; states are numbered as discovered, so a
+  // state is new exactly when its ID is past the last one seen.
+  const auto start = dfst.Start();
+  if (start == kNoStateId) return false;
+  std::vector<StateId> queue = {start};
+  StateId last = start;
+  for (size_t i = 0; i < queue.size(); ++i) {
+    if (static_cast<int64>(queue.size()) > max_states) return false;
+    for (ArcIterator<DeterminizeFst<Arc>> aiter(dfst, queue[i]); !aiter.Done();
+         aiter.Next()) {
+      const auto nextstate = aiter.Value().nextstate;
+      if (nextstate > last) {
+        last = nextstate;
+        queue.push_back(nextstate);
+      }
+    }
+  }
+  if (dfst.Properties(kError, false)) return false;
+  VectorFst<Arc> ofst(dfst);
+  if (ofst.Properties(kError, false)) return false;
+  static const ILabelCompare<Arc> comp;
+  ArcSort(&ofst, comp);
+  *fst = ofst;
+  return true;
+}
+
 }  // namespace fst
 
 #endif  // FST_UTIL_OPERATORS_OPTIMIZE_H_
@@ -0,0 +1,220 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_PACKED_FST_H_
+#define FST_UTIL_OPERATORS_PACKED_FST_H_
+
+// A compact FST type for byte and UTF-8 grammars, storing each arc in 8 bytes
+// rather than the 16 of a standard arc.
+//
+// Labels are stored in 16 bits, destination states in 24 bits, and weights as
+// 8-bit indices into a table of the distinct weights of the FST, which is
+// usually tiny since most arcs of a rule have weight One. An FST fits if its
+// labels are below 0xFFFF, it has fewer than 0xFFFFFF states, and it has at
+// most 256 distinct arc and final weights; rules using generated labels (see
+// StringFst) or Unicode code points outside the BMP do not. The arc type is
+// unchanged, so packed FSTs can be used wherever Fst<Arc> is expected.
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/compact-fst.h>
+#include <fst/expanded-fst.h>
+#include <fst/fst.h>
+#include <fst/util.h>
+
+namespace fst {
+
+struct PackedArcElement {
+  uint16 ilabel;
+  uint16 olabel;
+  // The destination state in the low 24 bits and the weight index in the
+  // high 8.
+  uint32 nextstate_weight;
+};
+
+template <class A>
+class PackedArcCompactor {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+  using Element = PackedArcElement;
+
+  static constexpr uint16 kNoLabel16 = 0xFFFF;
+  static constexpr uint32 kNoState24 = 0xFFFFFF;
+  static constexpr size_t kMaxWeights = 256;
+
+  PackedArcCompactor() {}
+
+  // Returns a compactor holding the distinct weights of the FST, or nullptr
+  // if the FST does not fit.
+  static std::shared_ptr<PackedArcCompactor> Create(
+      const ExpandedFst<Arc> &fst) {
+    auto compactor = std::make_shared<PackedArcCompactor>();
+    if (!compactor->Init(fst)) return nullptr;
+    return compactor;
+  }
+
+  Element Compact(StateId s, const Arc &arc) const {
+    Element element;
+    element.ilabel =
+        arc.ilabel == kNoLabel ? kNoLabel16 : static_cast<uint16>(arc.ilabel);
+    element.olabel =
+        arc.olabel == kNoLabel ? kNoLabel16 : static_cast<uint16>(arc.olabel);
+    const uint32 nextstate = arc.nextstate == kNoStateId
+                                 ? kNoState24
+                                 : static_cast<uint32>(arc.nextstate);
+    element.nextstate_weight = nextstate | (WeightIndex(arc.weight) << 24);
+    return element;
+  }
+
+  Arc Expand(StateId s, const Element &element,
+             uint8 flags = kArcValueFlags) const {
+    const auto nextstate = element.nextstate_weight & kNoState24;
+    return Arc(
+        element.ilabel == kNoLabel16 ? kNoLabel : element.ilabel,
+        element.olabel == kNoLabel16 ? kNoLabel : element.olabel,
+        weights_[element.nextstate_weight >> 24],
+        nextstate == kNoState24 ? kNoStateId
+                                : static_cast<StateId>(nextstate));
+  }
+
+  constexpr ssize_t Size() const { return -1; }
+
+  constexpr uint64 Properties() const { return 0; }
+
+  bool Compatible(const Fst<Arc> &fst) const {
+    const auto fits_label = [](Label label) {
+      return label >= 0 && label < kNoLabel16;
+    };
+    StateId num_states = 0;
+    for (StateIterator<Fst<Arc>> siter(fst); !siter.Done(); siter.Next()) {
+      const auto s = siter.Value();
+      if (++num_states >= static_cast<StateId>(kNoState24)) return false;
+      const auto final_weight = fst.Final(s);
+      if (final_weight != Weight::Zero() && !HasWeight(final_weight)) {
+        return false;
+      }
+      for (ArcIterator<Fst<Arc>> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+        const auto &arc = aiter.Value();
+        if (!fits_label(arc.ilabel) || !fits_label(arc.olabel) ||
+            !HasWeight(arc.weight)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static const std::string &Type() {
+    static const std::string *const type = new std::string("packed");
+    return *type;
+  }
+
+  bool Write(std::ostream &strm) const {
+    WriteType(strm, static_cast<int32>(weights_.size()));
+    for (const auto &weight : weights_) weight.Write(strm);
+    return !strm.fail();
+  }
+
+  static PackedArcCompactor *Read(std::istream &strm) {
+    int32 num_weights;
+    ReadType(strm, &num_weights);
+    if (strm.fail() || num_weights < 0 ||
+        num_weights > static_cast<int32>(kMaxWeights)) {
+      return nullptr;
+    }
+    auto *compactor = new PackedArcCompactor();
+    compactor->weights_.resize(num_weights);
+    for (auto &weight : compactor->weights_) weight.Read(strm);
+    if (strm.fail()) {
+      delete compactor;
+      return nullptr;
+    }
+    return compactor;
+  }
+
+  const std::vector<Weight> &Weights() const { return weights_; }
+
+ private:
+  // Collects the distinct weights, returning false if the FST does not fit.
+  bool Init(const ExpandedFst<Arc> &fst) {
+    const auto add = [this](const Weight &weight) {
+      if (HasWeight(weight)) return true;
+      if (weights_.size() == kMaxWeights) return false;
+      weights_.push_back(weight);
+      return true;
+    };
+    // Index 0, which most arcs use, is One.
+    if (!add(Weight::One())) return false;
+    for (StateId s = 0; s < fst.NumStates(); ++s) {
+      const auto final_weight = fst.Final(s);
+      if (final_weight != Weight::Zero() && !add(final_weight)) return false;
+      for (ArcIterator<ExpandedFst<Arc>> aiter(fst, s); !aiter.Done();
+           aiter.Next()) {
+        if (!add(aiter.Value().weight)) return false;
+      }
+    }
+    return Compatible(fst);
+  }
+
+  bool HasWeight(const Weight &weight) const {
+    for (const auto &w : weights_) {
+      if (w == weight) return true;
+    }
+    return false;
+  }
+
+  uint32 WeightIndex(const Weight &weight) const {
+    for (size_t i = 0; i < weights_.size(); ++i) {
+      if (weights_[i] == weight) return i;
+    }
+    // Zero is stored for the final weights of non-final states, which the
+    // compact store never asks for.
+    return 0;
+  }
+
+  std::vector<Weight> weights_;
+};
+
+template <class Arc>
+using PackedFst = CompactArcFst<Arc, PackedArcCompactor<Arc>>;
+
+using StdPackedFst = PackedFst<StdArc>;
+
+template <class Arc>
+bool IsPackedFst(const Fst<Arc> &fst) {
+  return fst.Type() == PackedFst<Arc>::Compactor::Type();
+}
+
+// Returns the FST in packed form, or nullptr if it does not fit.
+template <class Arc>
+std::unique_ptr<PackedFst<Arc>> MakePackedFst(const ExpandedFst<Arc> &fst) {
+  using Compactor = typename PackedFst<Arc>::Compactor;
+  auto arc_compactor = PackedArcCompactor<Arc>::Create(fst);
+  if (!arc_compactor) return nullptr;
+  return std::make_unique<PackedFst<Arc>>(
+      fst, std::make_shared<Compactor>(std::move(arc_compactor)));
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_PACKED_FST_H_
@@ -0,0 +1,129 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_STATE_ORDER_H_
+#define FST_UTIL_OPERATORS_STATE_ORDER_H_
+
+// Renumbers the states of an FST for locality of reference.
+//
+// States are put in breadth-first order from the start state, so the states
+// near the start, which every input visits, are stored together, and states
+// follow the states from which they are reached. Given visit counts collected
+// from traffic, the visited states are instead stored first, hottest first,
+// so the states most inputs touch share as few cache lines as possible.
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/expanded-fst.h>
+#include <fst/mutable-fst.h>
+#include <fst/properties.h>
+#include <fst/statesort.h>
+
+namespace fst {
+
+// Returns the states in breadth-first order from the start state, followed by
+// the unreachable states in their present order. In an acyclic FST a state is
+// only placed once all its reachable predecessors have been, so the order is
+// also topological.
+template <class Arc>
+std::vector<typename Arc::StateId> BreadthFirstStates(
+    const ExpandedFst<Arc> &fst) {
+  using StateId = typename Arc::StateId;
+  const auto num_states = fst.NumStates();
+  std::vector<StateId> states;
+  states.reserve(num_states);
+  const auto start = fst.Start();
+  if (start == kNoStateId) {
+    for (StateId s = 0; s < num_states; ++s) states.push_back(s);
+    return states;
+  }
+  std::vector<bool> reached(num_states, false);
+  std::queue<StateId> queue;
+  reached[start] = true;
+  queue.push(start);
+  while (!queue.empty()) {
+    const auto s = queue.front();
+    queue.pop();
+    states.push_back(s);
+    for (ArcIterator<ExpandedFst<Arc>> aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const auto nextstate = aiter.Value().nextstate;
+      if (!reached[nextstate]) {
+        reached[nextstate] = true;
+        queue.push(nextstate);
+      }
+    }
+  }
+  if (fst.Properties(kAcyclic, true) == kAcyclic) {
+    // Redoes the search, holding back each state until all of its reachable
+    // predecessors have been placed.
+    std::vector<size_t> waiting(num_states, 0);
+    for (const auto s : states) {
+      for (ArcIterator<ExpandedFst<Arc>> aiter(fst, s); !aiter.Done();
+           aiter.Next()) {
+        ++waiting[aiter.Value().nextstate];
+      }
+    }
+    const auto num_reached = states.size();
+    states.clear();
+    queue.push(start);
+    while (!queue.empty()) {
+      const auto s = queue.front();
+      queue.pop();
+      states.push_back(s);
+      for (ArcIterator<ExpandedFst<Arc>> aiter(fst, s); !aiter.Done();
+           aiter.Next()) {
+        const auto nextstate = aiter.Value().nextstate;
+        if (--waiting[nextstate] == 0) queue.push(nextstate);
+      }
+    }
+    DCHECK_EQ(states.size(), num_reached);
+  }
+  for (StateId s = 0; s < num_states; ++s) {
+    if (!reached[s]) states.push_back(s);
+  }
+  return states;
+}
+
+// Renumbers the states in breadth-first order (see above). If visits is
+// non-null, it holds the number of visits to each state, indexed by the
+// present state numbers, and states are stably sorted by decreasing count,
+// so that the visited states come first; states past its end count as never
+// visited. Unreachable states are kept, at the end.
+template <class Arc>
+void ReorderStates(MutableFst<Arc> *fst,
+                   const std::vector<uint64> *visits = nullptr) {
+  using StateId = typename Arc::StateId;
+  auto states = BreadthFirstStates(*fst);
+  if (visits) {
+    const auto count = [visits](StateId s) -> uint64 {
+      return static_cast<size_t>(s) < visits->size() ? (*visits)[s] : 0;
+    };
+    std::stable_sort(states.begin(), states.end(),
+                     [&count](StateId s1, StateId s2) {
+                       return count(s1) > count(s2);
+                     });
+  }
+  std::vector<StateId> order(states.size());
+  for (size_t i = 0; i < states.size(); ++i) order[states[i]] = i;
+  StateSort(fst, order);
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_STATE_ORDER_H_
@@ -0,0 +1,356 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_STREAMING_REWRITE_H_
+#define FST_UTIL_OPERATORS_STREAMING_REWRITE_H_
+
+// Top-1 rewriting of an unbounded stream of labels.
+//
+// The rewriter reads the input a chunk at a time and keeps a frontier of live
+// hypotheses: for each rule state reachable on the input read so far, the best
+// cost of reaching it and the output of that best path which has not yet been
+// emitted. Since the best path of the whole stream must run through one of
+// them, the longest common prefix of their outputs is determined and is
+// emitted at once. Memory is thus proportional to the number of rule states
+// times the output delay of the rule (how much input may pass before the
+// hypotheses agree), not to the length of the stream. For a sequential rule
+// the frontier is a single hypothesis and the output is emitted as soon as
+// the rule produces it.
+//
+// The rule should be trimmed (see Connect()), since a hypothesis in a state
+// from which no final state can be reached still holds back output. For rules
+// whose delay is unbounded, or too long to buffer, the pending output may be
+// bounded, at the cost of exactness; see the constructor.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fst.h>
+#include <fst/matcher.h>
+#include <fst/properties.h>
+#include <fst/weight.h>
+#include <thrax/algo/viterbi_rewrite.h>
+
+namespace fst {
+
+// An instance holds the state of one stream at a time; it is not thread-safe.
+// The weights must have the path property and be divisible (e.g., tropical
+// weights).
+template <class A>
+class StreamingRewriter {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  static_assert(IsPath<Weight>::value, "Weight must have path property");
+
+  // The rule must outlive the rewriter. If max_pending is positive and some
+  // hypothesis holds more than that many labels of undetermined output, the
+  // rewriter commits to the output of the best hypothesis so far and drops
+  // the hypotheses which disagree with it; the output may then differ from
+  // the best rewrite of the whole stream.
+  explicit StreamingRewriter(const Fst<Arc> &rule, size_t max_pending = 0)
+      : rule_(rule), max_pending_(max_pending), stamp_(0) {
+    Reset();
+  }
+
+  // Starts a new stream, discarding the current one.
+  void Reset() {
+    nodes_.clear();
+    started_ = false;
+    status_ = ViterbiStatus::kSuccess;
+  }
+
+  // Reads the label string [begin, end) as the next part of the stream, and
+  // appends the output it determines to any sink supporting push_back(Label).
+  // Returns kNoPath once the rule cannot accept any continuation of the
+  // stream, and kUnsupported if the rule is not known to be sorted on input
+  // labels or its epsilon moves form a negative cycle. Once an error is
+  // returned, it is returned for the rest of the stream.
+  template <class Iterator, class Sink>
+  ViterbiStatus Write(Iterator begin, Iterator end, Sink *output);
+
+  // Ends the stream, appending the rest of the output of the best path, and
+  // starts a new one. Returns kNoPath if the rule does not accept the stream.
+  template <class Sink>
+  ViterbiStatus Flush(Sink *output);
+
+  // The number of live hypotheses.
+  size_t NumHypotheses() const { return nodes_.size(); }
+
+  // The most labels of output held back by any hypothesis.
+  size_t NumPending() const {
+    size_t num_pending = 0;
+    for (const auto &node : nodes_) {
+      num_pending = std::max(num_pending, node.pending.size());
+    }
+    return num_pending;
+  }
+
+ private:
+  struct Node {
+    StateId state;
+    Weight cost;  // Relative to the best hypothesis.
+    // The non-epsilon output labels of the best path to the state which have
+    // not been emitted.
+    std::vector<Label> pending;
+    bool queued;
+  };
+
+  struct Slot {
+    uint64 stamp = 0;
+    int32 node = -1;
+  };
+
+  // Sets up the frontier for the start of the stream.
+  ViterbiStatus Start();
+
+  // Moves the frontier past the next label.
+  ViterbiStatus Advance(Label label, SortedMatcher<Fst<Arc>> *matcher);
+
+  // Returns the node for rule state q among the nodes with the current stamp,
+  // creating it (with cost Zero) if necessary.
+  int32 FindNode(std::vector<Node> *nodes, StateId q);
+
+  // Relaxes the node for q in nodes through node `from` of from_nodes, which
+  // may be the same vector, and an arc with the given output label and
+  // weight. Returns the index of the target node if its cost improved, and -1
+  // otherwise.
+  int32 Relax(const std::vector<Node> &from_nodes, int32 from,
+              std::vector<Node> *nodes, StateId q, Label olabel,
+              const Weight &weight);
+
+  // Computes the epsilon closure of the frontier, then makes the costs
+  // relative to the best one. Returns kUnsupported if the closure does not
+  // converge and kNoPath if the frontier is empty.
+  ViterbiStatus Close();
+
+  // Appends the output the hypotheses agree on, first committing to the best
+  // hypothesis if too much output is pending.
+  template <class Sink>
+  void Emit(Sink *output);
+
+  const Fst<Arc> &rule_;
+  const size_t max_pending_;
+  std::vector<Node> nodes_;
+  std::vector<Node> next_nodes_;
+  std::vector<Slot> slots_;
+  std::vector<int32> queue_;
+  uint64 stamp_;
+  bool started_;
+  ViterbiStatus status_;
+  NaturalLess<Weight> less_;
+};
+
+template <class Arc>
+template <class Iterator, class Sink>
+ViterbiStatus StreamingRewriter<Arc>::Write(Iterator begin, Iterator end,
+                                            Sink *output) {
+  if (status_ != ViterbiStatus::kSuccess) return status_;
+  if (!started_) {
+    started_ = true;
+    if ((status_ = Start()) != ViterbiStatus::kSuccess) return status_;
+    Emit(output);
+  }
+  SortedMatcher<Fst<Arc>> matcher(&rule_, MATCH_INPUT);
+  for (auto it = begin; it != end; ++it) {
+    // Label 0 is epsilon, which composition skips (NUL bytes compile to it).
+    if (*it == 0) continue;
+    if ((status_ = Advance(*it, &matcher)) != ViterbiStatus::kSuccess) {
+      nodes_.clear();
+      return status_;
+    }
+    Emit(output);
+  }
+  return status_;
+}
+
+template <class Arc>
+template <class Sink>
+ViterbiStatus StreamingRewriter<Arc>::Flush(Sink *output) {
+  if (status_ == ViterbiStatus::kSuccess && !started_) status_ = Start();
+  auto status = status_;
+  if (status == ViterbiStatus::kSuccess) {
+    int32 best = -1;
+    auto best_cost = Weight::Zero();
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      const auto cost = Times(nodes_[i].cost, rule_.Final(nodes_[i].state));
+      if (less_(cost, best_cost)) {
+        best = i;
+        best_cost = cost;
+      }
+    }
+    if (best == -1) {
+      status = ViterbiStatus::kNoPath;
+    } else {
+      for (const auto label : nodes_[best].pending) output->push_back(label);
+    }
+  }
+  Reset();
+  return status;
+}
+
+template <class Arc>
+ViterbiStatus StreamingRewriter<Arc>::Start() {
+  if (rule_.Properties(kILabelSorted, false) != kILabelSorted) {
+    return ViterbiStatus::kUnsupported;
+  }
+  nodes_.clear();
+  if (rule_.Start() == kNoStateId) return ViterbiStatus::kNoPath;
+  ++stamp_;
+  const auto start = FindNode(&nodes_, rule_.Start());
+  nodes_[start].cost = Weight::One();
+  return Close();
+}
+
+template <class Arc>
+ViterbiStatus StreamingRewriter<Arc>::Advance(
+    Label label, SortedMatcher<Fst<Arc>> *matcher) {
+  next_nodes_.clear();
+  ++stamp_;
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    matcher->SetState(nodes_[i].state);
+    for (matcher->Find(label); !matcher->Done(); matcher->Next()) {
+      const auto &arc = matcher->Value();
+      Relax(nodes_, i, &next_nodes_, arc.nextstate, arc.olabel, arc.weight);
+    }
+  }
+  nodes_.swap(next_nodes_);
+  return Close();
+}
+
+template <class Arc>
+int32 StreamingRewriter<Arc>::FindNode(std::vector<Node> *nodes, StateId q) {
+  if (q >= static_cast<StateId>(slots_.size())) slots_.resize(q + 1);
+  auto &slot = slots_[q];
+  if (slot.stamp != stamp_) {
+    slot.stamp = stamp_;
+    slot.node = nodes->size();
+    nodes->push_back({q, Weight::Zero(), {}, false});
+  }
+  return slot.node;
+}
+
+template <class Arc>
+int32 StreamingRewriter<Arc>::Relax(const std::vector<Node> &from_nodes,
+                                    int32 from, std::vector<Node> *nodes,
+                                    StateId q, Label olabel,
+                                    const Weight &weight) {
+  // Computes the cost first, since FindNode() may reallocate the nodes.
+  const auto cost = Times(from_nodes[from].cost, weight);
+  const auto to = FindNode(nodes, q);
+  auto &node = (*nodes)[to];
+  if (!less_(cost, node.cost)) return -1;
+  node.cost = cost;
+  // On an epsilon cycle a node may be its own predecessor, in which case the
+  // pending output is already in place.
+  if (&from_nodes != nodes || from != to) {
+    node.pending = from_nodes[from].pending;
+  }
+  if (olabel != 0) node.pending.push_back(olabel);
+  return to;
+}
+
+template <class Arc>
+ViterbiStatus StreamingRewriter<Arc>::Close() {
+  queue_.clear();
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    nodes_[i].queued = true;
+    queue_.push_back(i);
+  }
+  // Bounds the pops as ViterbiRewriter::CloseEpsilons() does.
+  size_t pops = 0;
+  for (size_t head = 0; head < queue_.size(); ++head) {
+    const auto n = nodes_.size();
+    if (++pops > n * n + 1) return ViterbiStatus::kUnsupported;
+    const auto i = queue_[head];
+    nodes_[i].queued = false;
+    for (ArcIterator<Fst<Arc>> aiter(rule_, nodes_[i].state); !aiter.Done();
+         aiter.Next()) {
+      const auto &arc = aiter.Value();
+      if (arc.ilabel != 0) break;
+      const auto to =
+          Relax(nodes_, i, &nodes_, arc.nextstate, arc.olabel, arc.weight);
+      if (to != -1 && !nodes_[to].queued) {
+        nodes_[to].queued = true;
+        queue_.push_back(to);
+      }
+    }
+  }
+  // Drops the nodes no path reached, and makes the costs relative to the best
+  // one so that they stay in range however long the stream.
+  nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(),
+                              [](const Node &node) {
+                                return node.cost == Weight::Zero();
+                              }),
+               nodes_.end());
+  if (nodes_.empty()) return ViterbiStatus::kNoPath;
+  auto best = Weight::Zero();
+  for (const auto &node : nodes_) best = Plus(best, node.cost);
+  for (auto &node : nodes_) node.cost = Divide(node.cost, best);
+  return ViterbiStatus::kSuccess;
+}
+
+template <class Arc>
+template <class Sink>
+void StreamingRewriter<Arc>::Emit(Sink *output) {
+  if (max_pending_ > 0 && NumPending() > max_pending_) {
+    // Commits to the pending output of the best hypothesis, keeping only the
+    // hypotheses which agree with it.
+    size_t best = 0;
+    for (size_t i = 1; i < nodes_.size(); ++i) {
+      if (less_(nodes_[i].cost, nodes_[best].cost)) best = i;
+    }
+    const auto committed = nodes_[best].pending;
+    nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(),
+                                [&committed](const Node &node) {
+                                  return node.pending.size() <
+                                             committed.size() ||
+                                         !std::equal(committed.begin(),
+                                                     committed.end(),
+                                                     node.pending.begin());
+                                }),
+                 nodes_.end());
+    for (auto &node : nodes_) {
+      node.pending.erase(node.pending.begin(),
+                         node.pending.begin() + committed.size());
+    }
+    for (const auto label : committed) output->push_back(label);
+    return;
+  }
+  // Finds the longest common prefix of the pending outputs.
+  const auto &first = nodes_[0].pending;
+  auto common = first.size();
+  for (size_t i = 1; i < nodes_.size() && common > 0; ++i) {
+    const auto &pending = nodes_[i].pending;
+    const auto limit = std::min(common, pending.size());
+    common = std::mismatch(first.begin(), first.begin() + limit,
+                           pending.begin())
+                 .first -
+             first.begin();
+  }
+  if (common == 0) return;
+  for (size_t i = 0; i < common; ++i) output->push_back(first[i]);
+  for (auto &node : nodes_) {
+    node.pending.erase(node.pending.begin(), node.pending.begin() + common);
+  }
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_STREAMING_REWRITE_H_
@@ -0,0 +1,238 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef FST_UTIL_OPERATORS_VITERBI_REWRITE_H_
+#define FST_UTIL_OPERATORS_VITERBI_REWRITE_H_
+
+// Fused composition and shortest path for string inputs.
+//
+// Top-1 rewriting only needs the output of the best path through the
+// composition of the input string with a rule. Instead of building the
+// composition and then searching it, the rewriter keeps, for each position in
+// the input, the best cost of reaching each rule state together with a
+// back-pointer, relaxing epsilon moves of the rule within a position and
+// labeled moves from one position to the next. Nodes live in one flat array
+// which is reused across calls, so steady-state rewriting does not allocate.
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/fst.h>
+#include <fst/matcher.h>
+#include <fst/properties.h>
+#include <fst/weight.h>
+
+namespace fst {
+
+enum class ViterbiStatus {
+  kSuccess,      // Found the best path.
+  kNoPath,       // The rule does not accept the input.
+  kUnsupported,  // The rule cannot be handled; compose instead.
+  kInterrupted,  // The caller asked to stop.
+};
+
+// An instance keeps its scratch space between calls; it is not thread-safe.
+// The weights must have the path property (e.g., tropical weights).
+template <class A>
+class ViterbiRewriter {
+ public:
+  using Arc = A;
+  using Label = typename Arc::Label;
+  using StateId = typename Arc::StateId;
+  using Weight = typename Arc::Weight;
+
+  static_assert(IsPath<Weight>::value, "Weight must have path property");
+
+  ViterbiRewriter() : stamp_(0) {}
+
+  // Finds the best path through the composition of the label string
+  // [begin, end) with the rule, and appends its non-epsilon output labels to
+  // any sink supporting push_back(Label), such as std::vector<Label> or, for
+  // byte output, std::string. Returns kUnsupported if the rule is not known to
+  // be sorted on input labels, or if its epsilon moves form a negative cycle.
+  // Among several best paths, the one chosen may differ from ShortestPath()'s.
+  // Input labels 0 are epsilons and are skipped, as composition does.
+  // If interrupted is given, it is polled once per position of the input, and
+  // if it returns true the search stops with kInterrupted.
+  template <class Iterator, class Sink>
+  ViterbiStatus operator()(const Fst<Arc> &rule, Iterator begin, Iterator end,
+                           Sink *output,
+                           const std::function<bool()> *interrupted = nullptr);
+
+  // The number of lattice nodes visited by the last call.
+  size_t NumNodes() const { return nodes_.size(); }
+
+ private:
+  struct Node {
+    StateId state;
+    int32 back;    // Index of the previous node on the best path, or -1.
+    Label olabel;  // Output label of the arc from the previous node.
+    Weight cost;
+    bool queued;
+  };
+
+  struct Slot {
+    uint64 stamp = 0;
+    int32 node = -1;
+  };
+
+  // Returns the node for rule state q at the position with the given stamp,
+  // creating it (with cost Zero) if necessary.
+  int32 FindNode(uint64 stamp, StateId q);
+
+  // Relaxes the node for (stamp, q) through the node `from` and an arc with
+  // the given output label and weight. Returns the index of the target node
+  // if its cost improved, and -1 otherwise.
+  int32 Relax(int32 from, uint64 stamp, StateId q, Label olabel,
+              const Weight &weight);
+
+  // Computes the epsilon closure of the nodes from `first` on, which all lie
+  // at the position with the given stamp. Returns false if it does not
+  // converge.
+  bool CloseEpsilons(const Fst<Arc> &rule, size_t first, uint64 stamp);
+
+  std::vector<Node> nodes_;
+  // Node indices by rule state for positions with even and odd stamps; each
+  // position receives a fresh stamp, so the tables never need clearing.
+  std::vector<Slot> slots_[2];
+  std::vector<int32> queue_;
+  std::vector<Label> labels_;  // Output labels of the best path, reversed.
+  uint64 stamp_;
+  NaturalLess<Weight> less_;
+};
+
+template <class Arc>
+template <class Iterator, class Sink>
+ViterbiStatus ViterbiRewriter<Arc>::operator()(const Fst<Arc> &rule,
+                                               Iterator begin, Iterator end,
+                                               Sink *output,
+                                               const std::function<bool()>
+                                                   *interrupted) {
+  if (rule.Properties(kILabelSorted, false) != kILabelSorted) {
+    return ViterbiStatus::kUnsupported;
+  }
+  nodes_.clear();
+  if (rule.Start() == kNoStateId) return ViterbiStatus::kNoPath;
+  auto stamp = ++stamp_;
+  const auto start = FindNode(stamp, rule.Start());
+  nodes_[start].cost = Weight::One();
+  SortedMatcher<Fst<Arc>> matcher(&rule, MATCH_INPUT);
+  size_t first = 0;  // The first node at the current position.
+  for (auto it = begin;; ++it) {
+    if (interrupted && (*interrupted)()) return ViterbiStatus::kInterrupted;
+    if (!CloseEpsilons(rule, first, stamp)) return ViterbiStatus::kUnsupported;
+    const size_t last = nodes_.size();
+    if (first == last) return ViterbiStatus::kNoPath;
+    // Composition passes over epsilons in the input without moving the rule,
+    // whereas Find(0) would match the rule's implicit epsilon self-loops.
+    while (it != end && *it == 0) ++it;
+    if (it == end) break;
+    const Label label = *it;
+    const auto next_stamp = ++stamp_;
+    for (auto i = first; i < last; ++i) {
+      matcher.SetState(nodes_[i].state);
+      for (matcher.Find(label); !matcher.Done(); matcher.Next()) {
+        const auto &arc = matcher.Value();
+        Relax(i, next_stamp, arc.nextstate, arc.olabel, arc.weight);
+      }
+    }
+    first = last;
+    stamp = next_stamp;
+  }
+  // Picks the best final node at the last position.
+  int32 best = -1;
+  auto best_cost = Weight::Zero();
+  for (auto i = first; i < nodes_.size(); ++i) {
+    const auto cost = Times(nodes_[i].cost, rule.Final(nodes_[i].state));
+    if (less_(cost, best_cost)) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  if (best == -1) return ViterbiStatus::kNoPath;
+  // Follows the back-pointers, then appends the labels in path order.
+  labels_.clear();
+  for (auto i = best; nodes_[i].back != -1; i = nodes_[i].back) {
+    if (nodes_[i].olabel != 0) labels_.push_back(nodes_[i].olabel);
+  }
+  for (auto rit = labels_.rbegin(); rit != labels_.rend(); ++rit) {
+    output->push_back(*rit);
+  }
+  return ViterbiStatus::kSuccess;
+}
+
+template <class Arc>
+int32 ViterbiRewriter<Arc>::FindNode(uint64 stamp, StateId q) {
+  auto &slots = slots_[stamp % 2];
+  if (q >= static_cast<StateId>(slots.size())) slots.resize(q + 1);
+  auto &slot = slots[q];
+  if (slot.stamp != stamp) {
+    slot.stamp = stamp;
+    slot.node = nodes_.size();
+    nodes_.push_back({q, -1, 0, Weight::Zero(), false});
+  }
+  return slot.node;
+}
+
+template <class Arc>
+int32 ViterbiRewriter<Arc>::Relax(int32 from, uint64 stamp, StateId q,
+                                  Label olabel, const Weight &weight) {
+  // Computes the cost first, since FindNode() may reallocate nodes_.
+  const auto cost = Times(nodes_[from].cost, weight);
+  const auto to = FindNode(stamp, q);
+  auto &node = nodes_[to];
+  if (!less_(cost, node.cost)) return -1;
+  node.cost = cost;
+  node.back = from;
+  node.olabel = olabel;
+  return to;
+}
+
+template <class Arc>
+bool ViterbiRewriter<Arc>::CloseEpsilons(const Fst<Arc> &rule, size_t first,
+                                         uint64 stamp) {
+  queue_.clear();
+  for (auto i = first; i < nodes_.size(); ++i) {
+    nodes_[i].queued = true;
+    queue_.push_back(i);
+  }
+  // A FIFO queue pops each node at most once per round of Bellman-Ford, so
+  // more pops than the square of the number of nodes means a negative cycle.
+  size_t pops = 0;
+  for (size_t head = 0; head < queue_.size(); ++head) {
+    const auto n = nodes_.size() - first;
+    if (++pops > n * n + 1) return false;
+    const auto i = queue_[head];
+    nodes_[i].queued = false;
+    // Epsilons sort first, so we can stop at the first labeled arc.
+    for (ArcIterator<Fst<Arc>> aiter(rule, nodes_[i].state); !aiter.Done();
+         aiter.Next()) {
+      const auto &arc = aiter.Value();
+      if (arc.ilabel != 0) break;
+      const auto to = Relax(i, stamp, arc.nextstate, arc.olabel, arc.weight);
+      if (to != -1 && !nodes_[to].queued) {
+        nodes_[to].queued = true;
+        queue_.push_back(to);
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // FST_UTIL_OPERATORS_VITERBI_REWRITE_H_
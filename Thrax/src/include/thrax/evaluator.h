@@ -36,6 +36,10 @@
 #include <fst/topsort.h>
 #include <fst/vector-fst.h>
 #include <fst/weight.h>
+#include <thrax/algo/cdrewrite.h>
+#include <thrax/algo/flat_dfa.h>
+#include <thrax/algo/optimize.h>
+#include <thrax/algo/state_order.h>
 #include <thrax/collection-node.h>
 #include <thrax/fst-node.h>
 #include <thrax/function-node.h>
@@ -47,9 +51,11 @@
 #include <thrax/rule-node.h>
 #include <thrax/statement-node.h>
 #include <thrax/string-node.h>
+#include <thrax/abstract-grm-manager.h>
 #include <thrax/grm-compiler.h>
 #include <thrax/identifier-counter.h>
 #include <thrax/printer.h>
+#include <thrax/rule-metadata.h>
 #include <thrax/datatype.h>
 #include <thrax/function.h>
 #include <thrax/optimize.h>
@@ -62,18 +68,18 @@
 #include <thrax/compat/stlfunctions.h>
 
 DECLARE_bool(always_export);
+DECLARE_bool(export_rule_metadata);
+DECLARE_bool(export_triggers);
 DECLARE_bool(optimize_all_fsts);
 DECLARE_bool(print_rules);
+DECLARE_bool(reorder_exported_states);
 DECLARE_bool(save_symbols);
+DECLARE_bool(sequentialize_exports);
+DECLARE_int64(sequentialize_max_states);
 DECLARE_string(indir);
 
 namespace thrax {
 
-// The name of the special FST that holds the symbol table of the generated
-// labels. This name should be one disallowed by the variable naming rules
-// (i.e., the user shouldn't be able to create this).
-static const char kStringFstSymtabFst[] = "*StringFstSymbolTable";
-
 // Retrieves a C++ function for the proper arc type. See
 // evaluator-specializations.cc for implementations.
 template <typename Arc>
@@ -269,7 +275,10 @@ class AstEvaluator : public AstWalker {
     for (/* far_reader starts at the beginning */;
          Success() && !far_reader->Done(); far_reader->Next()) {
       const auto& key = far_reader->GetKey();
-      if (key == kStringFstSymtabFst) {
+      if (key == kStringFstSymtabFst || key == kSequentialRulesFst ||
+          key == kRuleMetadataFst ||
+          key.compare(0, std::strlen(kTriggerFstPrefix), kTriggerFstPrefix) ==
+              0) {
         continue;
       } else {
         // Otherwise, we just have a normal exported FST. So we can just add it
@@ -330,8 +339,15 @@ class AstEvaluator : public AstWalker {
       return;
     }
     const std::string& name = identifier->GetIdentifier();
+    last_trigger_.reset();
     node->Get()->Accept(this);
     std::unique_ptr<DataType> thing = GetReturnValue();
+    // Remembers the trigger of top-level rules, so that it can be exported
+    // along with the rule or follow it through aliases.
+    if (last_trigger_ && env_->IsTopLevel() &&
+        env_->LocalEnvironmentDepth() == 1) {
+      rule_triggers_[name] = std::move(last_trigger_);
+    }
     // Inserts the new variable, dying if it clobbers a pre-existing object.
     if (!env_->InsertLocal(name, std::move(thing))) {
       Error(*identifier,
@@ -390,6 +406,11 @@ class AstEvaluator : public AstWalker {
       (*fsts)[kStringFstSymtabFst] = std::move(label_fst);
     }
 
+    // The names of the exported rules which can be applied in a single
+    // deterministic pass.
+    ::fst::SymbolTable sequential_rules(kSequentialRulesFst);
+    // The metadata of the exported rules, one symbol per rule.
+    ::fst::SymbolTable rule_metadata(kRuleMetadataFst);
     // Gets the exported FSTs and add them to the map.
     for (const auto* fst_i : exported_fsts_) {
       const std::string& name = fst_i->Get();
@@ -419,13 +440,64 @@ class AstEvaluator : public AstWalker {
       // reassign those tables, since we may have added generated labels. In the
       // worst case this is a no-op.
       ReassignSymbols(nfst.get());
+      if (FST_FLAGS_sequentialize_exports) {
+        // Only keeps the result if it is actually usable as such.
+        MutableTransducer sequential(*nfst);
+        if (::fst::Sequentialize(&sequential,
+                                 FST_FLAGS_sequentialize_max_states) &&
+            ::fst::FlatDfa<Arc>().Init(sequential)) {
+          VLOG(1) << "Sequentialized FST: " << name;
+          *nfst = sequential;
+        }
+      }
+      // Rules are only listed as sequential, and so flattened on loading,
+      // when asked for, since the flat form is held alongside the rule.
+      const bool sequential =
+          (FST_FLAGS_sequentialize_exports || FST_FLAGS_export_rule_metadata) &&
+          ::fst::FlatDfa<Arc>().Init(*nfst);
+      if (sequential && FST_FLAGS_sequentialize_exports) {
+        sequential_rules.AddSymbol(name);
+      }
       // TopSort to address b/119868645.
       //
       // TODO(rws): The particular example in b/119868645 is evidently fixed by
       // this, but this is not guaranteed to work in general since TopSort is a
       // no-op on cyclic machines.
-      TopSort(nfst.get());
+      //
+      // Breadth-first numbering keeps acyclic machines topologically sorted.
+      if (FST_FLAGS_reorder_exported_states) {
+        ::fst::ReorderStates(nfst.get());
+      } else {
+        TopSort(nfst.get());
+      }
+      if (FST_FLAGS_export_rule_metadata) {
+        rule_metadata.AddSymbol(
+            ComputeRuleMetadata(*nfst, sequential).ToString(name));
+      }
       (*fsts)[name] = std::move(nfst);
+      // Exports the trigger alongside the rule, unless it accepts the empty
+      // string and so fires on every input.
+      const auto it = rule_triggers_.find(name);
+      if (it != rule_triggers_.end()) {
+        const auto& trigger = *it->second;
+        if (trigger.Start() != ::fst::kNoStateId &&
+            trigger.Final(trigger.Start()) == Arc::Weight::Zero()) {
+          (*fsts)[kTriggerFstPrefix + name] =
+              std::make_unique<MutableTransducer>(trigger);
+        }
+      }
+    }
+    // The rules are listed in the input symbol table of a special FST, just
+    // like the generated labels.
+    if (sequential_rules.NumSymbols() > 0) {
+      auto sequential_fst = std::make_unique<MutableTransducer>();
+      sequential_fst->SetInputSymbols(&sequential_rules);
+      (*fsts)[kSequentialRulesFst] = std::move(sequential_fst);
+    }
+    if (rule_metadata.NumSymbols() > 0) {
+      auto metadata_fst = std::make_unique<MutableTransducer>();
+      metadata_fst->SetInputSymbols(&rule_metadata);
+      (*fsts)[kRuleMetadataFst] = std::move(metadata_fst);
     }
   }
 
@@ -448,17 +520,23 @@ class AstEvaluator : public AstWalker {
     return args;
   }
 
-  // Does the same as above, but using a CollectionNode instead.
+  // Does the same as above, but using a CollectionNode instead. If triggers is
+  // provided, it receives the trigger (if any) of each argument.
   std::unique_ptr<std::vector<std::unique_ptr<DataType>>>
-  GetArgumentsFromCollectionNode(CollectionNode* node) {
+  GetArgumentsFromCollectionNode(
+      CollectionNode* node,
+      std::vector<std::shared_ptr<const MutableTransducer>>* triggers =
+          nullptr) {
     auto args = std::make_unique<std::vector<std::unique_ptr<DataType>>>();
     for (int i = 0; i < node->Size(); ++i) {
+      last_trigger_.reset();
       node->Get(i)->Accept(this);
       std::unique_ptr<DataType> return_value = GetReturnValue();
       if (!return_value) {
         return nullptr;
       }
       args->push_back(std::move(return_value));
+      if (triggers) triggers->push_back(std::move(last_trigger_));
     }
     return args;
   }
@@ -533,6 +611,8 @@ class AstEvaluator : public AstWalker {
   // DataType supports).
   std::unique_ptr<DataType> MakeFst(FstNode* node) {
     std::unique_ptr<DataType> output;
+    // The trigger of the output, if known; see CDRewriteTrigger().
+    std::shared_ptr<const MutableTransducer> trigger;
     switch (node->GetType()) {
       case FstNode::CONCAT_FSTNODE: {
         VLOG(2) << "Concat Fst:";
@@ -601,6 +681,11 @@ class AstEvaluator : public AstWalker {
           return nullptr;
         }
         output = original->Copy();
+        if (FST_FLAGS_export_triggers && !identifier->HasNamespaces() &&
+            env_->IsTopLevel() && env_->LocalEnvironmentDepth() == 1) {
+          const auto it = rule_triggers_.find(identifier->GetIdentifier());
+          if (it != rule_triggers_.end()) trigger = it->second;
+        }
         // If we're currently at the top level namespace (i.e., compiling the
         // main body of the primary compilation target), and if the identifier
         // is one without aliases, then we may wish to free the memory if this
@@ -642,8 +727,10 @@ class AstEvaluator : public AstWalker {
         const std::string& name = func_identifier_node->Get();
         VLOG(2) << "Function Call Fst: " << name;
         if (name == "Optimize") optimize_embedding_ = 0;
+        std::vector<std::shared_ptr<const MutableTransducer>> arg_triggers;
         auto args = GetArgumentsFromCollectionNode(
-            fst::down_cast<CollectionNode*>(node->GetArgument(1)));
+            fst::down_cast<CollectionNode*>(node->GetArgument(1)),
+            &arg_triggers);
         if (!Success() || !args) {
           Error(*func_identifier_node,
                 ::fst::StrCat("Unable to bind all arguments for function call: ",
@@ -667,9 +754,25 @@ class AstEvaluator : public AstWalker {
           // If we didn't find a natural function with that name, then we might
           // have a C++ function, provided that the identifier has no
           // namespaces.
+          std::unique_ptr<MutableTransducer> cdrewrite_trigger;
+          if (FST_FLAGS_export_triggers && name == "CDRewrite" &&
+              args->size() >= 4 && (*args)[0]->is<Transducer*>() &&
+              (*args)[3]->is<Transducer*>()) {
+            cdrewrite_trigger = std::make_unique<MutableTransducer>();
+            ::fst::CDRewriteTrigger(**(*args)[0]->get<Transducer*>(),
+                                    **(*args)[3]->get<Transducer*>(),
+                                    cdrewrite_trigger.get());
+          }
           output = MakeFstFromCFunction(func_identifier_node->GetIdentifier(),
                                         *func_identifier_node, std::move(args));
-          if (output) function_found = true;
+          if (output) {
+            function_found = true;
+            if (cdrewrite_trigger) {
+              trigger = std::move(cdrewrite_trigger);
+            } else if (!arg_triggers.empty() && PreservesTrigger(name)) {
+              trigger = arg_triggers[0];
+            }
+          }
         }
         if (!function_found) {
           Error(*func_identifier_node,
@@ -691,6 +794,9 @@ class AstEvaluator : public AstWalker {
     if (output && output->is<Transducer*>()) {
       // First, we can attach the weight if appropriate.
       if (node->HasWeight()) {
+        // The identity mapping now carries a weight, so the trigger no longer
+        // describes the strings left unchanged.
+        trigger.reset();
         Transducer* unweighted_fst = *output->get<Transducer*>();
         auto weighted_fst = AttachWeight(*unweighted_fst, node->GetWeight());
         output = std::make_unique<DataType>(std::move(weighted_fst));
@@ -707,9 +813,19 @@ class AstEvaluator : public AstWalker {
           VLOG(2) << "Optimizing at line " << node->getline();
       }
     }
+    last_trigger_ = std::move(trigger);
     return output;
   }
 
+  // Returns true if the named built-in function preserves the relation of its
+  // first argument, and so also its trigger.
+  static bool PreservesTrigger(const std::string& function_name) {
+    return function_name == "Optimize" || function_name == "ArcSort" ||
+           function_name == "Determinize" || function_name == "Minimize" ||
+           function_name == "RmEpsilon" || function_name == "RmWeight" ||
+           function_name == "Sequentialize";
+  }
+
   // Releasess control of the return_value_ and returns it.
   std::unique_ptr<DataType> GetReturnValue() {
     return std::move(return_value_);
@@ -797,6 +913,12 @@ class AstEvaluator : public AstWalker {
   // these FSTs from the local environment. Note that these pointers are owned
   // by the original AST, not us.
   std::set<IdentifierNode*> exported_fsts_;
+  // With --export_triggers, the triggers of the top-level rules derived from
+  // CDRewrite[], keyed by rule name, and the trigger of the value most recently
+  // returned by MakeFst().
+  std::map<std::string, std::shared_ptr<const MutableTransducer>>
+      rule_triggers_;
+  std::shared_ptr<const MutableTransducer> last_trigger_;
   // A list of grammars that we've opened (and thus need to close at the end).
   // TODO(ttai): This is dangerous right now since if we have two simulatneous
   // compilations within the same process, then they'll be incorrectly sharing
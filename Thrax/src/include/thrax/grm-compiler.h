@@ -37,6 +37,7 @@
 
 DECLARE_bool(print_ast);
 DECLARE_bool(line_numbers_in_ast);
+DECLARE_bool(pack_exports);
 DECLARE_string(indir);
 
 namespace thrax {
@@ -199,6 +200,7 @@ bool GrmCompilerSpec<Arc>::EvaluateAstWithEnvironment(Namespace* env,
     VLOG(1) << "Compilation complete. Expanding exported FSTs.";
     evaluator->GetFsts(grm_manager_.GetFstMap(), top_level);
     grm_manager_.SortRuleInputLabels();
+    if (top_level && FST_FLAGS_pack_exports) grm_manager_.PackRules();
   } else {
     std::cout << "Compilation failed." << std::endl;
     success_ = false;
@@ -0,0 +1,75 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A runtime image holds the rules of a manager as they are once loaded and
+// prepared (see AbstractGrmManager::WriteImage()), so that a server can attach
+// to it without preparing the rules again. The file is laid out as
+//
+//   header: magic number, version, arc type, entry table, checksum
+//   payload: the entries, in the order of the table
+//
+// Each entry of the table gives the name, kind, offset and size of one entry
+// of the payload. FSTs are stored aligned, in a type which can be memory-mapped
+// (ConstFst, or a compact type such as PackedFst), and flat rules in the
+// FlatDfa format. The checksum is the 64-bit FNV-1a hash of the payload.
+
+#ifndef NLP_GRM_LANGUAGE_GRM_IMAGE_H_
+#define NLP_GRM_LANGUAGE_GRM_IMAGE_H_
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fst/types.h>
+
+namespace thrax {
+
+constexpr int32 kGrmImageMagicNumber = 0x494d5247;  // "GRMI".
+constexpr int32 kGrmImageFileVersion = 1;
+
+struct GrmImageEntry {
+  enum Kind : int32 {
+    kFst = 0,
+    kFlatRule = 1,
+  };
+
+  std::string name;
+  int32 kind = kFst;
+  int64 offset = 0;
+  int64 size = 0;
+};
+
+struct GrmImageHeader {
+  std::string arc_type;
+  std::vector<GrmImageEntry> entries;
+  uint64 checksum = 0;
+
+  // Writes the header. Its size only depends on the arc type and the names
+  // of the entries, so that it can be rewritten in place once the offsets,
+  // sizes and checksum are known.
+  bool Write(std::ostream &strm) const;
+
+  // Reads the header, logging and returning false if it is not that of an
+  // image of this version.
+  bool Read(std::istream &strm, const std::string &source);
+};
+
+// Returns the checksum of the bytes of the stream from the offset to its end.
+uint64 GrmImageChecksum(std::istream &strm, int64 offset);
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_GRM_IMAGE_H_
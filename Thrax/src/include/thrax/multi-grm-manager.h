@@ -0,0 +1,340 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The MultiGrmManager holds the FSTs of several FARs in one rule store, each
+// FAR mounted under its own prefix: rule "foo" of the FAR mounted under "base"
+// is named "base/foo", and one mounted under the empty prefix keeps its names
+// as they are. FARs can be mounted and unmounted independently of one another.
+//
+// Each FAR numbers its generated labels (see StringFst) independently, so on
+// mounting, labels whose symbols are already known are mapped to the existing
+// labels and clashing labels are given fresh ones. The merged symbol table is
+// stored under kStringFstSymtabFst, just as for a single FAR. Like SetFst(),
+// mounting and unmounting must not run concurrently with rewriting.
+
+#ifndef NLP_GRM_LANGUAGE_MULTI_GRM_MANAGER_H_
+#define NLP_GRM_LANGUAGE_MULTI_GRM_MANAGER_H_
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/extensions/far/far.h>
+#include <fst/relabel.h>
+#include <fst/symbol-table.h>
+#include <fst/vector-fst.h>
+#include <thrax/algo/packed_fst.h>
+#include <thrax/grm-manager.h>
+#include <thrax/rule-metadata.h>
+
+namespace thrax {
+
+template <typename Arc>
+class MultiGrmManagerSpec : public GrmManagerSpec<Arc> {
+  using Base = GrmManagerSpec<Arc>;
+  using Label = typename Arc::Label;
+  using Transducer = ::fst::Fst<Arc>;
+  using MutableTransducer = ::fst::VectorFst<Arc>;
+
+ public:
+  MultiGrmManagerSpec() : Base() {}
+
+  ~MultiGrmManagerSpec() override {}
+
+  // Loads the FSTs from a FAR under the prefix, preparing them as loading the
+  // FAR on its own would: its rule metadata is kept, and the flags applied on
+  // loading (--normalize_rule_epsilons, --pack_rules, etc.) apply. Returns
+  // false, leaving the store unchanged, if the prefix is already mounted, the
+  // FAR cannot be read, or one of its rules would clash with a rule already
+  // in the store.
+  bool Mount(const std::string &prefix, const std::string &filename);
+
+  // Removes the FSTs mounted under the prefix. Returns false if there are
+  // none. Their generated labels are kept in the merged symbol table.
+  bool Unmount(const std::string &prefix);
+
+  // Replaces everything with the FAR mounted under the empty prefix.
+  bool LoadArchive(const std::string &filename);
+
+  // Returns the full name of a rule. Names already in the store are returned
+  // as they are; otherwise the prefixes are searched in the order in which
+  // they were mounted. Returns the empty string if the rule is not found.
+  std::string ResolveRule(const std::string &name) const;
+
+  // The mounted prefixes, in mount order.
+  std::vector<std::string> Prefixes() const;
+
+  // Returns the full name of a rule mounted under the prefix.
+  static std::string MountedName(const std::string &prefix,
+                                 const std::string &rule) {
+    return prefix.empty() ? rule : prefix + "/" + rule;
+  }
+
+ private:
+  struct MountPoint {
+    std::string prefix;
+    std::vector<std::string> names;  // Including triggers.
+    std::set<std::string> sequential_rules;
+  };
+
+  // Maps the generated labels of the symbol table onto the merged table,
+  // adding any new symbols, and returns the labels which change.
+  std::vector<std::pair<Label, Label>> MergeGeneratedLabels(
+      const ::fst::SymbolTable &generated);
+
+  // Applies the relabeling to the FST and to any symbol tables it carries.
+  static void Relabel(const std::vector<std::pair<Label, Label>> &pairs,
+                      MutableTransducer *fst);
+
+  // Rewrites the merged generated labels and sequential rules FSTs.
+  void UpdateSpecialFsts();
+
+  std::vector<MountPoint> mounts_;
+  ::fst::SymbolTable generated_;
+
+  MultiGrmManagerSpec(const MultiGrmManagerSpec &) = delete;
+  MultiGrmManagerSpec &operator=(const MultiGrmManagerSpec &) = delete;
+};
+
+template <typename Arc>
+bool MultiGrmManagerSpec<Arc>::Mount(const std::string &prefix,
+                                     const std::string &filename) {
+  for (const auto &mount : mounts_) {
+    if (mount.prefix == prefix) {
+      LOG(ERROR) << "Prefix already mounted: " << prefix;
+      return false;
+    }
+  }
+  std::unique_ptr<::fst::FarReader<Arc>> reader(
+      ::fst::STTableFarReader<Arc>::Open(filename));
+  if (!reader) {
+    LOG(ERROR) << "Unable to open FAR: " << filename;
+    return false;
+  }
+  // Reads the whole FAR first, so that a clash leaves the store unchanged.
+  MountPoint mount;
+  mount.prefix = prefix;
+  std::map<std::string, std::unique_ptr<Transducer>> fsts;
+  std::map<std::string, RuleMetadata> metadata;
+  const ::fst::SymbolTable *generated = nullptr;
+  std::unique_ptr<const Transducer> generated_fst;
+  const auto trigger_prefix_size = std::strlen(kTriggerFstPrefix);
+  for (reader->Reset(); !reader->Done(); reader->Next()) {
+    const auto &key = reader->GetKey();
+    if (key == kStringFstSymtabFst) {
+      generated_fst.reset(reader->GetFst()->Copy());
+      generated = generated_fst->InputSymbols();
+    } else if (key == kSequentialRulesFst) {
+      if (const auto *symbols = reader->GetFst()->InputSymbols()) {
+        for (const auto &item : *symbols) {
+          mount.sequential_rules.insert(
+              MountedName(prefix, std::string(item.Symbol())));
+        }
+      }
+    } else if (key == kRuleMetadataFst) {
+      if (const auto *symbols = reader->GetFst()->InputSymbols()) {
+        for (const auto &item : *symbols) {
+          std::string rule;
+          RuleMetadata rule_metadata;
+          if (!RuleMetadata::FromString(std::string(item.Symbol()), &rule,
+                                        &rule_metadata)) {
+            LOG(WARNING) << "Ignoring malformed rule metadata: "
+                         << item.Symbol();
+            continue;
+          }
+          metadata[MountedName(prefix, rule)] = std::move(rule_metadata);
+        }
+      }
+    } else {
+      std::string name;
+      if (key.compare(0, trigger_prefix_size, kTriggerFstPrefix) == 0) {
+        name = kTriggerFstPrefix +
+               MountedName(prefix, key.substr(trigger_prefix_size));
+      } else if (key[0] == '*') {
+        VLOG(1) << "Skipping unknown special FST: " << key;
+        continue;
+      } else {
+        name = MountedName(prefix, key);
+      }
+      if (this->GetFst(name)) {
+        LOG(ERROR) << "Rule " << name << " from " << filename
+                   << " is already in the store";
+        return false;
+      }
+      // As on loading a FAR, packed FSTs stay packed.
+      const auto *fst = reader->GetFst();
+      if (::fst::IsPackedFst(*fst)) {
+        fsts[name] = ::fst::WrapUnique(fst->Copy());
+      } else {
+        fsts[name] = std::make_unique<MutableTransducer>(*fst);
+      }
+    }
+  }
+  if (generated) {
+    const auto pairs = MergeGeneratedLabels(*generated);
+    if (!pairs.empty()) {
+      for (auto &[name, fst] : fsts) {
+        // Relabeling unpacks a packed FST; --pack_rules packs it again.
+        if (::fst::IsPackedFst(*fst)) {
+          fst = std::make_unique<MutableTransducer>(*fst);
+        }
+        auto *relabeled = static_cast<MutableTransducer *>(fst.get());
+        Relabel(pairs, relabeled);
+        // The input alphabet recorded is out of date.
+        const auto it = metadata.find(name);
+        if (it != metadata.end()) {
+          it->second =
+              ComputeRuleMetadata(*relabeled, it->second.sequential);
+        }
+      }
+    }
+  }
+  for (auto &[name, fst] : fsts) {
+    mount.names.push_back(name);
+    this->fsts_[name] = std::move(fst);
+  }
+  // The FSTs are then prepared just as those of a FAR loaded on its own.
+  ::fst::SymbolTable metadata_symbols(kRuleMetadataFst);
+  for (const auto &[name, rule_metadata] : metadata) {
+    metadata_symbols.AddSymbol(rule_metadata.ToString(name));
+  }
+  this->AddRuleMetadata(metadata_symbols);
+  this->PrepareFsts(mount.names, mount.sequential_rules);
+  mounts_.push_back(std::move(mount));
+  UpdateSpecialFsts();
+  return true;
+}
+
+template <typename Arc>
+bool MultiGrmManagerSpec<Arc>::Unmount(const std::string &prefix) {
+  for (auto it = mounts_.begin(); it != mounts_.end(); ++it) {
+    if (it->prefix != prefix) continue;
+    for (const auto &name : it->names) this->RemoveFst(name);
+    mounts_.erase(it);
+    UpdateSpecialFsts();
+    return true;
+  }
+  return false;
+}
+
+template <typename Arc>
+bool MultiGrmManagerSpec<Arc>::LoadArchive(const std::string &filename) {
+  while (!mounts_.empty()) Unmount(mounts_.back().prefix);
+  this->fsts_.clear();
+  generated_ = ::fst::SymbolTable();
+  return Mount("", filename);
+}
+
+template <typename Arc>
+std::string MultiGrmManagerSpec<Arc>::ResolveRule(
+    const std::string &name) const {
+  if (this->GetFst(name)) return name;
+  for (const auto &mount : mounts_) {
+    auto mounted_name = MountedName(mount.prefix, name);
+    if (this->GetFst(mounted_name)) return mounted_name;
+  }
+  return "";
+}
+
+template <typename Arc>
+std::vector<std::string> MultiGrmManagerSpec<Arc>::Prefixes() const {
+  std::vector<std::string> prefixes;
+  for (const auto &mount : mounts_) prefixes.push_back(mount.prefix);
+  return prefixes;
+}
+
+template <typename Arc>
+std::vector<std::pair<typename Arc::Label, typename Arc::Label>>
+MultiGrmManagerSpec<Arc>::MergeGeneratedLabels(
+    const ::fst::SymbolTable &generated) {
+  if (generated_.NumSymbols() == 0) generated_.SetName(generated.Name());
+  std::vector<std::pair<Label, Label>> pairs;
+  // Fresh labels lie above those of both tables, so they cannot clash with a
+  // label of this FAR which has not been mapped yet.
+  auto next_label =
+      std::max(generated_.AvailableKey(), generated.AvailableKey());
+  for (const auto &item : generated) {
+    const std::string symbol(item.Symbol());
+    const auto label = item.Label();
+    auto merged_label = generated_.Find(symbol);
+    if (merged_label == ::fst::kNoSymbol) {
+      merged_label = generated_.Find(label).empty() ? label : next_label++;
+      generated_.AddSymbol(symbol, merged_label);
+    }
+    if (merged_label != label) pairs.emplace_back(label, merged_label);
+  }
+  return pairs;
+}
+
+template <typename Arc>
+void MultiGrmManagerSpec<Arc>::Relabel(
+    const std::vector<std::pair<Label, Label>> &pairs,
+    MutableTransducer *fst) {
+  ::fst::Relabel(fst, pairs, pairs);
+  // Tables saved with --save_symbols also list the generated labels.
+  for (const bool input : {true, false}) {
+    const auto *symbols = input ? fst->InputSymbols() : fst->OutputSymbols();
+    if (!symbols) continue;
+    std::unique_ptr<::fst::SymbolTable> relabeled(symbols->Copy());
+    std::vector<std::pair<std::string, Label>> moved;
+    for (const auto &[from, to] : pairs) {
+      auto symbol = symbols->Find(from);
+      if (symbol.empty()) continue;
+      relabeled->RemoveSymbol(from);
+      moved.emplace_back(std::move(symbol), to);
+    }
+    for (const auto &[symbol, label] : moved) {
+      relabeled->AddSymbol(symbol, label);
+    }
+    if (input) {
+      fst->SetInputSymbols(relabeled.get());
+    } else {
+      fst->SetOutputSymbols(relabeled.get());
+    }
+  }
+}
+
+template <typename Arc>
+void MultiGrmManagerSpec<Arc>::UpdateSpecialFsts() {
+  if (generated_.NumSymbols() > 0) {
+    auto label_fst = std::make_unique<MutableTransducer>();
+    label_fst->SetInputSymbols(&generated_);
+    this->fsts_[kStringFstSymtabFst] = std::move(label_fst);
+  }
+  ::fst::SymbolTable sequential_rules(kSequentialRulesFst);
+  for (const auto &mount : mounts_) {
+    for (const auto &name : mount.sequential_rules) {
+      if (this->GetFlatRule(name)) sequential_rules.AddSymbol(name);
+    }
+  }
+  if (sequential_rules.NumSymbols() > 0) {
+    auto sequential_fst = std::make_unique<MutableTransducer>();
+    sequential_fst->SetInputSymbols(&sequential_rules);
+    this->fsts_[kSequentialRulesFst] = std::move(sequential_fst);
+  } else {
+    this->fsts_.erase(kSequentialRulesFst);
+  }
+}
+
+class MultiGrmManager : public MultiGrmManagerSpec<::fst::StdArc> {};
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_MULTI_GRM_MANAGER_H_
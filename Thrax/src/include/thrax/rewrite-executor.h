@@ -0,0 +1,125 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Support for asynchronous rewriting: the status of a rewrite, a control block
+// through which a caller can cancel a rewrite or give it a deadline, and a
+// fixed pool of worker threads with a bounded queue. When the queue is full,
+// new work is rejected at once rather than left to wait.
+
+#ifndef NLP_GRM_LANGUAGE_REWRITE_EXECUTOR_H_
+#define NLP_GRM_LANGUAGE_REWRITE_EXECUTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace thrax {
+
+enum class RewriteStatus {
+  kOk,                // The rewrite succeeded.
+  kFailed,            // The rule does not accept the input, or is missing.
+  kRejected,          // The executor queue was full.
+  kDeadlineExceeded,  // The deadline passed before the rewrite finished.
+  kCancelled,         // The caller cancelled the rewrite.
+};
+
+struct RewriteResult {
+  RewriteStatus status = RewriteStatus::kFailed;
+  std::string output;
+};
+
+// Lets the caller stop a rewrite early, either explicitly or by a deadline.
+// The rewriting kernels poll it as they advance through the input, and general
+// composition as it expands states; composition with PDTs, and the search for
+// the best path once the composition is built, can only be stopped before they
+// start. Thread-safe.
+class RewriteControl {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit RewriteControl(Clock::time_point deadline = Clock::time_point::max())
+      : deadline_(deadline), cancelled_(false) {}
+
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Returns kOk while the rewrite may continue, and the reason to stop
+  // otherwise.
+  RewriteStatus Check() const {
+    if (cancelled_.load(std::memory_order_relaxed)) {
+      return RewriteStatus::kCancelled;
+    }
+    if (deadline_ != Clock::time_point::max() && Clock::now() >= deadline_) {
+      return RewriteStatus::kDeadlineExceeded;
+    }
+    return RewriteStatus::kOk;
+  }
+
+  bool Interrupted() const { return Check() != RewriteStatus::kOk; }
+
+ private:
+  const Clock::time_point deadline_;
+  std::atomic<bool> cancelled_;
+};
+
+// A fixed pool of threads running tasks from a queue of bounded depth. Tasks
+// which only help a caller through work it does itself anyway go on a second
+// queue of the same depth, so that a large batch cannot crowd out requests.
+// The destructor runs the tasks still queued and then joins the threads. A pool
+// of no threads runs each task on the thread submitting it.
+class RewriteExecutor {
+ public:
+  RewriteExecutor(int num_threads, size_t max_queue_depth);
+
+  ~RewriteExecutor();
+
+  // Queues the task, returning false without running it if the queue is full.
+  // Without threads, runs the task at once instead.
+  bool TrySubmit(std::function<void()> task);
+
+  // Does the same for a helper task, which the threads take before requests.
+  bool TrySubmitHelper(std::function<void()> task);
+
+  int NumThreads() const { return threads_.size(); }
+
+  // The number of requests, not counting helper tasks, waiting for a thread.
+  size_t QueueDepth() const;
+
+ private:
+  bool TrySubmit(std::function<void()> task,
+                 std::deque<std::function<void()>> *queue);
+
+  void Work();
+
+  const size_t max_queue_depth_;
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> queue_;
+  std::deque<std::function<void()>> helper_queue_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+
+  RewriteExecutor(const RewriteExecutor &) = delete;
+  RewriteExecutor &operator=(const RewriteExecutor &) = delete;
+};
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_REWRITE_EXECUTOR_H_
@@ -0,0 +1,109 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Facts about an exported rule which the compiler records in the FAR, so that
+// the runtime can choose how to apply the rule without recomputing them. Each
+// rule's metadata is stored as one symbol of the input symbol table of a
+// special FST (see kRuleMetadataFst), in the form
+//
+//   <rule> TAB <key>=<value> TAB <key>=<value> ...
+//
+// Unknown keys are ignored, so that fields can be added or dropped.
+
+#ifndef NLP_GRM_LANGUAGE_RULE_METADATA_H_
+#define NLP_GRM_LANGUAGE_RULE_METADATA_H_
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/expanded-fst.h>
+#include <fst/fst.h>
+#include <fst/properties.h>
+
+namespace thrax {
+
+struct RuleMetadata {
+  // The properties recorded, each with its negation, so that the runtime can
+  // tell a property which does not hold from one which is merely unknown.
+  // Sorting is left out, as the runtime sorts rules on loading anyway.
+  static constexpr uint64 kRecordedProperties =
+      ::fst::kAcceptor | ::fst::kNotAcceptor | ::fst::kIDeterministic |
+      ::fst::kNonIDeterministic | ::fst::kODeterministic |
+      ::fst::kNonODeterministic | ::fst::kEpsilons | ::fst::kNoEpsilons |
+      ::fst::kIEpsilons | ::fst::kNoIEpsilons | ::fst::kOEpsilons |
+      ::fst::kNoOEpsilons | ::fst::kWeighted | ::fst::kUnweighted |
+      ::fst::kCyclic | ::fst::kAcyclic | ::fst::kString | ::fst::kNotString;
+
+  int64 num_states = 0;
+  int64 num_arcs = 0;
+  uint64 properties = 0;
+  // Whether the rule can be applied in a single deterministic pass, which
+  // also makes it functional.
+  bool sequential = false;
+  // The input labels of the rule other than epsilon, as sorted, disjoint,
+  // closed ranges.
+  std::vector<std::pair<int64, int64>> input_alphabet;
+
+  bool HasProperties(uint64 props) const {
+    return (properties & props) == props;
+  }
+
+  bool HasInputLabel(int64 label) const;
+
+  // Returns the symbol holding the metadata of the named rule.
+  std::string ToString(const std::string &rule) const;
+
+  // Parses a symbol written by ToString(), returning false if it is
+  // malformed.
+  static bool FromString(const std::string &symbol, std::string *rule,
+                         RuleMetadata *metadata);
+};
+
+// Computes the metadata of a rule.
+template <class Arc>
+RuleMetadata ComputeRuleMetadata(const ::fst::ExpandedFst<Arc> &fst,
+                                 bool sequential) {
+  using StateId = typename Arc::StateId;
+  RuleMetadata metadata;
+  metadata.num_states = fst.NumStates();
+  metadata.properties =
+      fst.Properties(RuleMetadata::kRecordedProperties, true);
+  metadata.sequential = sequential;
+  std::set<int64> labels;
+  for (StateId s = 0; s < fst.NumStates(); ++s) {
+    for (::fst::ArcIterator<::fst::ExpandedFst<Arc>> aiter(fst, s);
+         !aiter.Done(); aiter.Next()) {
+      const auto &arc = aiter.Value();
+      ++metadata.num_arcs;
+      if (arc.ilabel != 0) labels.insert(arc.ilabel);
+    }
+  }
+  for (const auto label : labels) {
+    if (!metadata.input_alphabet.empty() &&
+        metadata.input_alphabet.back().second + 1 == label) {
+      metadata.input_alphabet.back().second = label;
+    } else {
+      metadata.input_alphabet.emplace_back(label, label);
+    }
+  }
+  return metadata;
+}
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_RULE_METADATA_H_
@@ -0,0 +1,73 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Visit counts collected from traffic for the rules of a FAR, which passes
+// such as state reordering use to lay out the rules. States are numbered as
+// in the FAR the counts were collected with.
+//
+// The text format has one tab-separated record per line:
+//
+//   state <rule> <state> <count>
+//   arc <rule> <state> <arc> <count>
+//
+// where arcs are identified by their position among the arcs leaving their
+// state, as loaded. Counts for the same state or arc are summed. Blank lines
+// and lines beginning with '#' are ignored.
+
+#ifndef NLP_GRM_LANGUAGE_RULE_PROFILE_H_
+#define NLP_GRM_LANGUAGE_RULE_PROFILE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fst/types.h>
+
+namespace thrax {
+
+class RuleProfile {
+ public:
+  RuleProfile() {}
+
+  void AddStateVisits(const std::string &rule, int64 state, uint64 count = 1);
+
+  void AddArcVisits(const std::string &rule, int64 state, size_t arc,
+                    uint64 count = 1);
+
+  // Returns the visit counts of the states of the rule, indexed by state, or
+  // nullptr if there are none.
+  const std::vector<uint64> *StateVisits(const std::string &rule) const;
+
+  // Returns the visit counts of the arcs of the rule, indexed by state and
+  // arc, or nullptr if there are none.
+  const std::vector<std::vector<uint64>> *ArcVisits(
+      const std::string &rule) const;
+
+  // The rules with counts, in lexicographic order.
+  std::vector<std::string> Rules() const;
+
+  // Adds the counts read from the file. Returns false, logging the line, if
+  // the file cannot be read or is malformed.
+  bool Read(const std::string &filename);
+
+  bool Write(const std::string &filename) const;
+
+ private:
+  std::map<std::string, std::vector<uint64>> state_visits_;
+  std::map<std::string, std::vector<std::vector<uint64>>> arc_visits_;
+};
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_RULE_PROFILE_H_
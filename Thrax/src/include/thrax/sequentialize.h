@@ -0,0 +1,74 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Makes the single FST argument p-subsequential if it is a functional
+// transducer with bounded delay; otherwise, returns it unchanged. Exported
+// rules which end up input-deterministic are recorded as such in the FAR so
+// that they can be applied without composition.
+
+#ifndef THRAX_SEQUENTIALIZE_H_
+#define THRAX_SEQUENTIALIZE_H_
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <fst/compat.h>
+#include <thrax/compat/compat.h>
+#include <fst/vector-fst.h>
+#include <thrax/algo/optimize.h>
+#include <thrax/datatype.h>
+#include <thrax/function.h>
+
+DECLARE_int64(sequentialize_max_states);  // From util/flags.cc.
+
+namespace thrax {
+namespace function {
+
+template <typename Arc>
+class Sequentialize : public UnaryFstFunction<Arc> {
+ public:
+  using Transducer = ::fst::Fst<Arc>;
+  using MutableTransducer = ::fst::VectorFst<Arc>;
+
+  Sequentialize() {}
+  ~Sequentialize() final {}
+
+ protected:
+  std::unique_ptr<Transducer> UnaryFstExecute(
+      const Transducer& fst,
+      const std::vector<std::unique_ptr<DataType>>& args) final {
+    if (args.size() != 1) {
+      std::cout << "Sequentialize: Expected 1 argument but got "
+                << args.size() << std::endl;
+      return nullptr;
+    }
+    auto output = std::make_unique<MutableTransducer>(fst);
+    if (!::fst::Sequentialize(output.get(),
+                              FST_FLAGS_sequentialize_max_states)) {
+      std::cout << "Sequentialize: Transducer cannot be sequentialized; "
+                << "leaving it unchanged" << std::endl;
+    }
+    return output;
+  }
+
+ private:
+  Sequentialize<Arc>(const Sequentialize<Arc>&) = delete;
+  Sequentialize<Arc>& operator=(const Sequentialize<Arc>&) = delete;
+};
+
+}  // namespace function
+}  // namespace thrax
+
+#endif  // THRAX_SEQUENTIALIZE_H_
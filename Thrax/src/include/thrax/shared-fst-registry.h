@@ -0,0 +1,157 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A process-wide index of loaded FSTs by content, through which grammar
+// managers share the storage of identical FSTs, whether they come from the
+// same FAR or from FARs loaded by different managers (e.g., the same
+// verbalizer imported into several locale grammars). Sharing relies on the
+// copy-on-write implementations of the OpenFst types: a copy of an FST refers
+// to the same states and arcs as the original, and the managers never modify
+// the FSTs they hold. Only VectorFsts and ConstFsts are shared, since a copy
+// of any other type (e.g., a CompactFst such as PackedFst) also shares its
+// implementation's arc cache, which threads reading the copies would race
+// to fill.
+
+#ifndef NLP_GRM_LANGUAGE_SHARED_FST_REGISTRY_H_
+#define NLP_GRM_LANGUAGE_SHARED_FST_REGISTRY_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <fst/types.h>
+#include <fst/equal.h>
+#include <fst/fst.h>
+#include <fst/symbol-table.h>
+
+namespace thrax {
+
+// Hashes the type, symbol tables, states and arcs of an FST. FSTs which are
+// identical in the sense of IdenticalFsts() hash alike.
+template <typename Arc>
+uint64 FstContentHash(const ::fst::Fst<Arc>& fst) {
+  uint64 hash = std::hash<std::string>()(fst.Type());
+  const auto combine = [&hash](uint64 value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  };
+  for (const auto* symbols : {fst.InputSymbols(), fst.OutputSymbols()}) {
+    combine(symbols ? std::hash<std::string>()(symbols->LabeledCheckSum())
+                    : 0);
+  }
+  combine(fst.Start());
+  for (::fst::StateIterator<::fst::Fst<Arc>> siter(fst); !siter.Done();
+       siter.Next()) {
+    const auto s = siter.Value();
+    combine(fst.Final(s).Hash());
+    combine(fst.NumArcs(s));
+    for (::fst::ArcIterator<::fst::Fst<Arc>> aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const auto& arc = aiter.Value();
+      combine(arc.ilabel);
+      combine(arc.olabel);
+      combine(arc.weight.Hash());
+      combine(arc.nextstate);
+    }
+  }
+  return hash;
+}
+
+// Returns true if the FSTs have the same type and symbol tables, and the same
+// states and arcs, in the same order and with exactly the same weights, so
+// that either can stand in for the other.
+template <typename Arc>
+bool IdenticalFsts(const ::fst::Fst<Arc>& fst1, const ::fst::Fst<Arc>& fst2) {
+  if (fst1.Type() != fst2.Type()) return false;
+  const auto same_symbols = [](const ::fst::SymbolTable* symbols1,
+                               const ::fst::SymbolTable* symbols2) {
+    if (!symbols1 || !symbols2) return symbols1 == symbols2;
+    return symbols1->LabeledCheckSum() == symbols2->LabeledCheckSum();
+  };
+  return same_symbols(fst1.InputSymbols(), fst2.InputSymbols()) &&
+         same_symbols(fst1.OutputSymbols(), fst2.OutputSymbols()) &&
+         ::fst::Equal(fst1, fst2, /*delta=*/0.0f);
+}
+
+// This class is thread-safe.
+template <typename Arc>
+class SharedFstRegistry {
+ public:
+  using Transducer = ::fst::Fst<Arc>;
+
+  // The registry of the process for this arc type.
+  static SharedFstRegistry* Get() {
+    static auto* const registry = new SharedFstRegistry();
+    return registry;
+  }
+
+  // Whether copies of the FST can stand in for it on any thread.
+  static bool Shareable(const Transducer& fst) {
+    return fst.Type() == "vector" || fst.Type() == "const";
+  }
+
+  // Looks for an FST identical to *fst. If there is one, replaces *fst with a
+  // copy of it, which shares its storage, and returns true. Otherwise
+  // registers *fst and returns false. Either way sets *holder to the
+  // registered FST; an FST stays registered while its holders are alive.
+  // FSTs which are not Shareable() are neither shared nor registered.
+  bool Share(std::unique_ptr<const Transducer>* fst,
+             std::shared_ptr<const Transducer>* holder) {
+    if (!Shareable(**fst)) {
+      holder->reset();
+      return false;
+    }
+    const auto hash = FstContentHash(**fst);
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto range = fsts_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      // Structural comparison, since contents may hash alike by chance.
+      if (IdenticalFsts(*it->second, **fst)) {
+        fst->reset(it->second->Copy());
+        *holder = it->second;
+        return true;
+      }
+    }
+    *holder = std::shared_ptr<const Transducer>((*fst)->Copy());
+    fsts_.emplace(hash, *holder);
+    return false;
+  }
+
+  // Forgets the FSTs which no manager holds any more.
+  void Prune() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = fsts_.begin(); it != fsts_.end();) {
+      if (it->second.use_count() == 1) {
+        it = fsts_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+ private:
+  SharedFstRegistry() {}
+
+  std::mutex mutex_;
+  std::unordered_multimap<uint64, std::shared_ptr<const Transducer>> fsts_;
+
+  SharedFstRegistry(const SharedFstRegistry&) = delete;
+  SharedFstRegistry& operator=(const SharedFstRegistry&) = delete;
+};
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_SHARED_FST_REGISTRY_H_
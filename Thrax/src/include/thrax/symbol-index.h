@@ -0,0 +1,174 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A read-only index of a symbol table for the symbol input and output modes,
+// which look up every token of the input and every label of the output.
+//
+// Symbols are found through a minimal perfect hash built with the "hash,
+// displace" scheme: the symbols are spread over buckets of about four, and
+// each bucket is given a seed under which its symbols hash to distinct free
+// slots of a table with exactly one slot per symbol. A lookup thus hashes the
+// token once, reads one seed, and compares the token to the one symbol stored
+// at its slot. Labels are found through an array indexed by label, or, for
+// tables whose labels are too sparse for one, a sorted array.
+
+#ifndef NLP_GRM_LANGUAGE_SYMBOL_INDEX_H_
+#define NLP_GRM_LANGUAGE_SYMBOL_INDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fst/types.h>
+#include <fst/compat.h>
+#include <fst/mutable-fst.h>
+#include <fst/symbol-table.h>
+#include <fst/util.h>
+
+namespace thrax {
+
+class SymbolIndex {
+ public:
+  // Builds the index of the symbol table, which takes time linear in its size.
+  // Returns nullptr if no perfect hash is found, which only happens if two
+  // symbols have the same 64-bit hash.
+  static std::unique_ptr<SymbolIndex> Build(const ::fst::SymbolTable &symtab);
+
+  // Returns the label of the symbol, or ::fst::kNoSymbol.
+  int64 Find(std::string_view symbol) const {
+    if (entries_.empty()) return ::fst::kNoSymbol;
+    const auto hash = Hash(symbol);
+    const auto &entry =
+        entries_[Slot(hash, seeds_[Bucket(hash, seeds_.size())])];
+    return Text(entry) == symbol ? entry.label : ::fst::kNoSymbol;
+  }
+
+  // Sets the symbol of the label, which remains valid as long as the index.
+  // Returns false if the label has no symbol.
+  bool Find(int64 label, std::string_view *symbol) const {
+    uint32 slot = kNoSlot;
+    if (dense_) {
+      if (label >= 0 && label < static_cast<int64>(slots_.size())) {
+        slot = slots_[label];
+      }
+    } else {
+      slot = SparseSlot(label);
+    }
+    if (slot == kNoSlot) return false;
+    *symbol = Text(entries_[slot]);
+    return true;
+  }
+
+  size_t NumSymbols() const { return entries_.size(); }
+
+  // Returns the memory held by the index.
+  size_t NumBytes() const;
+
+ private:
+  static constexpr uint32 kNoSlot = -1;
+
+  struct Entry {
+    int64 label;
+    uint32 offset;
+    uint32 size;
+  };
+
+  SymbolIndex() {}
+
+  // The 64-bit FNV-1a hash, rather than std::hash, whose width and quality
+  // vary with the platform; Bucket() uses the high bits and Slot() mixes all.
+  static uint64 Hash(std::string_view symbol) {
+    uint64 hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char ch : symbol) hash = (hash ^ ch) * 0x100000001b3ULL;
+    return hash;
+  }
+
+  static size_t Bucket(uint64 hash, size_t num_buckets) {
+    return (hash >> 32) % num_buckets;
+  }
+
+  // The slot of a symbol in a bucket with the given seed, from the
+  // finalizer of SplitMix64.
+  uint32 Slot(uint64 hash, uint32 seed) const {
+    auto x = hash + (seed + 1) * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return (x ^ (x >> 31)) % entries_.size();
+  }
+
+  std::string_view Text(const Entry &entry) const {
+    return std::string_view(pool_.data() + entry.offset, entry.size);
+  }
+
+  uint32 SparseSlot(int64 label) const;
+
+  // Finds a seed for each bucket, the largest buckets first. Returns false if
+  // some bucket has no seed.
+  bool Place(const std::vector<uint64> &hashes);
+
+  // Symbols, by slot.
+  std::vector<Entry> entries_;
+  // Texts of the symbols, stored back to back.
+  std::string pool_;
+  // Seeds, by bucket.
+  std::vector<uint32> seeds_;
+  // If dense_, slots by label; otherwise the labels, sorted, with
+  // sparse_slots_ holding their slots.
+  bool dense_ = true;
+  std::vector<uint32> slots_;
+  std::vector<int64> sparse_labels_;
+  std::vector<uint32> sparse_slots_;
+
+  SymbolIndex(const SymbolIndex &) = delete;
+  SymbolIndex &operator=(const SymbolIndex &) = delete;
+};
+
+// Compiles the tokens of the input, separated by any of the characters of
+// --fst_field_separator, into a string FST as ::fst::StringCompiler does with
+// TokenType::SYMBOL. Returns false if a token is not in the index.
+template <class Arc>
+bool CompileSymbols(const SymbolIndex &index, std::string_view input,
+                    ::fst::MutableFst<Arc> *fst) {
+  fst->DeleteStates();
+  auto s = fst->AddState();
+  fst->SetStart(s);
+  const auto &separators = FST_FLAGS_fst_field_separator;
+  size_t begin = 0;
+  while (begin < input.size()) {
+    const auto end = std::min(input.find_first_of(separators, begin),
+                              input.size());
+    if (end > begin) {
+      const auto token = input.substr(begin, end - begin);
+      const auto label = index.Find(token);
+      if (label == ::fst::kNoSymbol) {
+        LOG(ERROR) << "CompileSymbols: Symbol \"" << token
+                   << "\" is not mapped to any integer label";
+        return false;
+      }
+      const auto nextstate = fst->AddState();
+      fst->AddArc(s, Arc(label, label, nextstate));
+      s = nextstate;
+    }
+    begin = end + 1;
+  }
+  fst->SetFinal(s);
+  return true;
+}
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_SYMBOL_INDEX_H_
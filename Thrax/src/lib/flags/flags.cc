@@ -22,3 +22,43 @@ DEFINE_bool(save_symbols, false,
 
 DEFINE_string(indir, "", "The directory with the source files.");
 DEFINE_string(outdir, "", "The directory in which we'll write the output.");
+
+DEFINE_int64(sequentialize_max_states, 100000,
+             "The number of states after which attempts to sequentialize a "
+             "transducer are abandoned.");
+
+DEFINE_int32(rewrite_threads, 4,
+             "The number of threads serving asynchronous rewrites; with 0, "
+             "they are run on the calling thread.");
+DEFINE_int32(rewrite_queue_depth, 1024,
+             "The number of asynchronous rewrites which may wait for a thread "
+             "before further requests are rejected.");
+DEFINE_int64(parallel_rewrite_min_chunk, 16384,
+             "The fewest bytes of input ParallelRewriteBytes() hands to one "
+             "thread; shorter inputs are rewritten on the calling thread.");
+
+DEFINE_bool(viterbi_rewrites, false,
+            "Rewrite byte strings with rules that are not sequential by a "
+            "fused composition and shortest path search, which does not build "
+            "the lattice. Among several best rewrites, it may choose another "
+            "than composition does.");
+DEFINE_bool(normalize_rule_epsilons, false,
+            "On loading a FAR, remove epsilon transitions from rules where "
+            "this does not make them larger.");
+DEFINE_bool(reorder_rule_states, false,
+            "On loading a FAR, renumber the states of each rule for locality "
+            "of reference.");
+DEFINE_string(rule_state_profile, "",
+              "A file of state visit counts per rule; if set, "
+              "--reorder_rule_states stores the most visited states first.");
+DEFINE_bool(pack_rules, false,
+            "On loading a FAR, store the rules whose labels fit in 16 bits "
+            "and which have at most 256 distinct weights in packed form, "
+            "which takes half the memory.");
+DEFINE_bool(verify_grm_image, true,
+            "Check the checksum of a runtime image before attaching to it, "
+            "which reads the whole image once.");
+DEFINE_bool(share_identical_rules, false,
+            "On loading a FAR, share the storage of VectorFsts and ConstFsts "
+            "identical to ones already loaded, by the same manager or "
+            "another. Worth it when several grammars import the same rules.");
@@ -17,3 +17,6 @@
 DEFINE_bool(always_export, false, "Export all rules (for debugging purposes)");
 DEFINE_bool(print_ast, false, "Whether we print out the AST to stdout");
 DEFINE_bool(line_numbers_in_ast, false, "Print line numbers in AST");
+DEFINE_bool(pack_exports, false,
+            "Export the rules which fit in packed form (see PackedFst), "
+            "halving their size.");
@@ -0,0 +1,95 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thrax/grm-image.h>
+
+#include <utility>
+
+#include <fst/compat.h>
+#include <fst/util.h>
+
+namespace thrax {
+
+bool GrmImageHeader::Write(std::ostream &strm) const {
+  ::fst::WriteType(strm, kGrmImageMagicNumber);
+  ::fst::WriteType(strm, kGrmImageFileVersion);
+  ::fst::WriteType(strm, arc_type);
+  ::fst::WriteType(strm, static_cast<int64>(entries.size()));
+  for (const auto &entry : entries) {
+    ::fst::WriteType(strm, entry.name);
+    ::fst::WriteType(strm, entry.kind);
+    ::fst::WriteType(strm, entry.offset);
+    ::fst::WriteType(strm, entry.size);
+  }
+  ::fst::WriteType(strm, checksum);
+  return !strm.fail();
+}
+
+bool GrmImageHeader::Read(std::istream &strm, const std::string &source) {
+  int32 magic_number = 0;
+  ::fst::ReadType(strm, &magic_number);
+  if (strm.fail() || magic_number != kGrmImageMagicNumber) {
+    LOG(ERROR) << "GrmImageHeader::Read: Bad magic number: " << source;
+    return false;
+  }
+  int32 version = 0;
+  ::fst::ReadType(strm, &version);
+  if (version != kGrmImageFileVersion) {
+    LOG(ERROR) << "GrmImageHeader::Read: Unsupported version " << version
+               << ": " << source;
+    return false;
+  }
+  ::fst::ReadType(strm, &arc_type);
+  int64 num_entries = 0;
+  ::fst::ReadType(strm, &num_entries);
+  if (strm.fail() || num_entries < 0) {
+    LOG(ERROR) << "GrmImageHeader::Read: Bad entry table: " << source;
+    return false;
+  }
+  entries.clear();
+  for (int64 i = 0; i < num_entries && !strm.fail(); ++i) {
+    GrmImageEntry entry;
+    ::fst::ReadType(strm, &entry.name);
+    ::fst::ReadType(strm, &entry.kind);
+    ::fst::ReadType(strm, &entry.offset);
+    ::fst::ReadType(strm, &entry.size);
+    entries.push_back(std::move(entry));
+  }
+  ::fst::ReadType(strm, &checksum);
+  if (strm.fail()) {
+    LOG(ERROR) << "GrmImageHeader::Read: Truncated header: " << source;
+    return false;
+  }
+  return true;
+}
+
+uint64 GrmImageChecksum(std::istream &strm, int64 offset) {
+  static constexpr uint64 kOffsetBasis = 0xcbf29ce484222325ULL;
+  static constexpr uint64 kPrime = 0x100000001b3ULL;
+  strm.clear();
+  strm.seekg(offset);
+  uint64 hash = kOffsetBasis;
+  std::vector<char> buffer(1 << 20);
+  while (strm) {
+    strm.read(buffer.data(), buffer.size());
+    const auto count = strm.gcount();
+    for (std::streamsize i = 0; i < count; ++i) {
+      hash = (hash ^ static_cast<unsigned char>(buffer[i])) * kPrime;
+    }
+  }
+  strm.clear();
+  return hash;
+}
+
+}  // namespace thrax
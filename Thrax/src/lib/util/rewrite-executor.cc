@@ -0,0 +1,88 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thrax/rewrite-executor.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace thrax {
+
+RewriteExecutor::RewriteExecutor(int num_threads, size_t max_queue_depth)
+    : max_queue_depth_(std::max<size_t>(max_queue_depth, 1)),
+      stopping_(false) {
+  num_threads = std::max(num_threads, 0);
+  threads_.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { Work(); });
+  }
+}
+
+RewriteExecutor::~RewriteExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto &thread : threads_) thread.join();
+}
+
+bool RewriteExecutor::TrySubmit(std::function<void()> task) {
+  return TrySubmit(std::move(task), &queue_);
+}
+
+bool RewriteExecutor::TrySubmitHelper(std::function<void()> task) {
+  return TrySubmit(std::move(task), &helper_queue_);
+}
+
+bool RewriteExecutor::TrySubmit(std::function<void()> task,
+                                std::deque<std::function<void()>> *queue) {
+  if (threads_.empty()) {
+    task();
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || queue->size() >= max_queue_depth_) return false;
+    queue->push_back(std::move(task));
+  }
+  ready_.notify_one();
+  return true;
+}
+
+size_t RewriteExecutor::QueueDepth() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void RewriteExecutor::Work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this] {
+        return stopping_ || !queue_.empty() || !helper_queue_.empty();
+      });
+      // A helper task speeds up a caller which is waiting for it, and returns
+      // at once if the caller has finished the work.
+      auto &queue = helper_queue_.empty() ? queue_ : helper_queue_;
+      if (queue.empty()) return;
+      task = std::move(queue.front());
+      queue.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace thrax
@@ -0,0 +1,119 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thrax/rule-metadata.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+
+namespace thrax {
+namespace {
+
+// Splits the string at the separator.
+std::vector<std::string> Split(const std::string &s, char separator) {
+  std::vector<std::string> fields;
+  size_t begin = 0;
+  for (auto end = s.find(separator); end != std::string::npos;
+       end = s.find(separator, begin)) {
+    fields.push_back(s.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  fields.push_back(s.substr(begin));
+  return fields;
+}
+
+// Parses a whole string as an integer in the given base.
+bool ParseInt(const std::string &s, int base, int64 *value) {
+  if (s.empty()) return false;
+  char *end;
+  errno = 0;
+  *value = std::strtoll(s.c_str(), &end, base);
+  return errno == 0 && *end == '\0';
+}
+
+}  // namespace
+
+bool RuleMetadata::HasInputLabel(int64 label) const {
+  const auto it = std::upper_bound(
+      input_alphabet.begin(), input_alphabet.end(), label,
+      [](int64 label, const std::pair<int64, int64> &range) {
+        return label < range.first;
+      });
+  return it != input_alphabet.begin() && label <= std::prev(it)->second;
+}
+
+std::string RuleMetadata::ToString(const std::string &rule) const {
+  std::ostringstream strm;
+  strm << rule << "\tstates=" << num_states << "\tarcs=" << num_arcs
+       << "\tproperties=" << std::hex << properties << std::dec
+       << "\tsequential=" << sequential << "\talphabet=";
+  for (size_t i = 0; i < input_alphabet.size(); ++i) {
+    if (i > 0) strm << ",";
+    strm << input_alphabet[i].first;
+    if (input_alphabet[i].second != input_alphabet[i].first) {
+      strm << "-" << input_alphabet[i].second;
+    }
+  }
+  return strm.str();
+}
+
+bool RuleMetadata::FromString(const std::string &symbol, std::string *rule,
+                              RuleMetadata *metadata) {
+  const auto fields = Split(symbol, '\t');
+  if (fields[0].empty()) return false;
+  *rule = fields[0];
+  *metadata = RuleMetadata();
+  for (size_t i = 1; i < fields.size(); ++i) {
+    const auto pos = fields[i].find('=');
+    if (pos == std::string::npos) return false;
+    const auto key = fields[i].substr(0, pos);
+    const auto value = fields[i].substr(pos + 1);
+    int64 number = 0;
+    if (key == "alphabet") {
+      if (value.empty()) continue;
+      for (const auto &range : Split(value, ',')) {
+        // Labels are non-negative, so a dash can only separate them.
+        const auto dash = range.find('-');
+        int64 first;
+        int64 last;
+        if (dash == std::string::npos) {
+          if (!ParseInt(range, 10, &first)) return false;
+          last = first;
+        } else if (!ParseInt(range.substr(0, dash), 10, &first) ||
+                   !ParseInt(range.substr(dash + 1), 10, &last)) {
+          return false;
+        }
+        metadata->input_alphabet.emplace_back(first, last);
+      }
+    } else if (key == "properties") {
+      if (!ParseInt(value, 16, &number)) return false;
+      metadata->properties = number;
+    } else if (key == "states" || key == "arcs" || key == "sequential") {
+      if (!ParseInt(value, 10, &number)) return false;
+      if (key == "states") {
+        metadata->num_states = number;
+      } else if (key == "arcs") {
+        metadata->num_arcs = number;
+      } else {
+        metadata->sequential = number != 0;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace thrax
@@ -0,0 +1,143 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thrax/rule-profile.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <set>
+
+#include <fst/compat.h>
+
+namespace thrax {
+namespace {
+
+// Parses a non-negative decimal integer, rejecting anything else.
+bool ParseCount(const std::string &field, uint64 *value) {
+  if (field.empty() || field.find_first_not_of("0123456789") !=
+                           std::string::npos) {
+    return false;
+  }
+  *value = std::strtoull(field.c_str(), nullptr, 10);
+  return true;
+}
+
+// Splits the line at tabs.
+std::vector<std::string> SplitFields(const std::string &line) {
+  std::vector<std::string> fields;
+  size_t begin = 0;
+  for (auto end = line.find('\t'); end != std::string::npos;
+       end = line.find('\t', begin)) {
+    fields.push_back(line.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  fields.push_back(line.substr(begin));
+  return fields;
+}
+
+}  // namespace
+
+void RuleProfile::AddStateVisits(const std::string &rule, int64 state,
+                                 uint64 count) {
+  if (state < 0) return;
+  auto &visits = state_visits_[rule];
+  if (visits.size() <= static_cast<uint64>(state)) {
+    visits.resize(state + 1, 0);
+  }
+  visits[state] += count;
+}
+
+void RuleProfile::AddArcVisits(const std::string &rule, int64 state,
+                               size_t arc, uint64 count) {
+  if (state < 0) return;
+  auto &visits = arc_visits_[rule];
+  if (visits.size() <= static_cast<uint64>(state)) visits.resize(state + 1);
+  auto &state_visits = visits[state];
+  if (state_visits.size() <= arc) state_visits.resize(arc + 1, 0);
+  state_visits[arc] += count;
+}
+
+const std::vector<uint64> *RuleProfile::StateVisits(
+    const std::string &rule) const {
+  const auto it = state_visits_.find(rule);
+  return it == state_visits_.end() ? nullptr : &it->second;
+}
+
+const std::vector<std::vector<uint64>> *RuleProfile::ArcVisits(
+    const std::string &rule) const {
+  const auto it = arc_visits_.find(rule);
+  return it == arc_visits_.end() ? nullptr : &it->second;
+}
+
+std::vector<std::string> RuleProfile::Rules() const {
+  std::set<std::string> rules;
+  for (const auto &[rule, visits] : state_visits_) rules.insert(rule);
+  for (const auto &[rule, visits] : arc_visits_) rules.insert(rule);
+  return std::vector<std::string>(rules.begin(), rules.end());
+}
+
+bool RuleProfile::Read(const std::string &filename) {
+  std::ifstream istrm(filename);
+  if (!istrm) {
+    LOG(ERROR) << "Unable to open profile: " << filename;
+    return false;
+  }
+  std::string line;
+  for (int linenum = 1; std::getline(istrm, line); ++linenum) {
+    if (line.empty() || line[0] == '#') continue;
+    const auto fields = SplitFields(line);
+    uint64 state;
+    uint64 arc;
+    uint64 count;
+    if (fields.size() == 4 && fields[0] == "state" &&
+        ParseCount(fields[2], &state) && ParseCount(fields[3], &count)) {
+      AddStateVisits(fields[1], state, count);
+    } else if (fields.size() == 5 && fields[0] == "arc" &&
+               ParseCount(fields[2], &state) && ParseCount(fields[3], &arc) &&
+               ParseCount(fields[4], &count)) {
+      AddArcVisits(fields[1], state, arc, count);
+    } else {
+      LOG(ERROR) << "Malformed profile line " << filename << ":" << linenum
+                 << ": " << line;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RuleProfile::Write(const std::string &filename) const {
+  std::ofstream ostrm(filename);
+  if (!ostrm) {
+    LOG(ERROR) << "Unable to write profile: " << filename;
+    return false;
+  }
+  for (const auto &[rule, visits] : state_visits_) {
+    for (size_t s = 0; s < visits.size(); ++s) {
+      if (visits[s] == 0) continue;
+      ostrm << "state\t" << rule << "\t" << s << "\t" << visits[s] << "\n";
+    }
+  }
+  for (const auto &[rule, visits] : arc_visits_) {
+    for (size_t s = 0; s < visits.size(); ++s) {
+      for (size_t a = 0; a < visits[s].size(); ++a) {
+        if (visits[s][a] == 0) continue;
+        ostrm << "arc\t" << rule << "\t" << s << "\t" << a << "\t"
+              << visits[s][a] << "\n";
+      }
+    }
+  }
+  return static_cast<bool>(ostrm);
+}
+
+}  // namespace thrax
@@ -0,0 +1,137 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thrax/symbol-index.h>
+
+#include <numeric>
+
+namespace thrax {
+namespace {
+
+// Symbols per bucket, on average.
+constexpr size_t kBucketSize = 4;
+
+// Seeds tried for a bucket before giving up. With buckets of about four
+// symbols, the last buckets placed need a few thousand tries at most.
+constexpr uint32 kMaxSeed = 1 << 24;
+
+}  // namespace
+
+std::unique_ptr<SymbolIndex> SymbolIndex::Build(
+    const ::fst::SymbolTable &symtab) {
+  auto index = fst::WrapUnique(new SymbolIndex());
+  std::vector<uint64> hashes;
+  int64 max_label = -1;
+  for (const auto &item : symtab) {
+    const auto symbol = item.Symbol();
+    index->entries_.push_back({item.Label(),
+                               static_cast<uint32>(index->pool_.size()),
+                               static_cast<uint32>(symbol.size())});
+    index->pool_.append(symbol.data(), symbol.size());
+    hashes.push_back(Hash(symbol));
+    if (item.Label() < 0) index->dense_ = false;
+    max_label = std::max(max_label, item.Label());
+  }
+  if (index->entries_.empty()) return index;
+  if (!index->Place(hashes)) {
+    LOG(ERROR) << "SymbolIndex::Build: No perfect hash found for symbol table "
+               << symtab.Name();
+    return nullptr;
+  }
+  const auto num_symbols = index->entries_.size();
+  // Labels are mostly numbered from zero up, but a table with a few huge
+  // labels would make the array indexed by label too large.
+  if (max_label >= static_cast<int64>(2 * num_symbols + 1024)) {
+    index->dense_ = false;
+  }
+  if (index->dense_) {
+    index->slots_.assign(max_label + 1, kNoSlot);
+    for (uint32 slot = 0; slot < num_symbols; ++slot) {
+      index->slots_[index->entries_[slot].label] = slot;
+    }
+  } else {
+    std::vector<uint32> order(num_symbols);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&index](uint32 i, uint32 j) {
+      return index->entries_[i].label < index->entries_[j].label;
+    });
+    for (const auto slot : order) {
+      index->sparse_labels_.push_back(index->entries_[slot].label);
+      index->sparse_slots_.push_back(slot);
+    }
+  }
+  return index;
+}
+
+bool SymbolIndex::Place(const std::vector<uint64> &hashes) {
+  const auto num_symbols = entries_.size();
+  const auto num_buckets = (num_symbols + kBucketSize - 1) / kBucketSize;
+  seeds_.assign(num_buckets, 0);
+  std::vector<std::vector<uint32>> buckets(num_buckets);
+  for (uint32 i = 0; i < num_symbols; ++i) {
+    buckets[Bucket(hashes[i], num_buckets)].push_back(i);
+  }
+  std::vector<uint32> order(num_buckets);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&buckets](uint32 i, uint32 j) {
+    return buckets[i].size() > buckets[j].size();
+  });
+  std::vector<Entry> entries(num_symbols);
+  std::vector<bool> taken(num_symbols, false);
+  std::vector<uint32> slots;
+  for (const auto bucket : order) {
+    const auto &symbols = buckets[bucket];
+    if (symbols.empty()) break;
+    uint32 seed = 0;
+    for (; seed < kMaxSeed; ++seed) {
+      slots.clear();
+      bool placed = true;
+      for (const auto i : symbols) {
+        const auto slot = Slot(hashes[i], seed);
+        if (taken[slot] ||
+            std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+          placed = false;
+          break;
+        }
+        slots.push_back(slot);
+      }
+      if (placed) break;
+    }
+    if (seed == kMaxSeed) return false;
+    seeds_[bucket] = seed;
+    for (size_t k = 0; k < symbols.size(); ++k) {
+      taken[slots[k]] = true;
+      entries[slots[k]] = entries_[symbols[k]];
+    }
+  }
+  entries_.swap(entries);
+  return true;
+}
+
+uint32 SymbolIndex::SparseSlot(int64 label) const {
+  const auto it =
+      std::lower_bound(sparse_labels_.begin(), sparse_labels_.end(), label);
+  if (it == sparse_labels_.end() || *it != label) return kNoSlot;
+  return sparse_slots_[it - sparse_labels_.begin()];
+}
+
+size_t SymbolIndex::NumBytes() const {
+  return sizeof(*this) + entries_.capacity() * sizeof(Entry) +
+         pool_.capacity() + seeds_.capacity() * sizeof(uint32) +
+         slots_.capacity() * sizeof(uint32) +
+         sparse_labels_.capacity() * sizeof(int64) +
+         sparse_slots_.capacity() * sizeof(uint32);
+}
+
+}  // namespace thrax
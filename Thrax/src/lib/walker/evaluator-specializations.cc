@@ -25,6 +25,23 @@ DEFINE_bool(optimize_all_fsts, false,
             "If true, we'll run Optimize[] on all FSTs.");
 DEFINE_bool(print_rules, true,
             "If true, we'll print out the rules as we evaluate them.");
+DEFINE_bool(export_rule_metadata, false,
+            "If true, we'll record the properties, input alphabet and size of "
+            "each exported rule in the FAR, in an extra special FST, so that "
+            "the runtime need not compute them.");
+DEFINE_bool(export_triggers, false,
+            "If true, we'll export a trigger acceptor alongside each exported "
+            "rule derived from CDRewrite[], which lets the runtime pass through "
+            "inputs the rule cannot change without composing.");
+DEFINE_bool(sequentialize_exports, false,
+            "If true, we'll try to make each exported transducer "
+            "p-subsequential, keeping the result if it can then be applied in "
+            "a single deterministic pass, and list the rules which can be so "
+            "applied in the FAR, so that the runtime flattens them.");
+DEFINE_bool(reorder_exported_states, true,
+            "If true, we'll number the states of each exported FST in "
+            "breadth-first order from the start state, for locality of "
+            "reference; acyclic FSTs stay topologically sorted.");
 
 namespace thrax {
 
@@ -38,6 +38,7 @@
 #include <thrax/rewrite.h>
 #include <thrax/rmepsilon.h>
 #include <thrax/rmweight.h>
+#include <thrax/sequentialize.h>
 #include <thrax/stringfile.h>
 #include <thrax/stringfst.h>
 #include <thrax/symboltable.h>
@@ -83,6 +84,7 @@ void RegisterFunctions() {
   REGISTER_GRM_FUNCTION(Rewrite);
   REGISTER_GRM_FUNCTION(RmEpsilon);
   REGISTER_GRM_FUNCTION(RmWeight);
+  REGISTER_GRM_FUNCTION(Sequentialize);
   REGISTER_GRM_FUNCTION(StringFile);
   REGISTER_GRM_FUNCTION(StringFst);
   REGISTER_GRM_FUNCTION(SymbolTable);
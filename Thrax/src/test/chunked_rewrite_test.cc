@@ -0,0 +1,160 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/chunked_rewrite.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(sequentialize_exports);
+DECLARE_int32(rewrite_threads);
+DECLARE_int64(parallel_rewrite_min_chunk);
+
+namespace thrax {
+namespace {
+
+using ::fst::ChunkedDfaRewriter;
+using ::fst::StdArc;
+using ::fst::TropicalWeight;
+
+constexpr char kRules[][16] = {"delete_ab", "insert", "weighted"};
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export delete_ab = CDRewrite["ab" : "", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = (("a" : "ba") <1.0> | "b" <2.0> | ("c" : "") <0.5> |
+                   "d")*;
+)";
+
+class ChunkedRewriteTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    FST_FLAGS_sequentialize_exports = true;
+    grm_ = LoadTestGrammar(kGrammar, "chunked_rewrite_test").release();
+    FST_FLAGS_sequentialize_exports = false;
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *ChunkedRewriteTest::grm_ = nullptr;
+
+// Short inputs, all of them, and long random ones, some with bytes which
+// the rules reject and NUL bytes, which composition skips.
+std::vector<std::string> TestInputs() {
+  auto inputs = AllStrings("abcd", 5);
+  std::mt19937 rng(0);
+  for (const auto &letters : {std::string("abcd"), std::string("abcd\0", 5),
+                              std::string("abcde")}) {
+    for (int i = 0; i < 50; ++i) {
+      std::string input(std::uniform_int_distribution<int>(20, 200)(rng), ' ');
+      for (auto &ch : input) {
+        ch = letters[std::uniform_int_distribution<size_t>(
+            0, letters.size() - 1)(rng)];
+      }
+      inputs.push_back(input);
+    }
+  }
+  return inputs;
+}
+
+// Rewrites the input with the chunked rewriter, as ParallelRewriteBytes()
+// does but on one thread.
+bool ChunkedRewriteBytes(const ChunkedDfaRewriter<StdArc> &rewriter,
+                         const std::string &input, size_t num_chunks,
+                         std::string *output, TropicalWeight *weight) {
+  output->clear();
+  const auto *begin = reinterpret_cast<const unsigned char *>(input.data());
+  const auto chunks =
+      rewriter.Split(begin, begin + input.size(), num_chunks);
+  std::vector<std::vector<ChunkedDfaRewriter<StdArc>::Run>> runs;
+  for (const auto &chunk : chunks) {
+    runs.push_back(rewriter.RewriteChunk(chunk, begin));
+  }
+  return rewriter.Stitch(runs, output, weight);
+}
+
+TEST_F(ChunkedRewriteTest, MatchesComposition) {
+  ASSERT_NE(grm_, nullptr);
+  const auto inputs = TestInputs();
+  for (const auto *rule : kRules) {
+    const auto *flat = grm_->GetFlatRule(rule);
+    ASSERT_NE(flat, nullptr) << rule << " was not flattened";
+    // Short lookbehinds leave more candidates, and long ones fewer.
+    for (const size_t lookbehind : {1, 2, 16}) {
+      const ChunkedDfaRewriter<StdArc> rewriter(*flat, lookbehind);
+      for (const auto &input : inputs) {
+        std::string expected;
+        TropicalWeight expected_weight;
+        const bool accepted = ReferenceRewriteBytes(
+            *grm_->GetFst(rule), input, &expected, &expected_weight);
+        for (const size_t num_chunks : {1, 3, 8}) {
+          std::string output;
+          TropicalWeight weight;
+          ASSERT_EQ(accepted, ChunkedRewriteBytes(rewriter, input, num_chunks,
+                                                  &output, &weight))
+              << rule << " on \"" << input << "\" in " << num_chunks
+              << " chunks";
+          if (!accepted) continue;
+          EXPECT_EQ(expected, output)
+              << rule << " on \"" << input << "\" in " << num_chunks
+              << " chunks";
+          EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight));
+        }
+      }
+    }
+  }
+}
+
+TEST_F(ChunkedRewriteTest, ParallelRewriteBytesMatchesRewriteBytes) {
+  ASSERT_NE(grm_, nullptr);
+  const auto threads = FST_FLAGS_rewrite_threads;
+  const auto min_chunk = FST_FLAGS_parallel_rewrite_min_chunk;
+  FST_FLAGS_rewrite_threads = 3;
+  FST_FLAGS_parallel_rewrite_min_chunk = 8;
+  for (const auto *rule : kRules) {
+    for (const auto &input : TestInputs()) {
+      std::string expected;
+      const bool accepted =
+          ReferenceRewriteBytes(*grm_->GetFst(rule), input, &expected);
+      std::string output;
+      ASSERT_EQ(accepted, grm_->RewriteBytes(rule, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (accepted) EXPECT_EQ(expected, output);
+      std::string parallel_output;
+      ASSERT_EQ(accepted,
+                grm_->ParallelRewriteBytes(rule, input, &parallel_output))
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, parallel_output)
+            << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+  FST_FLAGS_rewrite_threads = threads;
+  FST_FLAGS_parallel_rewrite_min_chunk = min_chunk;
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,69 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Runs the C++ generated by thraxcodegen from testdata/codegen.grm (see the
+// codegen_test_rules genrule) and checks it against composition with the rules
+// in the FAR it was generated from.
+
+#include <string>
+#include <string_view>
+
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "codegen_test_rules.h"
+#include "rewrite-test-util.h"
+
+namespace thrax {
+namespace {
+
+using GeneratedRule = bool (*)(std::string_view, std::string *);
+
+void ExpectGeneratedRuleAgrees(const std::string &rule,
+                               GeneratedRule generated) {
+  GrmManager grm;
+  ASSERT_TRUE(grm.LoadArchive("codegen_test.far"));
+  const auto *fst = grm.GetFst(rule);
+  ASSERT_NE(fst, nullptr);
+  auto inputs = AllStrings("abcdef", 4);
+  inputs.push_back(std::string("a\0b", 3));
+  for (const auto &input : inputs) {
+    std::string expected;
+    const bool accepted = ReferenceRewriteBytes(*fst, input, &expected);
+    std::string output;
+    ASSERT_EQ(accepted, generated(input, &output))
+        << rule << " on \"" << input << "\"";
+    if (accepted) {
+      EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+    }
+  }
+}
+
+TEST(CodegenTest, Expand) {
+  ExpectGeneratedRuleAgrees("expand", codegen_test::expand);
+}
+
+TEST(CodegenTest, DeleteAb) {
+  ExpectGeneratedRuleAgrees("delete_ab", codegen_test::delete_ab);
+}
+
+TEST(CodegenTest, Upper) {
+  ExpectGeneratedRuleAgrees("upper", codegen_test::upper);
+}
+
+TEST(CodegenTest, Shift) {
+  ExpectGeneratedRuleAgrees("shift", codegen_test::shift);
+}
+
+}  // namespace
+}  // namespace thrax
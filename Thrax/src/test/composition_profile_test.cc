@@ -0,0 +1,289 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/composition_profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "thrax/rule-profile.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(reorder_rule_states);
+DECLARE_string(rule_state_profile);
+
+namespace thrax {
+namespace {
+
+using ::fst::CompositionProfiler;
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+)";
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "weighted"};
+
+// Returns the count, which is zero past the end of the vectors.
+uint64 Count(const std::vector<uint64> &visits, size_t s) {
+  return s < visits.size() ? visits[s] : 0;
+}
+
+uint64 Count(const std::vector<std::vector<uint64>> &visits, size_t s,
+             size_t a) {
+  return s < visits.size() ? Count(visits[s], a) : 0;
+}
+
+// A rule with an epsilon arc, two arcs on the same label, and an arc never
+// followed. The arcs are added in input label order.
+StdVectorFst HandBuiltRule() {
+  StdVectorFst fst;
+  for (int s = 0; s < 4; ++s) fst.AddState();
+  fst.SetStart(0);
+  fst.AddArc(0, StdArc(0, 0, 0));        // 0/0: epsilon to 2.
+  fst.AddArc(0, StdArc('a', 'a', 1));    // 0/1.
+  fst.AddArc(0, StdArc('b', 'b', 0));    // 0/2: back to 0.
+  fst.AddArc(1, StdArc('b', 'x', 3));    // 1/0.
+  fst.AddArc(1, StdArc('b', 'b', 1));    // 1/1: back to 1.
+  fst.AddArc(2, StdArc('a', 'y', 1));    // 2/0.
+  fst.AddArc(2, StdArc('c', 'c', 3));    // 2/1.
+  fst.SetFinal(3);
+  return fst;
+}
+
+std::vector<StdArc::Label> Labels(const std::string &input) {
+  return std::vector<StdArc::Label>(input.begin(), input.end());
+}
+
+TEST(CompositionProfilerTest, CountsVisits) {
+  const auto fst = HandBuiltRule();
+  ASSERT_EQ(::fst::kILabelSorted,
+            fst.Properties(::fst::kILabelSorted, false));
+  CompositionProfiler<StdArc> profiler(fst);
+  // 1 is reached from 0 and from 2 at the same position, but is counted once
+  // there; it is counted again at the next position, through its loop.
+  const auto ab = Labels("ab");
+  ASSERT_TRUE(profiler(ab.begin(), ab.end()));
+  EXPECT_EQ((std::vector<uint64>{1, 2, 1, 1}), profiler.StateVisits());
+  const auto &arc_visits = profiler.ArcVisits();
+  EXPECT_EQ(1u, Count(arc_visits, 0, 0));
+  EXPECT_EQ(1u, Count(arc_visits, 0, 1));
+  EXPECT_EQ(0u, Count(arc_visits, 0, 2));
+  EXPECT_EQ(1u, Count(arc_visits, 1, 0));
+  EXPECT_EQ(1u, Count(arc_visits, 1, 1));
+  EXPECT_EQ(1u, Count(arc_visits, 2, 0));
+  EXPECT_EQ(0u, Count(arc_visits, 2, 1));
+  // The counts accumulate; dead ends are counted too.
+  const auto c = Labels("c");
+  ASSERT_TRUE(profiler(c.begin(), c.end()));
+  EXPECT_EQ((std::vector<uint64>{2, 2, 2, 2}), profiler.StateVisits());
+  EXPECT_EQ(2u, Count(profiler.ArcVisits(), 0, 0));
+  EXPECT_EQ(1u, Count(profiler.ArcVisits(), 0, 1));
+  EXPECT_EQ(1u, Count(profiler.ArcVisits(), 2, 1));
+  const auto dd = Labels("dd");
+  ASSERT_TRUE(profiler(dd.begin(), dd.end()));
+  EXPECT_EQ((std::vector<uint64>{3, 2, 3, 2}), profiler.StateVisits());
+}
+
+TEST(CompositionProfilerTest, RejectsUnsortedRule) {
+  StdVectorFst fst;
+  fst.AddState();
+  fst.AddState();
+  fst.SetStart(0);
+  fst.AddArc(0, StdArc('b', 'b', 1));
+  fst.AddArc(0, StdArc('a', 'a', 1));
+  fst.SetFinal(1);
+  CompositionProfiler<StdArc> profiler(fst);
+  const auto a = Labels("a");
+  EXPECT_FALSE(profiler(a.begin(), a.end()));
+  EXPECT_TRUE(profiler.StateVisits().empty());
+  EXPECT_TRUE(profiler.ArcVisits().empty());
+}
+
+class ProfileRewriteTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "composition_profile_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *ProfileRewriteTest::grm_ = nullptr;
+
+// Profiling leaves the output alone, and every arc followed leads to a state
+// visited.
+TEST_F(ProfileRewriteTest, CountsAreConsistent) {
+  ASSERT_NE(grm_, nullptr);
+  const auto inputs = AllStrings("abcd", 4);
+  RuleProfile profile;
+  for (const auto *rule : kRules) {
+    for (const auto &input : inputs) {
+      std::string expected;
+      const bool success = grm_->RewriteBytes(rule, input, &expected);
+      std::string output;
+      ASSERT_EQ(success,
+                grm_->ProfileRewriteBytes(rule, input, &output, &profile))
+          << rule << " on \"" << input << "\"";
+      if (success) EXPECT_EQ(expected, output);
+    }
+  }
+  EXPECT_EQ((std::vector<std::string>{"insert", "replace_ab", "weighted"}),
+            profile.Rules());
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    const auto *state_visits = profile.StateVisits(rule);
+    const auto *arc_visits = profile.ArcVisits(rule);
+    ASSERT_NE(state_visits, nullptr) << rule;
+    ASSERT_NE(arc_visits, nullptr) << rule;
+    // Each input visits the start state at least once.
+    EXPECT_LE(inputs.size(), Count(*state_visits, fst->Start())) << rule;
+    uint64 total_arc_visits = 0;
+    uint64 total_state_visits = 0;
+    for (::fst::StateIterator<::fst::StdFst> siter(*fst); !siter.Done();
+         siter.Next()) {
+      const auto s = siter.Value();
+      total_state_visits += Count(*state_visits, s);
+      ::fst::ArcIterator<::fst::StdFst> aiter(*fst, s);
+      for (; !aiter.Done(); aiter.Next()) {
+        const auto count = Count(*arc_visits, s, aiter.Position());
+        if (count == 0) continue;
+        total_arc_visits += count;
+        EXPECT_GT(Count(*state_visits, s), 0u) << rule;
+        EXPECT_GT(Count(*state_visits, aiter.Value().nextstate), 0u) << rule;
+      }
+    }
+    // Other than the start, a state is only reached by following an arc.
+    EXPECT_LE(total_state_visits, inputs.size() + total_arc_visits) << rule;
+    EXPECT_GT(total_arc_visits, 0u) << rule;
+  }
+}
+
+TEST_F(ProfileRewriteTest, ProfileRoundTrips) {
+  ASSERT_NE(grm_, nullptr);
+  RuleProfile profile;
+  std::string output;
+  for (const auto *rule : kRules) {
+    for (const auto &input : AllStrings("abcd", 3)) {
+      grm_->ProfileRewriteBytes(rule, input, &output, &profile);
+    }
+  }
+  const auto path = ::testing::TempDir() + "/composition_profile_test.tsv";
+  ASSERT_TRUE(profile.Write(path));
+  RuleProfile read;
+  ASSERT_TRUE(read.Read(path));
+  EXPECT_EQ(profile.Rules(), read.Rules());
+  for (const auto *rule : kRules) {
+    ASSERT_NE(read.StateVisits(rule), nullptr) << rule;
+    ASSERT_NE(read.ArcVisits(rule), nullptr) << rule;
+    EXPECT_EQ(*profile.StateVisits(rule), *read.StateVisits(rule)) << rule;
+    EXPECT_EQ(*profile.ArcVisits(rule), *read.ArcVisits(rule)) << rule;
+  }
+  // Reading adds to the counts.
+  ASSERT_TRUE(read.Read(path));
+  const auto &once = *profile.StateVisits("insert");
+  const auto &twice = *read.StateVisits("insert");
+  ASSERT_EQ(once.size(), twice.size());
+  for (size_t s = 0; s < once.size(); ++s) EXPECT_EQ(2 * once[s], twice[s]);
+}
+
+TEST(RuleProfileTest, ReadsTextFormat) {
+  const auto path = ::testing::TempDir() + "/rule_profile_test.tsv";
+  {
+    std::ofstream ostrm(path);
+    ostrm << "# A comment.\n\n"
+          << "state\trule\t2\t5\n"
+          << "arc\trule\t1\t3\t7\n"
+          << "state\trule\t2\t1\n";
+  }
+  RuleProfile profile;
+  ASSERT_TRUE(profile.Read(path));
+  EXPECT_EQ((std::vector<uint64>{0, 0, 6}), *profile.StateVisits("rule"));
+  EXPECT_EQ(7u, Count(*profile.ArcVisits("rule"), 1, 3));
+  EXPECT_EQ(nullptr, profile.StateVisits("other"));
+  for (const auto *line :
+       {"state\trule\t-1\t5\n", "arc\trule\t1\t5\n", "state\trule\t1\tx\n",
+        "visit\trule\t1\t1\n"}) {
+    {
+      std::ofstream ostrm(path);
+      ostrm << line;
+    }
+    RuleProfile malformed;
+    EXPECT_FALSE(malformed.Read(path)) << line;
+  }
+  RuleProfile missing;
+  EXPECT_FALSE(missing.Read(::testing::TempDir() + "/no_such_profile.tsv"));
+}
+
+// Rules laid out by a profile on loading rewrite as they did before.
+TEST_F(ProfileRewriteTest, ReorderedByProfile) {
+  ASSERT_NE(grm_, nullptr);
+  const auto inputs = AllStrings("abcd", 4);
+  RuleProfile profile;
+  std::string output;
+  for (const auto *rule : kRules) {
+    for (const auto &input : inputs) {
+      grm_->ProfileRewriteBytes(rule, input, &output, &profile);
+    }
+  }
+  const auto path = ::testing::TempDir() + "/composition_profile_reorder.tsv";
+  ASSERT_TRUE(profile.Write(path));
+  FST_FLAGS_reorder_rule_states = true;
+  FST_FLAGS_rule_state_profile = path;
+  auto reordered_grm =
+      LoadTestGrammar(kGrammar, "composition_profile_reordered_test");
+  FST_FLAGS_reorder_rule_states = false;
+  FST_FLAGS_rule_state_profile = "";
+  ASSERT_NE(reordered_grm, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    const auto *reordered = reordered_grm->GetFst(rule);
+    ASSERT_NE(reordered, nullptr) << rule;
+    // A hottest state comes first.
+    const auto &visits = *profile.StateVisits(rule);
+    const auto max_visits = *std::max_element(visits.begin(), visits.end());
+    bool hottest_first = false;
+    for (size_t s = 0; s < visits.size(); ++s) {
+      if (visits[s] == max_visits && fst->Final(s) == reordered->Final(0) &&
+          fst->NumArcs(s) == reordered->NumArcs(0)) {
+        hottest_first = true;
+      }
+    }
+    EXPECT_TRUE(hottest_first) << rule;
+    for (const auto &input : inputs) {
+      std::string expected;
+      const bool success = grm_->RewriteBytes(rule, input, &expected);
+      ASSERT_EQ(success, reordered_grm->RewriteBytes(rule, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (success) EXPECT_EQ(expected, output) << rule;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace thrax
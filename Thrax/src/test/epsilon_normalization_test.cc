@@ -0,0 +1,128 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <string>
+
+#include "fst/expanded-fst.h"
+#include "fst/fst.h"
+#include "fst/properties.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(normalize_rule_epsilons);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdFst;
+using ::fst::TropicalWeight;
+
+// The weights leave no ties between outputs, so any best path will do. The
+// unions and closures leave epsilon transitions in the exports.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export accept = ("a" | "b" "c" | "" | "d"+)*;
+export weighted = (("a" : "ba") <1.0> | "b" <2.0> | ("c" : "") <0.5> |
+                   "d" ("" : "y") <0.25>)*;
+)";
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "accept", "weighted"};
+
+// Returns the number of states and arcs, as the normalization counts them.
+int64 Size(const StdFst &fst) {
+  int64 size = 0;
+  for (::fst::StateIterator<StdFst> siter(fst); !siter.Done(); siter.Next()) {
+    size += 1 + fst.NumArcs(siter.Value());
+  }
+  return size;
+}
+
+class EpsilonNormalizationTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "epsilon_normalization_test").release();
+    FST_FLAGS_normalize_rule_epsilons = true;
+    normalized_grm_ =
+        LoadTestGrammar(kGrammar, "epsilon_normalization_normalized_test")
+            .release();
+    FST_FLAGS_normalize_rule_epsilons = false;
+  }
+
+  static void TearDownTestSuite() {
+    delete grm_;
+    delete normalized_grm_;
+  }
+
+  static GrmManager *grm_;
+  static GrmManager *normalized_grm_;
+};
+
+GrmManager *EpsilonNormalizationTest::grm_ = nullptr;
+GrmManager *EpsilonNormalizationTest::normalized_grm_ = nullptr;
+
+// Every input is rewritten as the rule as compiled rewrites it.
+TEST_F(EpsilonNormalizationTest, RewritesAgree) {
+  ASSERT_NE(grm_, nullptr);
+  ASSERT_NE(normalized_grm_, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    const auto *normalized = normalized_grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr) << rule;
+    ASSERT_NE(normalized, nullptr) << rule;
+    for (const auto &input : AllStrings("abcde", 4)) {
+      std::string expected;
+      TropicalWeight expected_weight;
+      const bool accepted =
+          ReferenceRewriteBytes(*fst, input, &expected, &expected_weight);
+      std::string output;
+      TropicalWeight weight;
+      ASSERT_EQ(accepted,
+                ReferenceRewriteBytes(*normalized, input, &output, &weight))
+          << rule << " on \"" << input << "\"";
+      EXPECT_EQ(accepted, normalized_grm_->RewriteBytes(rule, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (!accepted) continue;
+      EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight))
+          << rule << " on \"" << input << "\"";
+    }
+  }
+}
+
+// No rule grows, and the acceptor loses all of its epsilons.
+TEST_F(EpsilonNormalizationTest, RemovesEpsilons) {
+  ASSERT_NE(grm_, nullptr);
+  ASSERT_NE(normalized_grm_, nullptr);
+  for (const auto *rule : kRules) {
+    EXPECT_LE(Size(*normalized_grm_->GetFst(rule)), Size(*grm_->GetFst(rule)))
+        << rule;
+  }
+  const auto *accept = grm_->GetFst("accept");
+  ASSERT_NE(::fst::kNoIEpsilons,
+            accept->Properties(::fst::kNoIEpsilons, true));
+  const auto *normalized_accept = normalized_grm_->GetFst("accept");
+  EXPECT_EQ(::fst::kNoIEpsilons,
+            normalized_accept->Properties(::fst::kNoIEpsilons, true));
+  EXPECT_LT(Size(*normalized_accept), Size(*accept));
+  // Insertions keep their epsilon inputs.
+  EXPECT_NE(::fst::kNoIEpsilons, normalized_grm_->GetFst("insert")->Properties(
+                                     ::fst::kNoIEpsilons, true));
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,159 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/flat_dfa.h"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "fst/arc.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_rule_metadata);
+DECLARE_bool(sequentialize_exports);
+
+namespace thrax {
+namespace {
+
+using ::fst::FlatDfa;
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using ::fst::TropicalWeight;
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c";
+export delete_ab = CDRewrite["ab" : "", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = (("a" : "ba") <1.0> | "b" <2.0> | ("c" : "") <0.5>)*;
+)";
+
+class FlatDfaTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    FST_FLAGS_sequentialize_exports = true;
+    grm_ = LoadTestGrammar(kGrammar, "flat_dfa_test").release();
+    FST_FLAGS_sequentialize_exports = false;
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *FlatDfaTest::grm_ = nullptr;
+
+// Checks that the flat rule rewrites as composition does, or rejects what
+// composition rejects.
+void ExpectRewritesAgree(const GrmManager &grm, const std::string &rule,
+                         const FlatDfa<StdArc> &flat,
+                         const std::string &input) {
+  std::string expected;
+  TropicalWeight expected_weight;
+  const bool accepted = ReferenceRewriteBytes(*grm.GetFst(rule), input,
+                                              &expected, &expected_weight);
+  std::string output;
+  TropicalWeight weight;
+  ASSERT_EQ(accepted, flat.RewriteBytes(input, &output, &weight))
+      << rule << " on \"" << input << "\"";
+  if (!accepted) return;
+  EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+  EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight))
+      << rule << " on \"" << input << "\"";
+}
+
+TEST_F(FlatDfaTest, MatchesComposition) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *rule : {"delete_ab", "insert", "weighted"}) {
+    const auto *flat = grm_->GetFlatRule(rule);
+    ASSERT_NE(flat, nullptr) << rule << " was not flattened";
+    for (const auto &input : AllStrings("abcd", 5)) {
+      ExpectRewritesAgree(*grm_, rule, *flat, input);
+    }
+  }
+}
+
+TEST_F(FlatDfaTest, SkipsNulAsCompositionDoes) {
+  ASSERT_NE(grm_, nullptr);
+  const auto *flat = grm_->GetFlatRule("delete_ab");
+  ASSERT_NE(flat, nullptr);
+  for (const auto &input : {std::string("a\0b", 3), std::string("\0", 1),
+                            std::string("cab\0", 4)}) {
+    ExpectRewritesAgree(*grm_, "delete_ab", *flat, input);
+  }
+}
+
+TEST_F(FlatDfaTest, WriteReadRoundTrip) {
+  ASSERT_NE(grm_, nullptr);
+  const auto *flat = grm_->GetFlatRule("weighted");
+  ASSERT_NE(flat, nullptr);
+  std::stringstream strm;
+  ASSERT_TRUE(flat->Write(strm, "weighted"));
+  std::unique_ptr<FlatDfa<StdArc>> read(
+      FlatDfa<StdArc>::Read(strm, "weighted"));
+  ASSERT_NE(read, nullptr);
+  EXPECT_EQ(flat->NumStates(), read->NumStates());
+  EXPECT_EQ(flat->NumArcs(), read->NumArcs());
+  for (const auto &input : AllStrings("abc", 4)) {
+    ExpectRewritesAgree(*grm_, "weighted", *read, input);
+  }
+}
+
+// Without --sequentialize_exports no rule is listed as sequential, so none is
+// flattened on loading, whatever their metadata records.
+TEST(FlatDfaLoadTest, FlattensOnlyWhenAsked) {
+  const bool export_rule_metadata = FST_FLAGS_export_rule_metadata;
+  FST_FLAGS_export_rule_metadata = true;
+  auto grm = LoadTestGrammar(kGrammar, "flat_dfa_unlisted_test");
+  FST_FLAGS_export_rule_metadata = export_rule_metadata;
+  ASSERT_NE(grm, nullptr);
+  for (const auto *rule : {"delete_ab", "insert", "weighted"}) {
+    EXPECT_EQ(grm->GetFlatRule(rule), nullptr) << rule << " was flattened";
+  }
+}
+
+TEST(FlatDfaReadTest, RejectsUnsortedArcs) {
+  StdVectorFst fst;
+  const auto s = fst.AddState();
+  fst.SetStart(s);
+  fst.SetFinal(s);
+  fst.AddArc(s, StdArc('a', 'a', s));
+  fst.AddArc(s, StdArc('b', 'b', s));
+  FlatDfa<StdArc> dfa;
+  ASSERT_TRUE(dfa.Init(fst));
+  std::stringstream strm;
+  ASSERT_TRUE(dfa.Write(strm, "unsorted"));
+  // The two arcs, each an ilabel, nextstate, output, output_size and weight,
+  // are followed by the empty pool, which is its int64 size alone.
+  auto contents = strm.str();
+  constexpr size_t kArcSize = 5 * 4;
+  const auto arcs = contents.size() - sizeof(int64) - 2 * kArcSize;
+  std::swap_ranges(contents.begin() + arcs, contents.begin() + arcs + kArcSize,
+                   contents.begin() + arcs + kArcSize);
+  std::istringstream unsorted(contents);
+  EXPECT_EQ(FlatDfa<StdArc>::Read(unsorted, "unsorted"), nullptr);
+  // Unswapped, the same bytes read back fine.
+  std::istringstream sorted(strm.str());
+  std::unique_ptr<FlatDfa<StdArc>> read(
+      FlatDfa<StdArc>::Read(sorted, "sorted"));
+  EXPECT_NE(read, nullptr);
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,144 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/grm-image.h"
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "fst/arc.h"
+#include "fst/equal.h"
+#include "gtest/gtest.h"
+#include "thrax/algo/packed_fst.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_rule_metadata);
+DECLARE_bool(export_triggers);
+DECLARE_bool(pack_rules);
+DECLARE_bool(sequentialize_exports);
+
+namespace thrax {
+namespace {
+
+// A rule flattened on export, one which is not sequential, and one whose
+// generated label keeps it from being packed.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export delete_ab = CDRewrite["ab" : "", "", "", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+export tag = CDRewrite["c" : "[TAG]", "", "", sigma*];
+)";
+
+class GrmImageTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    FST_FLAGS_export_rule_metadata = true;
+    FST_FLAGS_export_triggers = true;
+    FST_FLAGS_sequentialize_exports = true;
+    FST_FLAGS_pack_rules = true;
+    grm_ = LoadTestGrammar(kGrammar, "grm_image_test").release();
+    FST_FLAGS_pack_rules = false;
+    FST_FLAGS_sequentialize_exports = false;
+    FST_FLAGS_export_triggers = false;
+    FST_FLAGS_export_rule_metadata = false;
+    image_path_ = new std::string(::testing::TempDir() + "/grm_image_test.img");
+    if (grm_ && !grm_->WriteImage(*image_path_)) image_path_->clear();
+  }
+
+  static void TearDownTestSuite() {
+    delete grm_;
+    delete image_path_;
+  }
+
+  static GrmManager *grm_;
+  static std::string *image_path_;
+};
+
+GrmManager *GrmImageTest::grm_ = nullptr;
+std::string *GrmImageTest::image_path_ = nullptr;
+
+TEST_F(GrmImageTest, RoundTripsTheLoadedManager) {
+  ASSERT_NE(grm_, nullptr);
+  ASSERT_FALSE(image_path_->empty());
+  GrmManager image;
+  ASSERT_TRUE(image.LoadImage(*image_path_));
+  // The FSTs, special ones included, as loaded, packed ones still packed.
+  ASSERT_EQ(grm_->GetFstMap().size(), image.GetFstMap().size());
+  size_t num_packed = 0;
+  for (const auto &[name, fst] : grm_->GetFstMap()) {
+    const auto *image_fst = image.GetFst(name);
+    ASSERT_NE(image_fst, nullptr) << name;
+    EXPECT_EQ(::fst::IsPackedFst(*fst), ::fst::IsPackedFst(*image_fst))
+        << name;
+    if (::fst::IsPackedFst(*fst)) ++num_packed;
+    // The metadata FST is rewritten from the metadata the manager holds,
+    // which the next check covers.
+    if (name == kRuleMetadataFst) continue;
+    EXPECT_TRUE(::fst::Equal(*fst, *image_fst)) << name;
+  }
+  EXPECT_GT(num_packed, 0u);
+  for (const auto *rule : {"delete_ab", "weighted", "tag"}) {
+    const auto *metadata = grm_->GetRuleMetadata(rule);
+    const auto *image_metadata = image.GetRuleMetadata(rule);
+    ASSERT_EQ(metadata == nullptr, image_metadata == nullptr) << rule;
+    if (metadata) {
+      EXPECT_EQ(metadata->ToString(rule), image_metadata->ToString(rule));
+    }
+    const auto *flat = grm_->GetFlatRule(rule);
+    const auto *image_flat = image.GetFlatRule(rule);
+    ASSERT_EQ(flat == nullptr, image_flat == nullptr) << rule;
+    if (flat) {
+      EXPECT_EQ(flat->NumStates(), image_flat->NumStates()) << rule;
+      EXPECT_EQ(flat->NumArcs(), image_flat->NumArcs()) << rule;
+    }
+    for (const auto &input : AllStrings("abcde", 4)) {
+      std::string expected;
+      const bool accepted = grm_->RewriteBytes(rule, input, &expected);
+      std::string output;
+      ASSERT_EQ(accepted, image.RewriteBytes(rule, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+  EXPECT_NE(image.GetFlatRule("delete_ab"), nullptr);
+}
+
+TEST_F(GrmImageTest, RejectsCorruptImage) {
+  ASSERT_FALSE(image_path_->empty());
+  std::string contents;
+  {
+    std::ifstream strm(*image_path_, std::ios_base::binary);
+    contents.assign(std::istreambuf_iterator<char>(strm),
+                    std::istreambuf_iterator<char>());
+  }
+  ASSERT_FALSE(contents.empty());
+  contents.back() ^= 1;
+  const auto path = ::testing::TempDir() + "/grm_image_test_corrupt.img";
+  {
+    std::ofstream strm(path, std::ios_base::binary);
+    strm.write(contents.data(), contents.size());
+  }
+  GrmManager image;
+  EXPECT_FALSE(image.LoadImage(path));
+  EXPECT_TRUE(image.GetFstMap().empty());
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,148 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/incremental_rewrite.h"
+
+#include <memory>
+#include <random>
+#include <string>
+
+#include "fst/arc.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+namespace thrax {
+namespace {
+
+using ::fst::IncrementalRewriter;
+using ::fst::StdArc;
+using ::fst::ViterbiStatus;
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "weighted",
+                               "optional"};
+
+// The weights leave no ties between outputs, so any best path will do.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+export optional = (sigma | ("b" : "bb") <-1.0>)*;
+)";
+
+class IncrementalRewriteTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "incremental_rewrite_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *IncrementalRewriteTest::grm_ = nullptr;
+
+// Returns a random string over the alphabet of at most max_length bytes.
+std::string RandomString(const std::string &alphabet, size_t max_length,
+                         std::mt19937 *rng) {
+  std::string text(std::uniform_int_distribution<size_t>(0, max_length)(*rng),
+                   ' ');
+  for (auto &ch : text) {
+    ch = alphabet[std::uniform_int_distribution<size_t>(
+        0, alphabet.size() - 1)(*rng)];
+  }
+  return text;
+}
+
+// Applies random edits to the input of the rewriter, checking after each
+// that the rewrite of the edited input agrees with composition.
+TEST_F(IncrementalRewriteTest, MatchesCompositionAfterEdits) {
+  ASSERT_NE(grm_, nullptr);
+  // NUL bytes, which composition skips, are among the edits.
+  const std::string alphabet("abcde\0", 6);
+  std::mt19937 rng(0);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    IncrementalRewriter<StdArc> rewriter(*fst);
+    std::string input = RandomString("abcd", 20, &rng);
+    std::string output;
+    rewriter.Reset(input.begin(), input.end(), &output);
+    for (int edit = 0; edit < 300; ++edit) {
+      const auto pos =
+          std::uniform_int_distribution<size_t>(0, input.size())(rng);
+      const auto length =
+          std::uniform_int_distribution<size_t>(0, input.size() - pos)(rng) %
+          4;
+      const auto text = RandomString(alphabet, 3, &rng);
+      input.replace(pos, length, text);
+      output.clear();
+      const auto *begin = reinterpret_cast<const unsigned char *>(text.data());
+      const auto status = rewriter.Replace(pos, length, begin,
+                                           begin + text.size(), &output);
+      ASSERT_NE(status, ViterbiStatus::kUnsupported) << rule;
+      ASSERT_EQ(input, std::string(rewriter.Input().begin(),
+                                   rewriter.Input().end()));
+      std::string expected;
+      const bool accepted = ReferenceRewriteBytes(*fst, input, &expected);
+      ASSERT_EQ(accepted, status == ViterbiStatus::kSuccess)
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+}
+
+// An edit far from the ends of a long input only recomputes the few columns
+// around it, for a rule which forgets its context quickly.
+TEST_F(IncrementalRewriteTest, RecomputesAroundTheEdit) {
+  ASSERT_NE(grm_, nullptr);
+  auto session = grm_->StartRewriteSession("replace_ab");
+  ASSERT_NE(session, nullptr);
+  std::string input;
+  for (int i = 0; i < 100; ++i) input += "abcd";
+  std::string output;
+  ASSERT_TRUE(session->SetInput(input, &output));
+  EXPECT_EQ(input.size() + 1, session->NumRecomputed());
+  ASSERT_TRUE(session->Replace(200, 2, "ba", &output));
+  input.replace(200, 2, "ba");
+  EXPECT_EQ(input, session->Input());
+  EXPECT_LT(session->NumRecomputed(), 10u);
+  std::string expected;
+  ASSERT_TRUE(ReferenceRewriteBytes(*grm_->GetFst("replace_ab"), input,
+                                    &expected));
+  EXPECT_EQ(expected, output);
+}
+
+// A session keeps an input which the rule rejects, so that a later edit can
+// make it acceptable.
+TEST_F(IncrementalRewriteTest, RecoversFromRejectedInput) {
+  ASSERT_NE(grm_, nullptr);
+  auto session = grm_->StartRewriteSession("insert");
+  ASSERT_NE(session, nullptr);
+  std::string output;
+  EXPECT_FALSE(session->SetInput("abecd", &output));
+  ASSERT_TRUE(session->Replace(2, 1, "c", &output));
+  std::string expected;
+  ASSERT_TRUE(
+      ReferenceRewriteBytes(*grm_->GetFst("insert"), "abccd", &expected));
+  EXPECT_EQ(expected, output);
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,123 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <../bin/utildefs.h>
+
+#include <string>
+#include <vector>
+
+#include "fst/icu.h"
+#include "fst/symbol-table.h"
+#include "gtest/gtest.h"
+
+DECLARE_string(field_separator);
+
+namespace thrax {
+namespace {
+
+using ::fst::SymbolTable;
+using ::fst::TokenType;
+using Label = LabelFormatter::Label;
+
+// The formatting LabelFormatter replaced, which looked the label up in the
+// symbol tables each time.
+bool AppendLabel(Label label, TokenType type,
+                 const SymbolTable *generated_symtab, SymbolTable *symtab,
+                 std::string *path) {
+  if (label != 0) {
+    if (generated_symtab && !generated_symtab->Find(label).empty()) {
+      const auto &sym = generated_symtab->Find(label);
+      *path += "[" + sym + "]";
+    } else if (type == TokenType::SYMBOL) {
+      const auto &sym = symtab->Find(label);
+      if (sym.empty()) return false;
+      if (!path->empty()) *path += FST_FLAGS_field_separator;
+      *path += sym;
+    } else if (type == TokenType::BYTE) {
+      path->push_back(label);
+    } else if (type == TokenType::UTF8) {
+      std::string utf8_string;
+      std::vector<Label> labels;
+      labels.push_back(label);
+      if (!::fst::LabelsToUTF8String(labels, &utf8_string)) return false;
+      *path += utf8_string;
+    }
+  }
+  return true;
+}
+
+class LabelFormatterTest : public ::testing::Test {
+ protected:
+  LabelFormatterTest() : generated_("generated"), symbols_("symbols") {
+    generated_.AddSymbol("BOS", 0xF0000);
+    generated_.AddSymbol("EOS", 0xF0001);
+    generated_.AddSymbol("x", 0xF8000);
+    symbols_.AddSymbol("<epsilon>", 0);
+    symbols_.AddSymbol("hello", 1);
+    symbols_.AddSymbol("world", 2);
+    symbols_.AddSymbol("!", 97);
+  }
+
+  // Checks that the formatter agrees with AppendLabel on the labels, with
+  // and without the generated labels.
+  void ExpectSameText(TokenType type, const std::vector<Label> &labels) {
+    for (const auto *generated :
+         {&generated_, static_cast<SymbolTable *>(nullptr)}) {
+      std::string expected;
+      bool expected_success = true;
+      for (const auto label : labels) {
+        if (!AppendLabel(label, type, generated, &symbols_, &expected)) {
+          expected_success = false;
+          break;
+        }
+      }
+      const LabelFormatter formatter(generated, type, &symbols_);
+      std::string output;
+      ASSERT_EQ(expected_success, formatter.Format(labels, &output))
+          << "\"" << expected << "\"";
+      if (expected_success) EXPECT_EQ(expected, output);
+    }
+  }
+
+  SymbolTable generated_;
+  SymbolTable symbols_;
+};
+
+TEST_F(LabelFormatterTest, Bytes) {
+  ExpectSameText(TokenType::BYTE, {});
+  ExpectSameText(TokenType::BYTE, {'a', 'b', 0, 'c'});
+  ExpectSameText(TokenType::BYTE, {0xF0000, 'a', 0xF0001, 0xF8000});
+  ExpectSameText(TokenType::BYTE, {0x80, 0xFF, 1});
+}
+
+TEST_F(LabelFormatterTest, Utf8) {
+  ExpectSameText(TokenType::UTF8, {'a', 0xE9, 0, 0x4E2D, 0x1F600});
+  ExpectSameText(TokenType::UTF8, {0x7F, 0x80, 0x7FF, 0x800, 0xFFFF});
+  ExpectSameText(TokenType::UTF8, {0x10000, 0x10FFFF});
+  ExpectSameText(TokenType::UTF8, {0xF0000, 0xE9, 0xF0001});
+  ExpectSameText(TokenType::UTF8, {'a', -5});
+}
+
+TEST_F(LabelFormatterTest, Symbols) {
+  ExpectSameText(TokenType::SYMBOL, {1, 2, 0, 97});
+  ExpectSameText(TokenType::SYMBOL, {0xF0000, 1, 0xF8000, 2, 0xF0001});
+  ExpectSameText(TokenType::SYMBOL, {1, 5});
+  const auto separator = FST_FLAGS_field_separator;
+  FST_FLAGS_field_separator = "|";
+  ExpectSameText(TokenType::SYMBOL, {1, 2, 0xF0000, 97});
+  FST_FLAGS_field_separator = separator;
+}
+
+}  // namespace
+}  // namespace thrax
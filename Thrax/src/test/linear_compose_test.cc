@@ -0,0 +1,112 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/linear_compose.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+namespace thrax {
+namespace {
+
+using ::fst::LinearComposer;
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using ::fst::TropicalWeight;
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+)";
+
+class LinearComposeTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "linear_compose_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  // Composes each input in turn with the same composer, checking its shortest
+  // path against composition.
+  static void ExpectComposerAgrees(const std::string &rule,
+                                   const std::vector<std::string> &inputs) {
+    ASSERT_NE(grm_, nullptr);
+    const auto *fst = grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    LinearComposer<StdArc> composer;
+    for (const auto &input : inputs) {
+      std::string expected;
+      TropicalWeight expected_weight;
+      const bool accepted =
+          ReferenceRewriteBytes(*fst, input, &expected, &expected_weight);
+      StdVectorFst lattice;
+      ASSERT_TRUE(composer(CompileBytes(input), *fst, &lattice))
+          << rule << " on \"" << input << "\"";
+      std::string output;
+      TropicalWeight weight;
+      ASSERT_EQ(accepted, ShortestPathBytes(lattice, &output, &weight))
+          << rule << " on \"" << input << "\"";
+      if (!accepted) continue;
+      EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight))
+          << rule << " on \"" << input << "\"";
+    }
+  }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *LinearComposeTest::grm_ = nullptr;
+
+TEST_F(LinearComposeTest, MatchesComposition) {
+  const auto inputs = AllStrings("abcde", 4);
+  for (const auto *rule : {"replace_ab", "insert", "weighted"}) {
+    ExpectComposerAgrees(rule, inputs);
+  }
+}
+
+// The scratch tables are stamped by position; a shorter input after a longer
+// one must not find the states of the longer one.
+TEST_F(LinearComposeTest, ReusedForDecreasingLengths) {
+  ExpectComposerAgrees("replace_ab", {"abcd", "ab"});
+  ExpectComposerAgrees("replace_ab", {"abababab", "abab", "ab", "", "ab"});
+  auto inputs = AllStrings("abcd", 5);
+  std::reverse(inputs.begin(), inputs.end());
+  for (const auto *rule : {"replace_ab", "insert", "weighted"}) {
+    ExpectComposerAgrees(rule, inputs);
+  }
+}
+
+TEST_F(LinearComposeTest, FallsBackOnEpsilonInput) {
+  ASSERT_NE(grm_, nullptr);
+  LinearComposer<StdArc> composer;
+  StdVectorFst lattice;
+  EXPECT_FALSE(composer(CompileBytes(std::string("a\0b", 3)),
+                        *grm_->GetFst("replace_ab"), &lattice));
+}
+
+}  // namespace
+}  // namespace thrax
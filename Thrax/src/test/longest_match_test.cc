@@ -0,0 +1,140 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/longest_match.h"
+
+#include <memory>
+#include <string>
+
+#include "fst/arc.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(sequentialize_exports);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::UnmatchedPolicy;
+
+// Entries sharing prefixes, with outputs which depend on how the entry ends,
+// so that the rule is not input-deterministic as compiled.
+constexpr char kGrammar[] = R"(
+export dict = ("ab" : "X") | ("abc" : "Y") | ("ac" : "W") | ("b" : "Z") |
+              "ca" | ("bcab" : "V");
+)";
+
+class LongestMatchTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "longest_match_test").release();
+    FST_FLAGS_sequentialize_exports = true;
+    flat_grm_ =
+        LoadTestGrammar(kGrammar, "longest_match_flat_test").release();
+    FST_FLAGS_sequentialize_exports = false;
+  }
+
+  static void TearDownTestSuite() {
+    delete grm_;
+    delete flat_grm_;
+  }
+
+  static GrmManager *grm_;
+  static GrmManager *flat_grm_;
+};
+
+GrmManager *LongestMatchTest::grm_ = nullptr;
+GrmManager *LongestMatchTest::flat_grm_ = nullptr;
+
+// Segments the input as the segmenter should, finding the longest entry at
+// each position by composing each of its prefixes, longest first, with the
+// rule and taking the shortest path.
+bool ReferenceSegmentBytes(const ::fst::Fst<StdArc> &rule,
+                           const std::string &input, UnmatchedPolicy policy,
+                           char separator, std::string *output) {
+  output->clear();
+  bool first = true;
+  for (size_t i = 0; i < input.size();) {
+    std::string segment;
+    size_t length = input.size() - i;
+    for (; length > 0; --length) {
+      if (ReferenceRewriteBytes(rule, input.substr(i, length), &segment)) {
+        break;
+      }
+    }
+    if (length == 0) {
+      if (policy == UnmatchedPolicy::kFail) return false;
+      if (policy == UnmatchedPolicy::kDrop) {
+        ++i;
+        continue;
+      }
+      segment = input.substr(i, 1);
+      length = 1;
+    }
+    if (!first && separator != 0) output->push_back(separator);
+    first = false;
+    output->append(segment);
+    i += length;
+  }
+  return true;
+}
+
+void ExpectSegmentsAgree(const GrmManager &grm, UnmatchedPolicy policy,
+                         char separator) {
+  const auto segmenter = grm.PrepareSegmenter("dict", policy, separator);
+  ASSERT_NE(segmenter, nullptr);
+  for (const auto &input : AllStrings("abcd", 5)) {
+    std::string expected;
+    const bool accepted = ReferenceSegmentBytes(*grm.GetFst("dict"), input,
+                                                policy, separator, &expected);
+    const auto *begin = reinterpret_cast<const unsigned char *>(input.data());
+    std::string output;
+    ASSERT_EQ(accepted,
+              (*segmenter)(begin, begin + input.size(), &output))
+        << "\"" << input << "\"";
+    if (accepted) EXPECT_EQ(expected, output) << "\"" << input << "\"";
+  }
+}
+
+TEST_F(LongestMatchTest, MatchesCompositionForEachPolicy) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto policy : {UnmatchedPolicy::kCopy, UnmatchedPolicy::kDrop,
+                            UnmatchedPolicy::kFail}) {
+    ExpectSegmentsAgree(*grm_, policy, 0);
+    ExpectSegmentsAgree(*grm_, policy, '|');
+  }
+}
+
+TEST_F(LongestMatchTest, UsesTheFlatRule) {
+  ASSERT_NE(flat_grm_, nullptr);
+  ASSERT_NE(flat_grm_->GetFlatRule("dict"), nullptr);
+  ExpectSegmentsAgree(*flat_grm_, UnmatchedPolicy::kCopy, '|');
+  ExpectSegmentsAgree(*flat_grm_, UnmatchedPolicy::kFail, 0);
+}
+
+TEST_F(LongestMatchTest, SegmentBytes) {
+  ASSERT_NE(grm_, nullptr);
+  std::string output;
+  ASSERT_TRUE(grm_->SegmentBytes("dict", "abcabdbcab", &output,
+                                 UnmatchedPolicy::kCopy, '|'));
+  EXPECT_EQ("Y|X|d|V", output);
+  EXPECT_FALSE(grm_->SegmentBytes("dict", "abd", &output,
+                                  UnmatchedPolicy::kFail));
+  EXPECT_FALSE(grm_->SegmentBytes("missing", "ab", &output));
+}
+
+}  // namespace
+}  // namespace thrax
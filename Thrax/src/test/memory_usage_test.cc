@@ -0,0 +1,125 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "fst/fst.h"
+#include "gtest/gtest.h"
+#include "thrax/algo/packed_fst.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(pack_rules);
+DECLARE_bool(sequentialize_exports);
+
+namespace thrax {
+namespace {
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export delete_ab = CDRewrite["ab" : "", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = (("a" : "ba") <1.0> | "b" <2.0> | ("c" : "") <0.5>)*;
+)";
+
+// Checks that the totals add up to the entries for the rules, and that each
+// entry describes the FST loaded under its name.
+void ExpectConsistent(const GrmManager &grm) {
+  const auto usage = grm.MemoryUsage();
+  std::set<std::string> names;
+  std::map<std::string, size_t> bytes_by_type;
+  size_t total_bytes = 0;
+  size_t shared_bytes = 0;
+  for (const auto &rule : usage.rules) {
+    EXPECT_TRUE(names.insert(rule.name).second) << rule.name;
+    const auto *fst = grm.GetFst(rule.name);
+    ASSERT_NE(fst, nullptr) << rule.name;
+    EXPECT_EQ(fst->Type(), rule.type) << rule.name;
+    int64 num_states = 0;
+    int64 num_arcs = 0;
+    for (::fst::StateIterator<::fst::StdFst> siter(*fst); !siter.Done();
+         siter.Next()) {
+      ++num_states;
+      num_arcs += fst->NumArcs(siter.Value());
+    }
+    EXPECT_EQ(num_states, rule.num_states) << rule.name;
+    EXPECT_EQ(num_arcs, rule.num_arcs) << rule.name;
+    EXPECT_GT(rule.fst_bytes, 0u) << rule.name;
+    const auto *flat = grm.GetFlatRule(rule.name);
+    EXPECT_EQ(flat ? flat->SizeInBytes() : 0, rule.flat_bytes) << rule.name;
+    EXPECT_EQ(rule.fst_bytes + rule.symbol_table_bytes + rule.flat_bytes,
+              rule.TotalBytes());
+    bytes_by_type[rule.type] += rule.fst_bytes;
+    total_bytes += rule.TotalBytes();
+    if (rule.shared) shared_bytes += rule.fst_bytes;
+  }
+  EXPECT_EQ(bytes_by_type, usage.bytes_by_type);
+  EXPECT_EQ(total_bytes, usage.total_bytes);
+  EXPECT_EQ(shared_bytes, usage.shared_bytes);
+}
+
+TEST(MemoryUsageTest, TotalsAddUp) {
+  auto grm = LoadTestGrammar(kGrammar, "memory_usage_test");
+  ASSERT_NE(grm, nullptr);
+  ExpectConsistent(*grm);
+  const auto usage = grm->MemoryUsage();
+  EXPECT_EQ(0u, usage.shared_bytes);
+  std::set<std::string> names;
+  for (const auto &rule : usage.rules) names.insert(rule.name);
+  for (const auto *rule : {"delete_ab", "insert", "weighted"}) {
+    EXPECT_EQ(1u, names.count(rule)) << rule;
+  }
+}
+
+// Flat forms are counted with their rules, and packed rules by their type.
+TEST(MemoryUsageTest, CountsFlatAndPackedRules) {
+  FST_FLAGS_sequentialize_exports = true;
+  FST_FLAGS_pack_rules = true;
+  auto grm = LoadTestGrammar(kGrammar, "memory_usage_packed_test");
+  FST_FLAGS_sequentialize_exports = false;
+  FST_FLAGS_pack_rules = false;
+  ASSERT_NE(grm, nullptr);
+  ExpectConsistent(*grm);
+  const auto usage = grm->MemoryUsage();
+  size_t flat_bytes = 0;
+  for (const auto &rule : usage.rules) flat_bytes += rule.flat_bytes;
+  EXPECT_GT(flat_bytes, 0u);
+  const auto *packed = grm->GetFst("weighted");
+  ASSERT_NE(packed, nullptr);
+  ASSERT_TRUE(::fst::IsPackedFst(*packed));
+  EXPECT_EQ(1u, usage.bytes_by_type.count(packed->Type()));
+}
+
+// Removing a rule takes its memory off the total.
+TEST(MemoryUsageTest, RemovedRulesAreNotCounted) {
+  auto grm = LoadTestGrammar(kGrammar, "memory_usage_removed_test");
+  ASSERT_NE(grm, nullptr);
+  const auto before = grm->MemoryUsage();
+  size_t removed_bytes = 0;
+  for (const auto &rule : before.rules) {
+    if (rule.name == "weighted") removed_bytes = rule.TotalBytes();
+  }
+  ASSERT_GT(removed_bytes, 0u);
+  grm->RemoveFst("weighted");
+  const auto after = grm->MemoryUsage();
+  EXPECT_EQ(before.rules.size() - 1, after.rules.size());
+  EXPECT_EQ(before.total_bytes - removed_bytes, after.total_bytes);
+  ExpectConsistent(*grm);
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,125 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/multi-grm-manager.h"
+
+#include <string>
+
+#include "fst/arc.h"
+#include "fst/arcsort.h"
+#include "fst/compose.h"
+#include "fst/project.h"
+#include "fst/symbol-table.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/algo/packed_fst.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_rule_metadata);
+DECLARE_bool(pack_rules);
+DECLARE_bool(sequentialize_exports);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+
+// Both grammars generate labels for their bracketed symbols, starting from
+// the same one, so mounting the second must move its labels for [MARK] and
+// [TAG].
+constexpr char kProducer[] = R"(
+sigma = "a" | "b" | "[TAG]";
+export tag = CDRewrite["a" : "[TAG]", "", "", sigma*];
+)";
+
+constexpr char kConsumer[] = R"(
+marker = "[MARK]";
+sigma = "a" | "b" | "[TAG]" | marker;
+export untag = CDRewrite["[TAG]" : "b", "", "", sigma*];
+)";
+
+// Byte rules only, which fit in packed form.
+constexpr char kBytes[] = R"(
+sigma = "a" | "b" | "c";
+export delete_ab = CDRewrite["ab" : "", "", "", sigma*];
+)";
+
+TEST(MultiGrmManagerTest, MergesGeneratedLabels) {
+  const auto producer = CompileTestGrammar(kProducer, "multi_producer");
+  const auto consumer = CompileTestGrammar(kConsumer, "multi_consumer");
+  ASSERT_FALSE(producer.empty());
+  ASSERT_FALSE(consumer.empty());
+  MultiGrmManager grm;
+  ASSERT_TRUE(grm.Mount("producer", producer));
+  ASSERT_TRUE(grm.Mount("consumer", consumer));
+  const auto *label_fst = grm.GetFst(kStringFstSymtabFst);
+  ASSERT_NE(label_fst, nullptr);
+  const auto *generated = label_fst->InputSymbols();
+  ASSERT_NE(generated, nullptr);
+  const auto label_tag = generated->Find("TAG");
+  const auto label_mark = generated->Find("MARK");
+  ASSERT_NE(label_tag, ::fst::kNoSymbol);
+  ASSERT_NE(label_mark, ::fst::kNoSymbol);
+  EXPECT_NE(label_tag, label_mark);
+  // The output of one FAR's rule is read by the other's with the same label.
+  StdVectorFst tagged;
+  ASSERT_TRUE(grm.Rewrite("producer/tag", "bab", &tagged));
+  ::fst::Project(&tagged, ::fst::ProjectType::OUTPUT);
+  ::fst::ArcSort(&tagged, ::fst::OLabelCompare<StdArc>());
+  StdVectorFst untagged;
+  ::fst::Compose(tagged, *grm.GetFst("consumer/untag"), &untagged);
+  std::string output;
+  ASSERT_TRUE(ShortestPathBytes(untagged, &output));
+  EXPECT_EQ("bbb", output);
+  // Unmounting keeps the merged labels, so remounting changes nothing.
+  ASSERT_TRUE(grm.Unmount("consumer"));
+  EXPECT_EQ(grm.GetFst("consumer/untag"), nullptr);
+  ASSERT_TRUE(grm.Mount("consumer", consumer));
+  generated = grm.GetFst(kStringFstSymtabFst)->InputSymbols();
+  EXPECT_EQ(label_mark, generated->Find("MARK"));
+}
+
+TEST(MultiGrmManagerTest, PreparesMountedRulesAsLoadingDoes) {
+  FST_FLAGS_export_rule_metadata = true;
+  FST_FLAGS_sequentialize_exports = true;
+  const auto path = CompileTestGrammar(kBytes, "multi_bytes");
+  FST_FLAGS_sequentialize_exports = false;
+  FST_FLAGS_export_rule_metadata = false;
+  ASSERT_FALSE(path.empty());
+  GrmManager single;
+  ASSERT_TRUE(single.LoadArchive(path));
+  FST_FLAGS_pack_rules = true;
+  MultiGrmManager grm;
+  const bool mounted = grm.Mount("bytes", path);
+  FST_FLAGS_pack_rules = false;
+  ASSERT_TRUE(mounted);
+  const auto *fst = grm.GetFst("bytes/delete_ab");
+  ASSERT_NE(fst, nullptr);
+  EXPECT_TRUE(::fst::IsPackedFst(*fst));
+  EXPECT_NE(grm.GetRuleMetadata("bytes/delete_ab"), nullptr);
+  EXPECT_NE(grm.GetFlatRule("bytes/delete_ab"), nullptr);
+  for (const auto &input : AllStrings("abcd", 4)) {
+    std::string expected;
+    const bool accepted = single.RewriteBytes("delete_ab", input, &expected);
+    std::string output;
+    ASSERT_EQ(accepted, grm.RewriteBytes("bytes/delete_ab", input, &output))
+        << input;
+    if (accepted) EXPECT_EQ(expected, output) << input;
+  }
+}
+
+}  // namespace
+}  // namespace thrax
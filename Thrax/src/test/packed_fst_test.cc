@@ -0,0 +1,195 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/packed_fst.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "fst/arc.h"
+#include "fst/fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-compiler.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_triggers);
+DECLARE_bool(normalize_rule_epsilons);
+DECLARE_bool(pack_rules);
+DECLARE_bool(reorder_rule_states);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdPackedFst;
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "weighted"};
+
+// The weights leave no ties between outputs, so any best path will do.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+)";
+
+class PackedFstTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    FST_FLAGS_export_triggers = true;
+    grm_ = LoadTestGrammar(kGrammar, "packed_fst_test").release();
+    // Packed on loading.
+    FST_FLAGS_pack_rules = true;
+    packed_grm_ = LoadTestGrammar(kGrammar, "packed_fst_load_test").release();
+    FST_FLAGS_pack_rules = false;
+    // Packed on export, and loaded as stored.
+    FST_FLAGS_pack_exports = true;
+    exported_grm_ =
+        LoadTestGrammar(kGrammar, "packed_fst_export_test").release();
+    FST_FLAGS_pack_exports = false;
+    FST_FLAGS_export_triggers = false;
+  }
+
+  static void TearDownTestSuite() {
+    delete grm_;
+    delete packed_grm_;
+    delete exported_grm_;
+  }
+
+  static GrmManager *grm_;
+  static GrmManager *packed_grm_;
+  static GrmManager *exported_grm_;
+};
+
+GrmManager *PackedFstTest::grm_ = nullptr;
+GrmManager *PackedFstTest::packed_grm_ = nullptr;
+GrmManager *PackedFstTest::exported_grm_ = nullptr;
+
+// Checks that the rule rewrites every input as the unpacked rule does.
+void ExpectRewritesAgree(const ::fst::Fst<StdArc> &expected_rule,
+                         const ::fst::Fst<StdArc> &rule,
+                         const std::string &name) {
+  for (const auto &input : AllStrings("abcde", 4)) {
+    std::string expected;
+    ::fst::TropicalWeight expected_weight;
+    const bool accepted = ReferenceRewriteBytes(expected_rule, input,
+                                                &expected, &expected_weight);
+    std::string output;
+    ::fst::TropicalWeight weight;
+    ASSERT_EQ(accepted, ReferenceRewriteBytes(rule, input, &output, &weight))
+        << name << " on \"" << input << "\"";
+    if (!accepted) continue;
+    EXPECT_EQ(expected, output) << name << " on \"" << input << "\"";
+    EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight))
+        << name << " on \"" << input << "\"";
+  }
+}
+
+TEST_F(PackedFstTest, MatchesComposition) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    ASSERT_FALSE(::fst::IsPackedFst(*fst));
+    const auto packed = ::fst::MakePackedFst(
+        static_cast<const ::fst::ExpandedFst<StdArc> &>(*fst));
+    ASSERT_NE(packed, nullptr) << rule << " does not fit";
+    EXPECT_EQ(fst->NumStates(), packed->NumStates());
+    EXPECT_EQ(::fst::CountArcs(*fst), ::fst::CountArcs(*packed));
+    ExpectRewritesAgree(*fst, *packed, rule);
+  }
+}
+
+TEST_F(PackedFstTest, WriteReadRoundTrip) {
+  ASSERT_NE(grm_, nullptr);
+  const auto *fst = grm_->GetFst("weighted");
+  ASSERT_NE(fst, nullptr);
+  const auto packed = ::fst::MakePackedFst(
+      static_cast<const ::fst::ExpandedFst<StdArc> &>(*fst));
+  ASSERT_NE(packed, nullptr);
+  std::stringstream strm;
+  ASSERT_TRUE(packed->Write(strm, ::fst::FstWriteOptions("weighted")));
+  std::unique_ptr<::fst::Fst<StdArc>> read(
+      ::fst::Fst<StdArc>::Read(strm, ::fst::FstReadOptions("weighted")));
+  ASSERT_NE(read, nullptr);
+  EXPECT_TRUE(::fst::IsPackedFst(*read));
+  ExpectRewritesAgree(*fst, *read, "weighted");
+}
+
+TEST_F(PackedFstTest, RejectsWideLabels) {
+  ::fst::StdVectorFst fst;
+  const auto s = fst.AddState();
+  fst.SetStart(s);
+  fst.SetFinal(s);
+  fst.AddArc(s, StdArc(0x10000, 0x10000, s));
+  EXPECT_EQ(::fst::MakePackedFst(fst), nullptr);
+}
+
+// Rules are packed, whether on loading or on export, but their triggers are
+// not, and rewriting through prepared rules, which threads share, agrees
+// with composition.
+TEST_F(PackedFstTest, PacksRulesButNotTriggers) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *grm : {packed_grm_, exported_grm_}) {
+    ASSERT_NE(grm, nullptr);
+    for (const auto *rule : kRules) {
+      const auto *fst = grm->GetFst(rule);
+      ASSERT_NE(fst, nullptr);
+      EXPECT_TRUE(::fst::IsPackedFst(*fst)) << rule;
+      const auto *trigger = grm->GetFst(std::string(kTriggerFstPrefix) + rule);
+      ASSERT_NE(trigger, nullptr) << rule;
+      EXPECT_FALSE(::fst::IsPackedFst(*trigger)) << rule;
+      ExpectRewritesAgree(*grm_->GetFst(rule), *fst, rule);
+      const auto prepared = grm->PrepareRule(rule);
+      ASSERT_NE(prepared, nullptr);
+      for (const auto &input : AllStrings("abcde", 4)) {
+        std::string expected;
+        const bool accepted =
+            ReferenceRewriteBytes(*grm_->GetFst(rule), input, &expected);
+        std::string output;
+        ASSERT_EQ(accepted, grm->RewriteBytes(*prepared, input, &output))
+            << rule << " on \"" << input << "\"";
+        if (accepted) {
+          EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+        }
+      }
+    }
+  }
+}
+
+// The passes which edit rules on loading leave rules stored packed alone
+// rather than unpacking them.
+TEST_F(PackedFstTest, KeepsStoredRulesPacked) {
+  ASSERT_NE(grm_, nullptr);
+  FST_FLAGS_pack_exports = true;
+  FST_FLAGS_normalize_rule_epsilons = true;
+  FST_FLAGS_reorder_rule_states = true;
+  auto grm = LoadTestGrammar(kGrammar, "packed_fst_kept_test");
+  FST_FLAGS_pack_exports = false;
+  FST_FLAGS_normalize_rule_epsilons = false;
+  FST_FLAGS_reorder_rule_states = false;
+  ASSERT_NE(grm, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    EXPECT_TRUE(::fst::IsPackedFst(*fst)) << rule;
+    ExpectRewritesAgree(*grm_->GetFst(rule), *fst, rule);
+  }
+}
+
+}  // namespace
+}  // namespace thrax
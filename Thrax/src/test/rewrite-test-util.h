@@ -0,0 +1,128 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Helpers shared by the tests of the rewrite kernels, which check each kernel
+// against the composition of the input with the rule followed by the shortest
+// path, on grammars compiled from source by the test itself.
+
+#ifndef NLP_GRM_LANGUAGE_TEST_REWRITE_TEST_UTIL_H_
+#define NLP_GRM_LANGUAGE_TEST_REWRITE_TEST_UTIL_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "fst/arcsort.h"
+#include "fst/compose.h"
+#include "fst/fst.h"
+#include "fst/shortest-path.h"
+#include "fst/string.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/algo/stringcompile.h"
+#include "thrax/grm-compiler.h"
+#include "thrax/grm-manager.h"
+
+namespace thrax {
+
+// Compiles the grammar source and writes its exports to a FAR named `name` in
+// the test's temporary directory, returning the path of the FAR, or the empty
+// string if the grammar fails to compile. The compiler flags in effect (e.g.
+// --sequentialize_exports) apply.
+inline std::string CompileTestGrammar(const std::string &source,
+                                      const std::string &name) {
+  // Each grammar numbers its generated labels afresh, as a run of the
+  // compiler would.
+  ::fst::thrax_internal::ResetGeneratedSymbols();
+  GrmCompilerSpec<::fst::StdArc> compiler;
+  if (!compiler.ParseContents(source) || !compiler.EvaluateAst()) return "";
+  const auto path = ::testing::TempDir() + "/" + name + ".far";
+  compiler.GetGrmManager()->ExportFar(path);
+  return path;
+}
+
+// Compiles the grammar source and loads it into a new manager, as a FAR
+// would be loaded at runtime. Returns nullptr on failure.
+inline std::unique_ptr<GrmManager> LoadTestGrammar(const std::string &source,
+                                                   const std::string &name) {
+  const auto path = CompileTestGrammar(source, name);
+  if (path.empty()) return nullptr;
+  auto grm = std::make_unique<GrmManager>();
+  if (!grm->LoadArchive(path)) return nullptr;
+  return grm;
+}
+
+// Reads the output bytes and weight of the shortest path of the lattice.
+// Returns false if the lattice has no path.
+inline bool ShortestPathBytes(const ::fst::Fst<::fst::StdArc> &lattice,
+                              std::string *output,
+                              ::fst::TropicalWeight *weight = nullptr) {
+  ::fst::StdVectorFst path;
+  ::fst::ShortestPath(lattice, &path);
+  if (path.Start() == ::fst::kNoStateId) return false;
+  output->clear();
+  auto total = ::fst::TropicalWeight::One();
+  auto s = path.Start();
+  while (path.NumArcs(s) > 0) {
+    ::fst::ArcIterator<::fst::StdVectorFst> aiter(path, s);
+    const auto &arc = aiter.Value();
+    if (arc.olabel != 0) output->push_back(static_cast<char>(arc.olabel));
+    total = ::fst::Times(total, arc.weight);
+    s = arc.nextstate;
+  }
+  if (weight) *weight = ::fst::Times(total, path.Final(s));
+  return true;
+}
+
+// Compiles the byte string as GrmManager does.
+inline ::fst::StdVectorFst CompileBytes(const std::string &input) {
+  const ::fst::StringCompiler<::fst::StdArc> compiler(::fst::TokenType::BYTE);
+  ::fst::StdVectorFst input_fst;
+  compiler(input, &input_fst);
+  return input_fst;
+}
+
+// Rewrites the byte string with the rule by composition and the shortest
+// path, which is what every rewrite kernel must agree with. Returns false if
+// the rule rejects the input.
+inline bool ReferenceRewriteBytes(const ::fst::Fst<::fst::StdArc> &rule,
+                                  const std::string &input,
+                                  std::string *output,
+                                  ::fst::TropicalWeight *weight = nullptr) {
+  auto input_fst = CompileBytes(input);
+  ::fst::ArcSort(&input_fst, ::fst::OLabelCompare<::fst::StdArc>());
+  ::fst::StdVectorFst lattice;
+  ::fst::Compose(input_fst, rule, &lattice);
+  return ShortestPathBytes(lattice, output, weight);
+}
+
+// Inputs for the tests: every string over the alphabet up to the given
+// length, shortest first.
+inline std::vector<std::string> AllStrings(const std::string &alphabet,
+                                           int max_length) {
+  std::vector<std::string> strings = {""};
+  for (size_t begin = 0, end = 1; max_length > 0; --max_length) {
+    for (size_t i = begin; i < end; ++i) {
+      for (const auto ch : alphabet) strings.push_back(strings[i] + ch);
+    }
+    begin = end;
+    end = strings.size();
+  }
+  return strings;
+}
+
+}  // namespace thrax
+
+#endif  // NLP_GRM_LANGUAGE_TEST_REWRITE_TEST_UTIL_H_
@@ -0,0 +1,242 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/rewrite-executor.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "fst/arc.h"
+#include "fst/union.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_int32(rewrite_threads);
+DECLARE_int32(rewrite_queue_depth);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdVectorFst;
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+)";
+
+// Occupies the single thread of an executor until released.
+class Blocker {
+ public:
+  explicit Blocker(RewriteExecutor *executor) {
+    auto started = std::make_shared<std::promise<void>>();
+    auto start_future = started->get_future();
+    auto release = release_.get_future().share();
+    EXPECT_TRUE(executor->TrySubmit([started, release] {
+      started->set_value();
+      release.wait();
+    }));
+    start_future.wait();
+  }
+
+  ~Blocker() { Release(); }
+
+  void Release() {
+    if (!released_) release_.set_value();
+    released_ = true;
+  }
+
+ private:
+  std::promise<void> release_;
+  bool released_ = false;
+};
+
+TEST(RewriteExecutorTest, RunsEveryTask) {
+  std::atomic<int> count{0};
+  {
+    RewriteExecutor executor(3, 100);
+    EXPECT_EQ(3, executor.NumThreads());
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(executor.TrySubmit([&count] { ++count; }));
+    }
+  }
+  // The destructor runs the tasks still queued.
+  EXPECT_EQ(100, count);
+}
+
+TEST(RewriteExecutorTest, RejectsWhenQueueIsFull) {
+  std::atomic<int> count{0};
+  {
+    RewriteExecutor executor(1, 1);
+    Blocker blocker(&executor);
+    EXPECT_TRUE(executor.TrySubmit([&count] { ++count; }));
+    EXPECT_EQ(1u, executor.QueueDepth());
+    EXPECT_FALSE(executor.TrySubmit([&count] { count += 10; }));
+    blocker.Release();
+  }
+  EXPECT_EQ(1, count);
+}
+
+// Helper tasks have a queue of their own, so they never take the place of
+// requests.
+TEST(RewriteExecutorTest, QueuesHelpersApart) {
+  std::atomic<int> count{0};
+  {
+    RewriteExecutor executor(1, 1);
+    Blocker blocker(&executor);
+    EXPECT_TRUE(executor.TrySubmitHelper([&count] { ++count; }));
+    EXPECT_FALSE(executor.TrySubmitHelper([&count] { ++count; }));
+    EXPECT_EQ(0u, executor.QueueDepth());
+    EXPECT_TRUE(executor.TrySubmit([&count] { ++count; }));
+    EXPECT_FALSE(executor.TrySubmit([&count] { ++count; }));
+    blocker.Release();
+  }
+  EXPECT_EQ(2, count);
+}
+
+TEST(RewriteExecutorTest, RunsTasksInlineWithoutThreads) {
+  RewriteExecutor executor(0, 1);
+  EXPECT_EQ(0, executor.NumThreads());
+  int count = 0;
+  EXPECT_TRUE(executor.TrySubmit([&count] { ++count; }));
+  EXPECT_TRUE(executor.TrySubmit([&count] { ++count; }));
+  EXPECT_EQ(2, count);
+}
+
+class RewriteAsyncTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "rewrite_executor_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *RewriteAsyncTest::grm_ = nullptr;
+
+TEST_F(RewriteAsyncTest, RewritesAsRewriteBytesDoes) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto &input : AllStrings("abcd", 3)) {
+    std::string expected;
+    ASSERT_TRUE(grm_->RewriteBytes("replace_ab", input, &expected));
+    auto result = grm_->RewriteAsync("replace_ab", input).get();
+    EXPECT_EQ(RewriteStatus::kOk, result.status) << input;
+    EXPECT_EQ(expected, result.output) << input;
+  }
+}
+
+TEST_F(RewriteAsyncTest, FailsOnRejectedInputOrMissingRule) {
+  ASSERT_NE(grm_, nullptr);
+  EXPECT_EQ(RewriteStatus::kFailed,
+            grm_->RewriteAsync("replace_ab", "abe").get().status);
+  const auto result = grm_->RewriteAsync("missing", "ab").get();
+  EXPECT_EQ(RewriteStatus::kFailed, result.status);
+  EXPECT_TRUE(result.output.empty());
+}
+
+TEST_F(RewriteAsyncTest, StopsWhenCancelled) {
+  ASSERT_NE(grm_, nullptr);
+  auto control = std::make_shared<RewriteControl>();
+  control->Cancel();
+  const auto result = grm_->RewriteAsync("replace_ab", "abab", control).get();
+  EXPECT_EQ(RewriteStatus::kCancelled, result.status);
+  EXPECT_TRUE(result.output.empty());
+}
+
+TEST_F(RewriteAsyncTest, StopsAtTheDeadline) {
+  ASSERT_NE(grm_, nullptr);
+  auto control = std::make_shared<RewriteControl>(
+      RewriteControl::Clock::now() - std::chrono::seconds(1));
+  const auto result = grm_->RewriteAsync("replace_ab", "abab", control).get();
+  EXPECT_EQ(RewriteStatus::kDeadlineExceeded, result.status);
+  EXPECT_TRUE(result.output.empty());
+  // A deadline yet to come lets the rewrite finish.
+  control = std::make_shared<RewriteControl>(RewriteControl::Clock::now() +
+                                             std::chrono::hours(1));
+  EXPECT_EQ(RewriteStatus::kOk,
+            grm_->RewriteAsync("replace_ab", "abab", control).get().status);
+}
+
+// An input which is not a string takes general composition, which a control
+// can stop as well; until it does, the result is the same as without one.
+TEST_F(RewriteAsyncTest, ControlsGeneralComposition) {
+  ASSERT_NE(grm_, nullptr);
+  const auto prepared = grm_->PrepareRule("replace_ab");
+  ASSERT_NE(prepared, nullptr);
+  auto input = CompileBytes("cabd");
+  ::fst::Union(&input, CompileBytes("abab"));
+  StdVectorFst expected;
+  ASSERT_TRUE(grm_->Rewrite(*prepared, input, &expected));
+  const RewriteControl control;
+  StdVectorFst output;
+  ASSERT_TRUE(grm_->Rewrite(*prepared, input, &output, &control));
+  EXPECT_EQ(expected.NumStates(), output.NumStates());
+  std::string expected_bytes;
+  ASSERT_TRUE(grm_->RewriteBytes(*prepared, input, &expected_bytes));
+  std::string output_bytes;
+  ASSERT_TRUE(grm_->RewriteBytes(*prepared, input, &output_bytes, &control));
+  EXPECT_EQ(expected_bytes, output_bytes);
+  RewriteControl cancelled;
+  cancelled.Cancel();
+  EXPECT_FALSE(grm_->Rewrite(*prepared, input, &output, &cancelled));
+}
+
+// With the only thread busy and room for one waiting request, the help a
+// batch leaves queued does not get the next request rejected.
+TEST(RewriteManyTest, DoesNotCrowdOutRewriteAsync) {
+  const auto threads = FST_FLAGS_rewrite_threads;
+  const auto queue_depth = FST_FLAGS_rewrite_queue_depth;
+  FST_FLAGS_rewrite_threads = 1;
+  FST_FLAGS_rewrite_queue_depth = 1;
+  // A fresh manager, whose executor is created with the flags above.
+  auto grm = LoadTestGrammar(kGrammar, "rewrite_executor_mixed_test");
+  ASSERT_NE(grm, nullptr);
+  // Occupies the thread with a request whose callback waits to be released.
+  std::promise<void> started;
+  std::promise<void> release;
+  auto release_future = release.get_future().share();
+  grm->RewriteAsync("replace_ab", "ab", nullptr,
+                    [&started, release_future](RewriteResult) {
+                      started.set_value();
+                      release_future.wait();
+                    });
+  started.get_future().wait();
+  // The batch finishes on the calling thread, leaving its helper queued.
+  const auto results = grm->RewriteMany(
+      "abab", {"replace_ab", "replace_ab", "missing"}, /*parallel=*/true);
+  ASSERT_EQ(3u, results.size());
+  EXPECT_EQ(RewriteStatus::kOk, results[0].status);
+  EXPECT_EQ("xx", results[0].output);
+  EXPECT_EQ(RewriteStatus::kOk, results[1].status);
+  EXPECT_EQ(RewriteStatus::kFailed, results[2].status);
+  auto queued = grm->RewriteAsync("replace_ab", "cab");
+  // The queue of requests is now full.
+  EXPECT_EQ(RewriteStatus::kRejected,
+            grm->RewriteAsync("replace_ab", "abc").get().status);
+  release.set_value();
+  const auto result = queued.get();
+  EXPECT_EQ(RewriteStatus::kOk, result.status);
+  EXPECT_EQ("cx", result.output);
+  FST_FLAGS_rewrite_threads = threads;
+  FST_FLAGS_rewrite_queue_depth = queue_depth;
+}
+
+}  // namespace
+}  // namespace thrax
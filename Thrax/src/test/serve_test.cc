@@ -0,0 +1,155 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <../bin/serve-utils.h>
+
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "rewrite-test-util.h"
+
+namespace thrax {
+namespace {
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d" | "[10]";
+export newline = CDRewrite["a" : "[10]", "", "", sigma*];
+export upper = CDRewrite["b" : "B", "", "", sigma*];
+)";
+
+TEST(EscapeFieldTest, RoundTrips) {
+  for (const auto &field :
+       {std::string(""), std::string("abc"), std::string("a\nb\tc\\d"),
+        std::string("\\n"), std::string("\n\n"), std::string("x\\")}) {
+    const auto escaped = EscapeField(field);
+    EXPECT_EQ(std::string::npos, escaped.find('\n')) << escaped;
+    EXPECT_EQ(std::string::npos, escaped.find('\t')) << escaped;
+    std::string unescaped;
+    ASSERT_TRUE(UnescapeField(escaped, &unescaped)) << escaped;
+    EXPECT_EQ(field, unescaped);
+  }
+  EXPECT_EQ("a\\nb\\tc\\\\", EscapeField("a\nb\tc\\"));
+}
+
+TEST(EscapeFieldTest, RejectsBadEscapes) {
+  std::string output;
+  EXPECT_FALSE(UnescapeField("a\\q", &output));
+  EXPECT_FALSE(UnescapeField("a\\", &output));
+}
+
+class ServeTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const auto far = CompileTestGrammar(kGrammar, "serve_test");
+    ASSERT_FALSE(far.empty());
+    server_ = std::make_unique<RewriteServer>(/*num_threads=*/2,
+                                              /*max_queue_depth=*/16,
+                                              /*max_batch_size=*/4,
+                                              /*max_batch_delay_us=*/100);
+    ASSERT_TRUE(server_->Load(far));
+  }
+
+  // Sends the lines as one client and reads back the given number of reply
+  // lines, which may arrive in any order.
+  std::vector<std::string> Exchange(const std::vector<std::string> &requests,
+                                    size_t num_replies) {
+    int to_server[2];
+    int from_server[2];
+    EXPECT_EQ(0, pipe(to_server));
+    EXPECT_EQ(0, pipe(from_server));
+    std::string data;
+    for (const auto &request : requests) data += request + '\n';
+    EXPECT_EQ(static_cast<ssize_t>(data.size()),
+              write(to_server[1], data.data(), data.size()));
+    close(to_server[1]);
+    // The connection closes its descriptors once every request is answered.
+    server_->Serve(
+        std::make_shared<ServeConnection>(to_server[0], from_server[1]));
+    ServeConnection reader(from_server[0], STDOUT_FILENO);
+    std::vector<std::string> replies;
+    std::string line;
+    while (replies.size() < num_replies && reader.ReadLine(&line)) {
+      replies.push_back(line);
+    }
+    return replies;
+  }
+
+  std::unique_ptr<RewriteServer> server_;
+};
+
+// Returns the reply to each request id.
+std::map<std::string, std::string> ById(
+    const std::vector<std::string> &replies) {
+  std::map<std::string, std::string> by_id;
+  for (const auto &reply : replies) {
+    const auto tab = reply.find('\t');
+    by_id[reply.substr(0, tab)] =
+        tab == std::string::npos ? "" : reply.substr(tab + 1);
+  }
+  return by_id;
+}
+
+TEST_F(ServeTest, AnswersEachRequest) {
+  auto replies = ById(Exchange({"1\tnewline\tab",
+                                "2\tnewline,upper\tb\\nab",
+                                "3\tmissing\tab",
+                                "4\tnewline\tae",
+                                "5\tnewline\ta\\q",
+                                "6"},
+                               6));
+  ASSERT_EQ(6u, replies.size());
+  // Newlines in the output are escaped, so every reply stays on one line.
+  EXPECT_EQ("OK\t\\nb", replies["1"]);
+  EXPECT_EQ("OK\tB\\n\\nB", replies["2"]);
+  EXPECT_EQ("ERROR\t", replies["3"]);
+  EXPECT_EQ("FAILED\t", replies["4"]);
+  EXPECT_EQ("ERROR\t", replies["5"]);
+  EXPECT_EQ("ERROR\t", replies["6"]);
+}
+
+TEST_F(ServeTest, KeepsStatsPerRule) {
+  ASSERT_EQ(4u, Exchange({"1\tnewline\tab", "2\tnewline,upper\tab",
+                          "3\tupper\te", "4\tmissing\tab"},
+                         4)
+                    .size());
+  const auto lines = Exchange({"!stats"}, 3);
+  ASSERT_EQ(3u, lines.size());
+  std::map<std::string, std::vector<std::string>> stats;
+  for (const auto &line : lines) {
+    if (line.empty()) continue;
+    auto fields = ::fst::StringSplit(line, '\t');
+    ASSERT_EQ(6u, fields.size()) << line;
+    stats[fields[0]] = std::vector<std::string>(fields.begin() + 1,
+                                                fields.begin() + 3);
+  }
+  // Unknown rules are not counted, and requests through the cascade count
+  // towards both of its rules.
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ((std::vector<std::string>{"2", "0"}), stats["newline"]);
+  EXPECT_EQ((std::vector<std::string>{"2", "1"}), stats["upper"]);
+  EXPECT_TRUE(lines.back().empty());
+}
+
+TEST(ListenOnSocketTest, RejectsLongPath) {
+  RewriteServer server(1, 1, 1, 1);
+  EXPECT_FALSE(ListenOnSocket(std::string(200, 'x'), &server));
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,146 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/shared-fst-registry.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "fst/arc.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/algo/packed_fst.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(pack_rules);
+DECLARE_bool(share_identical_rules);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using Transducer = ::fst::Fst<StdArc>;
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+)";
+
+StdVectorFst MakeFst(StdArc::Label label) {
+  StdVectorFst fst;
+  const auto s = fst.AddState();
+  fst.SetStart(s);
+  fst.SetFinal(s);
+  fst.AddArc(s, StdArc(label, label, s));
+  return fst;
+}
+
+TEST(SharedFstRegistryTest, SharesIdenticalVectorFsts) {
+  auto *registry = SharedFstRegistry<StdArc>::Get();
+  std::unique_ptr<const Transducer> fst1(new StdVectorFst(MakeFst(1000)));
+  std::unique_ptr<const Transducer> fst2(new StdVectorFst(MakeFst(1000)));
+  std::unique_ptr<const Transducer> fst3(new StdVectorFst(MakeFst(1001)));
+  std::shared_ptr<const Transducer> holder1, holder2, holder3;
+  EXPECT_FALSE(registry->Share(&fst1, &holder1));
+  EXPECT_TRUE(registry->Share(&fst2, &holder2));
+  EXPECT_EQ(holder1, holder2);
+  EXPECT_FALSE(registry->Share(&fst3, &holder3));
+  EXPECT_NE(holder1, holder3);
+}
+
+TEST(SharedFstRegistryTest, LeavesPackedFstsAlone) {
+  auto *registry = SharedFstRegistry<StdArc>::Get();
+  const auto fst = MakeFst(2000);
+  std::unique_ptr<const Transducer> packed1 = ::fst::MakePackedFst(fst);
+  std::unique_ptr<const Transducer> packed2 = ::fst::MakePackedFst(fst);
+  ASSERT_NE(packed1, nullptr);
+  ASSERT_NE(packed2, nullptr);
+  const auto *original = packed2.get();
+  std::shared_ptr<const Transducer> holder1, holder2;
+  EXPECT_FALSE(registry->Share(&packed1, &holder1));
+  EXPECT_EQ(holder1, nullptr);
+  EXPECT_FALSE(registry->Share(&packed2, &holder2));
+  EXPECT_EQ(holder2, nullptr);
+  EXPECT_EQ(original, packed2.get());
+}
+
+// Managers loading the same grammar share its rules, unless they are packed.
+TEST(SharedFstRegistryTest, ManagersShareRules) {
+  FST_FLAGS_share_identical_rules = true;
+  const auto first = LoadTestGrammar(kGrammar, "shared_fst_registry_test");
+  const auto second = LoadTestGrammar(kGrammar, "shared_fst_registry_test");
+  FST_FLAGS_pack_rules = true;
+  const auto packed =
+      LoadTestGrammar(kGrammar, "shared_fst_registry_packed_test");
+  const auto packed_again =
+      LoadTestGrammar(kGrammar, "shared_fst_registry_packed_test");
+  FST_FLAGS_pack_rules = false;
+  FST_FLAGS_share_identical_rules = false;
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  ASSERT_NE(packed, nullptr);
+  ASSERT_NE(packed_again, nullptr);
+  for (const auto &rule : second->MemoryUsage().rules) {
+    if (rule.name == "replace_ab" || rule.name == "insert") {
+      EXPECT_TRUE(rule.shared) << rule.name;
+    }
+  }
+  for (const auto &rule : packed_again->MemoryUsage().rules) {
+    if (::fst::IsPackedFst(*packed_again->GetFst(rule.name))) {
+      EXPECT_FALSE(rule.shared) << rule.name;
+    }
+  }
+  for (const auto &input : AllStrings("abcd", 4)) {
+    std::string expected;
+    ASSERT_TRUE(first->RewriteBytes("replace_ab", input, &expected));
+    std::string output;
+    ASSERT_TRUE(second->RewriteBytes("replace_ab", input, &output));
+    EXPECT_EQ(expected, output);
+  }
+}
+
+// A manager lets go of the registered FSTs of the rules it removes or
+// replaces, so that later managers no longer share them.
+TEST(SharedFstRegistryTest, ReleasesRemovedRules) {
+  constexpr char kReleasedGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export kept = CDRewrite["ca" : "y", "", "", sigma*];
+export removed = CDRewrite["cb" : "y", "", "", sigma*];
+export replaced = CDRewrite["cc" : "y", "", "", sigma*];
+)";
+  FST_FLAGS_share_identical_rules = true;
+  const auto first =
+      LoadTestGrammar(kReleasedGrammar, "shared_fst_registry_released_test");
+  ASSERT_NE(first, nullptr);
+  first->RemoveFst("removed");
+  ASSERT_TRUE(first->SetFst("replaced", *first->GetFst("kept")));
+  const auto second =
+      LoadTestGrammar(kReleasedGrammar, "shared_fst_registry_released_test");
+  FST_FLAGS_share_identical_rules = false;
+  ASSERT_NE(second, nullptr);
+  std::map<std::string, bool> shared;
+  for (const auto &rule : second->MemoryUsage().rules) {
+    shared[rule.name] = rule.shared;
+  }
+  EXPECT_TRUE(shared["kept"]);
+  EXPECT_FALSE(shared["removed"]);
+  EXPECT_FALSE(shared["replaced"]);
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,176 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/state_order.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(reorder_rule_states);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using ::fst::TropicalWeight;
+
+// The weights leave no ties between outputs, so any best path will do.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+export fixed = ("ab" : "x") | ("abc" : "yz") <1.0> | ("d" : "") <2.0>;
+)";
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "weighted", "fixed"};
+
+class StateOrderTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "state_order_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *StateOrderTest::grm_ = nullptr;
+
+// Checks that the reordered FST rewrites every input as the original does.
+void ExpectRewritesAgree(const ::fst::Fst<StdArc> &original,
+                         const ::fst::Fst<StdArc> &reordered,
+                         const std::string &rule) {
+  for (const auto &input : AllStrings("abcde", 4)) {
+    std::string expected;
+    TropicalWeight expected_weight;
+    const bool accepted =
+        ReferenceRewriteBytes(original, input, &expected, &expected_weight);
+    std::string output;
+    TropicalWeight weight;
+    ASSERT_EQ(accepted,
+              ReferenceRewriteBytes(reordered, input, &output, &weight))
+        << rule << " on \"" << input << "\"";
+    if (!accepted) continue;
+    EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+    EXPECT_TRUE(::fst::ApproxEqual(expected_weight, weight))
+        << rule << " on \"" << input << "\"";
+  }
+}
+
+// Checks that state i of the reordered FST is state states[i] of the
+// original, with the same final weight and the same arcs in the same order.
+void ExpectRenumbered(const StdVectorFst &original,
+                      const StdVectorFst &reordered,
+                      const std::vector<int> &states, const std::string &rule) {
+  ASSERT_EQ(original.NumStates(), static_cast<int>(states.size())) << rule;
+  ASSERT_EQ(original.NumStates(), reordered.NumStates()) << rule;
+  std::vector<int> order(states.size(), -1);
+  for (size_t i = 0; i < states.size(); ++i) order[states[i]] = i;
+  EXPECT_EQ(order[original.Start()], reordered.Start()) << rule;
+  for (int s = 0; s < reordered.NumStates(); ++s) {
+    const auto t = states[s];
+    EXPECT_EQ(original.Final(t), reordered.Final(s)) << rule;
+    ASSERT_EQ(original.NumArcs(t), reordered.NumArcs(s)) << rule;
+    ::fst::ArcIterator<StdVectorFst> aiter(original, t);
+    for (::fst::ArcIterator<StdVectorFst> raiter(reordered, s);
+         !raiter.Done(); raiter.Next(), aiter.Next()) {
+      const auto &arc = aiter.Value();
+      const auto &rearc = raiter.Value();
+      EXPECT_EQ(arc.ilabel, rearc.ilabel) << rule;
+      EXPECT_EQ(arc.olabel, rearc.olabel) << rule;
+      EXPECT_EQ(arc.weight, rearc.weight) << rule;
+      EXPECT_EQ(order[arc.nextstate], rearc.nextstate) << rule;
+    }
+  }
+}
+
+TEST_F(StateOrderTest, RenumbersBreadthFirst) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *rule : kRules) {
+    const StdVectorFst original(*grm_->GetFst(rule));
+    const auto states = ::fst::BreadthFirstStates(original);
+    StdVectorFst reordered(original);
+    ::fst::ReorderStates(&reordered);
+    EXPECT_EQ(0, reordered.Start()) << rule;
+    ExpectRenumbered(original, reordered, states, rule);
+    ExpectRewritesAgree(original, reordered, rule);
+  }
+}
+
+// An acyclic FST comes out topologically sorted.
+TEST_F(StateOrderTest, KeepsAcyclicFstsSorted) {
+  ASSERT_NE(grm_, nullptr);
+  StdVectorFst reordered(*grm_->GetFst("fixed"));
+  ASSERT_EQ(::fst::kAcyclic, reordered.Properties(::fst::kAcyclic, true));
+  ::fst::ReorderStates(&reordered);
+  for (int s = 0; s < reordered.NumStates(); ++s) {
+    for (::fst::ArcIterator<StdVectorFst> aiter(reordered, s); !aiter.Done();
+         aiter.Next()) {
+      EXPECT_LT(s, aiter.Value().nextstate);
+    }
+  }
+}
+
+// Visited states come first, hottest first, and the others follow in
+// breadth-first order.
+TEST_F(StateOrderTest, PutsHotStatesFirst) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *rule : kRules) {
+    const StdVectorFst original(*grm_->GetFst(rule));
+    const int last = original.NumStates() - 1;
+    if (last < 2) continue;
+    // The counts stop short of the last state, which is then never visited.
+    std::vector<uint64> visits(last, 0);
+    visits[last - 1] = 10;
+    visits[0] = 5;
+    std::vector<int> states = {last - 1, 0};
+    for (const auto s : ::fst::BreadthFirstStates(original)) {
+      if (s != last - 1 && s != 0) states.push_back(s);
+    }
+    StdVectorFst reordered(original);
+    ::fst::ReorderStates(&reordered, &visits);
+    ExpectRenumbered(original, reordered, states, rule);
+    ExpectRewritesAgree(original, reordered, rule);
+  }
+}
+
+// Rules reordered on loading rewrite as they did before.
+TEST_F(StateOrderTest, ReorderedOnLoading) {
+  ASSERT_NE(grm_, nullptr);
+  FST_FLAGS_reorder_rule_states = true;
+  auto reordered_grm = LoadTestGrammar(kGrammar, "state_order_loaded_test");
+  FST_FLAGS_reorder_rule_states = false;
+  ASSERT_NE(reordered_grm, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *reordered = reordered_grm->GetFst(rule);
+    ASSERT_NE(reordered, nullptr);
+    EXPECT_EQ(0, reordered->Start()) << rule;
+    ExpectRewritesAgree(*grm_->GetFst(rule), *reordered, rule);
+  }
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,155 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/streaming_rewrite.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StreamingRewriter;
+using ::fst::ViterbiStatus;
+
+constexpr char kRules[][16] = {"replace_ab", "insert", "weighted",
+                               "optional"};
+
+// The weights leave no ties between outputs, so any best path will do.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+export optional = (sigma | ("b" : "bb") <-1.0>)*;
+)";
+
+class StreamingRewriteTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    grm_ = LoadTestGrammar(kGrammar, "streaming_rewrite_test").release();
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *StreamingRewriteTest::grm_ = nullptr;
+
+std::vector<std::string> TestInputs() {
+  auto inputs = AllStrings("abcde", 4);
+  for (const auto &input : {std::string("\0", 1), std::string("a\0b", 3),
+                            std::string("\0ab\0", 4), std::string("e\0", 2)}) {
+    inputs.push_back(input);
+  }
+  return inputs;
+}
+
+// Streams the input through the rewriter in chunks of the given size, and
+// returns whether the stream was accepted, setting the output to everything
+// the rewriter emitted.
+bool StreamBytes(StreamingRewriter<StdArc> *rewriter, const std::string &input,
+                 size_t chunk_size, std::string *output) {
+  output->clear();
+  const auto *data = reinterpret_cast<const unsigned char *>(input.data());
+  for (size_t begin = 0; begin < input.size(); begin += chunk_size) {
+    const auto end = std::min(begin + chunk_size, input.size());
+    if (rewriter->Write(data + begin, data + end, output) !=
+        ViterbiStatus::kSuccess) {
+      rewriter->Reset();
+      return false;
+    }
+  }
+  return rewriter->Flush(output) == ViterbiStatus::kSuccess;
+}
+
+TEST_F(StreamingRewriteTest, MatchesCompositionForAnyChunking) {
+  ASSERT_NE(grm_, nullptr);
+  for (const auto *rule : kRules) {
+    const auto *fst = grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    // The rewriter is reused across streams, as a RewriteStream is.
+    StreamingRewriter<StdArc> rewriter(*fst);
+    for (const auto &input : TestInputs()) {
+      std::string expected;
+      const bool accepted = ReferenceRewriteBytes(*fst, input, &expected);
+      for (const size_t chunk_size : {1, 2, 64}) {
+        std::string output;
+        ASSERT_EQ(accepted, StreamBytes(&rewriter, input, chunk_size, &output))
+            << rule << " on \"" << input << "\" in chunks of " << chunk_size;
+        if (accepted) {
+          EXPECT_EQ(expected, output)
+              << rule << " on \"" << input << "\" in chunks of "
+              << chunk_size;
+        }
+      }
+    }
+  }
+}
+
+// The output of a rule with a short delay comes out as the stream goes,
+// holding back only a few bytes however long the stream.
+TEST_F(StreamingRewriteTest, EmitsAsTheStreamGoes) {
+  ASSERT_NE(grm_, nullptr);
+  std::string input;
+  for (int i = 0; i < 100; ++i) input += "abcda";
+  std::string expected;
+  ASSERT_TRUE(
+      ReferenceRewriteBytes(*grm_->GetFst("replace_ab"), input, &expected));
+  auto stream = grm_->StartRewriteStream("replace_ab");
+  ASSERT_NE(stream, nullptr);
+  std::string output;
+  std::string streamed;
+  for (size_t begin = 0; begin < input.size(); begin += 3) {
+    ASSERT_TRUE(stream->Write(input.substr(begin, 3), &output));
+    streamed += output;
+    EXPECT_LE(stream->NumPending(), 2u);
+    ASSERT_EQ(expected.substr(0, streamed.size()), streamed);
+  }
+  // Only the pending bytes are left for the end.
+  EXPECT_LE(expected.size(), streamed.size() + 2);
+  ASSERT_TRUE(stream->Flush(&output));
+  streamed += output;
+  EXPECT_EQ(expected, streamed);
+}
+
+TEST_F(StreamingRewriteTest, RejectedStreamStaysRejected) {
+  ASSERT_NE(grm_, nullptr);
+  auto stream = grm_->StartRewriteStream("insert");
+  ASSERT_NE(stream, nullptr);
+  std::string output;
+  ASSERT_TRUE(stream->Write("ab", &output));
+  EXPECT_FALSE(stream->Write("e", &output));
+  EXPECT_FALSE(stream->Write("cd", &output));
+  EXPECT_FALSE(stream->Flush(&output));
+  // Flush() starts a new stream.
+  ASSERT_TRUE(stream->Write("bc", &output));
+  std::string streamed = output;
+  ASSERT_TRUE(stream->Flush(&output));
+  streamed += output;
+  EXPECT_EQ("bxc", streamed);
+}
+
+}  // namespace
+}  // namespace thrax
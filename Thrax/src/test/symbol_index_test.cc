@@ -0,0 +1,125 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/symbol-index.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "fst/arc.h"
+#include "fst/equal.h"
+#include "fst/string.h"
+#include "fst/symbol-table.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using ::fst::SymbolTable;
+
+// Checks that the index finds every symbol of the table both ways.
+void ExpectFindsAll(const SymbolIndex &index, const SymbolTable &symtab) {
+  EXPECT_EQ(symtab.NumSymbols(), index.NumSymbols());
+  for (const auto &item : symtab) {
+    EXPECT_EQ(item.Label(), index.Find(item.Symbol())) << item.Symbol();
+    std::string_view symbol;
+    ASSERT_TRUE(index.Find(item.Label(), &symbol)) << item.Label();
+    EXPECT_EQ(item.Symbol(), symbol);
+  }
+}
+
+// Checks that the index finds nothing for symbols and labels not in the
+// table.
+void ExpectMisses(const SymbolIndex &index, const SymbolTable &symtab) {
+  const std::string missing_symbols[] = {
+      "", "missing", "token", "token1x", "TOKEN1", std::string("\0", 1)};
+  for (const auto &symbol : missing_symbols) {
+    if (symtab.Find(symbol) != ::fst::kNoSymbol) continue;
+    EXPECT_EQ(::fst::kNoSymbol, index.Find(symbol)) << symbol;
+  }
+  for (const int64 label :
+       {int64{-2}, int64{-1}, int64{3}, int64{1} << 20, int64{1} << 40}) {
+    if (!symtab.Find(label).empty()) continue;
+    std::string_view symbol;
+    EXPECT_FALSE(index.Find(label, &symbol)) << label;
+  }
+}
+
+TEST(SymbolIndexTest, DenseLabels) {
+  SymbolTable symtab;
+  symtab.AddSymbol("<epsilon>", 0);
+  // Leaves label 3 out, so that the array indexed by label has a hole.
+  for (int64 i = 1; i < 5000; ++i) {
+    if (i != 3) symtab.AddSymbol("token" + std::to_string(i), i);
+  }
+  const auto index = SymbolIndex::Build(symtab);
+  ASSERT_NE(index, nullptr);
+  ExpectFindsAll(*index, symtab);
+  ExpectMisses(*index, symtab);
+}
+
+TEST(SymbolIndexTest, SparseLabels) {
+  SymbolTable symtab;
+  symtab.AddSymbol("<epsilon>", 0);
+  for (int64 i = 1; i < 5000; ++i) {
+    symtab.AddSymbol("token" + std::to_string(i), i * 1000003);
+  }
+  // Negative labels also make the index sparse.
+  SymbolTable negative;
+  negative.AddSymbol("minus", -5);
+  negative.AddSymbol("zero", 0);
+  negative.AddSymbol("one", 1);
+  for (const auto *table : {&symtab, &negative}) {
+    const auto index = SymbolIndex::Build(*table);
+    ASSERT_NE(index, nullptr);
+    ExpectFindsAll(*index, *table);
+    ExpectMisses(*index, *table);
+  }
+}
+
+TEST(SymbolIndexTest, EmptyTable) {
+  const SymbolTable symtab;
+  const auto index = SymbolIndex::Build(symtab);
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(0u, index->NumSymbols());
+  ExpectMisses(*index, symtab);
+}
+
+TEST(SymbolIndexTest, CompileSymbolsMatchesStringCompiler) {
+  SymbolTable symtab;
+  symtab.AddSymbol("<epsilon>", 0);
+  for (int64 i = 1; i < 100; ++i) {
+    symtab.AddSymbol("w" + std::to_string(i), 7 * i);
+  }
+  const auto index = SymbolIndex::Build(symtab);
+  ASSERT_NE(index, nullptr);
+  const ::fst::StringCompiler<StdArc> compiler(::fst::TokenType::SYMBOL,
+                                               &symtab);
+  for (const std::string input : {"w1 w2 w99", "w5  w5 ", "", "w42"}) {
+    StdVectorFst expected;
+    ASSERT_TRUE(compiler(input, &expected)) << input;
+    StdVectorFst fst;
+    ASSERT_TRUE(CompileSymbols(*index, input, &fst)) << input;
+    EXPECT_TRUE(::fst::Equal(expected, fst)) << input;
+  }
+  StdVectorFst fst;
+  EXPECT_FALSE(CompileSymbols(*index, "w1 w100", &fst));
+}
+
+}  // namespace
+}  // namespace thrax
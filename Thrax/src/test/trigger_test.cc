@@ -0,0 +1,96 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <string>
+
+#include "fst/arc.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_triggers);
+
+namespace thrax {
+namespace {
+
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+)";
+
+// A rule rewriting what the triggers of the rules above let through.
+constexpr char kReplacement[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_c = CDRewrite["c" : "y", "", "", sigma*];
+)";
+
+class TriggerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    FST_FLAGS_export_triggers = true;
+    grm_ = LoadTestGrammar(kGrammar, "trigger_test");
+    FST_FLAGS_export_triggers = false;
+    ASSERT_NE(grm_, nullptr);
+  }
+
+  // Checks that rewriting with the rule, triggers and all, agrees with
+  // composition on every short input.
+  void ExpectSound(const std::string &rule) {
+    for (const auto &input : AllStrings("abcd", 5)) {
+      std::string expected;
+      const bool accepted =
+          ReferenceRewriteBytes(*grm_->GetFst(rule), input, &expected);
+      std::string output;
+      ASSERT_EQ(accepted, grm_->RewriteBytes(rule, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+
+  std::unique_ptr<GrmManager> grm_;
+};
+
+TEST_F(TriggerTest, RewritesAgreeWithComposition) {
+  for (const auto *rule : {"replace_ab", "insert"}) {
+    ASSERT_NE(grm_->GetFst(std::string(kTriggerFstPrefix) + rule), nullptr)
+        << rule;
+    ExpectSound(rule);
+  }
+}
+
+TEST_F(TriggerTest, SetFstDropsTheTrigger) {
+  // The trigger of replace_ab lets "cd" through unchanged.
+  std::string output;
+  ASSERT_TRUE(grm_->RewriteBytes("replace_ab", "cd", &output));
+  EXPECT_EQ("cd", output);
+  const auto replacement = LoadTestGrammar(kReplacement, "trigger_test_new");
+  ASSERT_NE(replacement, nullptr);
+  ASSERT_TRUE(
+      grm_->SetFst("replace_ab", *replacement->GetFst("replace_c")));
+  EXPECT_EQ(grm_->GetFst(std::string(kTriggerFstPrefix) + "replace_ab"),
+            nullptr);
+  ASSERT_TRUE(grm_->RewriteBytes("replace_ab", "cd", &output));
+  EXPECT_EQ("yd", output);
+  ExpectSound("replace_ab");
+  // The other rule keeps its trigger.
+  EXPECT_NE(grm_->GetFst(std::string(kTriggerFstPrefix) + "insert"), nullptr);
+  ExpectSound("insert");
+}
+
+}  // namespace
+}  // namespace thrax
@@ -0,0 +1,192 @@
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thrax/algo/viterbi_rewrite.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fst/arc.h"
+#include "fst/compose.h"
+#include "fst/vector-fst.h"
+#include "gtest/gtest.h"
+#include "thrax/grm-manager.h"
+#include "rewrite-test-util.h"
+
+DECLARE_bool(export_triggers);
+DECLARE_bool(viterbi_rewrites);
+
+namespace thrax {
+namespace {
+
+using ::fst::StdArc;
+using ::fst::StdVectorFst;
+using ::fst::TropicalWeight;
+using ::fst::ViterbiRewriter;
+using ::fst::ViterbiStatus;
+
+// The weights leave no ties between outputs, so any best path will do.
+constexpr char kGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export replace_ab = CDRewrite["ab" : "x", "", "", sigma*];
+export insert = CDRewrite["" : "x", "b", "c", sigma*];
+export weighted = CDRewrite[("a" : "b") <1.0> | ("a" : "c") <2.0>, "", "d",
+                            sigma*];
+export optional = (sigma | ("b" : "bb") <-1.0>)*;
+)";
+
+// Every "a" has two best rewrites, so the search may break ties differently
+// from ShortestPath().
+constexpr char kAmbiguousGrammar[] = R"(
+sigma = "a" | "b" | "c" | "d";
+export tied = CDRewrite["a" : ("x" | "y"), "", "", sigma*];
+export tied_weighted = CDRewrite[("a" : "x") <1.0> | ("a" : "y") <1.0> |
+                                 ("ab" : "z") <2.0>, "", "", sigma*];
+)";
+
+class ViterbiRewriteTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    FST_FLAGS_export_triggers = true;
+    grm_ = LoadTestGrammar(kGrammar, "viterbi_rewrite_test").release();
+    FST_FLAGS_export_triggers = false;
+  }
+
+  static void TearDownTestSuite() { delete grm_; }
+
+  static GrmManager *grm_;
+};
+
+GrmManager *ViterbiRewriteTest::grm_ = nullptr;
+
+std::vector<std::string> TestInputs() {
+  auto inputs = AllStrings("abcde", 4);
+  for (const auto &input : {std::string("\0", 1), std::string("a\0b", 3),
+                            std::string("\0ab\0", 4), std::string("e\0", 2)}) {
+    inputs.push_back(input);
+  }
+  return inputs;
+}
+
+TEST_F(ViterbiRewriteTest, MatchesComposition) {
+  ASSERT_NE(grm_, nullptr);
+  ViterbiRewriter<StdArc> rewriter;
+  for (const auto *rule : {"replace_ab", "insert", "weighted", "optional"}) {
+    const auto *fst = grm_->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    for (const auto &input : TestInputs()) {
+      std::string expected;
+      const bool accepted = ReferenceRewriteBytes(*fst, input, &expected);
+      const auto *begin = reinterpret_cast<const unsigned char *>(input.data());
+      std::string output;
+      const auto status =
+          rewriter(*fst, begin, begin + input.size(), &output);
+      ASSERT_EQ(accepted ? ViterbiStatus::kSuccess : ViterbiStatus::kNoPath,
+                status)
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+}
+
+// Goes through the manager, which also tries the trigger and the input
+// alphabet of the rule before searching.
+TEST_F(ViterbiRewriteTest, PreparedRuleMatchesComposition) {
+  ASSERT_NE(grm_, nullptr);
+  FST_FLAGS_viterbi_rewrites = true;
+  for (const auto *rule : {"replace_ab", "insert", "weighted", "optional"}) {
+    const auto prepared = grm_->PrepareRule(rule);
+    ASSERT_NE(prepared, nullptr);
+    for (const auto &input : TestInputs()) {
+      std::string expected;
+      const bool accepted =
+          ReferenceRewriteBytes(*grm_->GetFst(rule), input, &expected);
+      std::string output;
+      ASSERT_EQ(accepted, grm_->RewriteBytes(*prepared, input, &output))
+          << rule << " on \"" << input << "\"";
+      if (accepted) {
+        EXPECT_EQ(expected, output) << rule << " on \"" << input << "\"";
+      }
+    }
+  }
+  FST_FLAGS_viterbi_rewrites = false;
+}
+
+// Returns the weight of the best path through the rule from input to output,
+// or Zero if there is none.
+TropicalWeight RewriteWeight(const ::fst::Fst<StdArc> &rule,
+                             const std::string &input,
+                             const std::string &output) {
+  const auto input_fst = CompileBytes(input);
+  const auto output_fst = CompileBytes(output);
+  StdVectorFst lattice;
+  ::fst::Compose(::fst::ComposeFst<StdArc>(input_fst, rule), output_fst,
+                 &lattice);
+  std::string path_output;
+  TropicalWeight weight;
+  if (!ShortestPathBytes(lattice, &path_output, &weight)) {
+    return TropicalWeight::Zero();
+  }
+  return weight;
+}
+
+// Without --viterbi_rewrites the manager composes, so that rewriting the
+// bytes breaks ties as rewriting the compiled string does. With it, the kernel
+// may pick another rewrite, but always one of the best.
+TEST(ViterbiRewriteTieTest, AmbiguousRewritesAgreeWithComposition) {
+  auto grm = LoadTestGrammar(kAmbiguousGrammar, "viterbi_rewrite_tie_test");
+  ASSERT_NE(grm, nullptr);
+  for (const auto *rule : {"tied", "tied_weighted"}) {
+    const auto *fst = grm->GetFst(rule);
+    ASSERT_NE(fst, nullptr);
+    const auto prepared = grm->PrepareRule(rule);
+    ASSERT_NE(prepared, nullptr);
+    for (const auto &input : AllStrings("abcd", 4)) {
+      std::string expected;
+      TropicalWeight expected_weight;
+      const bool accepted =
+          ReferenceRewriteBytes(*fst, input, &expected, &expected_weight);
+      ASSERT_TRUE(accepted) << rule << " on \"" << input << "\"";
+      std::string composed_output;
+      ASSERT_TRUE(grm->RewriteBytes(*prepared, CompileBytes(input),
+                                    &composed_output))
+          << rule << " on \"" << input << "\"";
+      EXPECT_TRUE(::fst::ApproxEqual(
+          expected_weight, RewriteWeight(*fst, input, composed_output)))
+          << rule << " on \"" << input << "\" gave \"" << composed_output
+          << "\"";
+      std::string output;
+      ASSERT_TRUE(grm->RewriteBytes(*prepared, input, &output))
+          << rule << " on \"" << input << "\"";
+      EXPECT_EQ(composed_output, output) << rule << " on \"" << input << "\"";
+      FST_FLAGS_viterbi_rewrites = true;
+      std::string viterbi_output;
+      const bool viterbi_accepted =
+          grm->RewriteBytes(*prepared, input, &viterbi_output);
+      FST_FLAGS_viterbi_rewrites = false;
+      ASSERT_TRUE(viterbi_accepted) << rule << " on \"" << input << "\"";
+      EXPECT_TRUE(::fst::ApproxEqual(expected_weight,
+                                     RewriteWeight(*fst, input,
+                                                   viterbi_output)))
+          << rule << " on \"" << input << "\" gave \"" << viterbi_output
+          << "\"";
+    }
+  }
+}
+
+}  // namespace
+}  // namespace thrax